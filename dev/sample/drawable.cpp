@@ -101,6 +101,9 @@ void entry(const Options & options) {
     // setup draw parameters of the drawable to have 3 non-indexed vertices.
     dr->draw(GraphicsPipeline::DrawParameters {}.setNonIndexed(3));
 
+    // create an upload batch to animate the uniform buffers.
+    auto ub = UploadBatch({{"animation"}, &q});
+
     // show the window and begin the rendering loop.
     glfw.show();
     for (;;) {
@@ -112,12 +115,13 @@ void entry(const Options & options) {
                 if (frame->index > options.headless) break; // render required number of frames in headless mode, then quit.
                 std::cout << "Frame " << frame->index << std::endl;
             }
-            // Animate the triangle. Note that this is not the most efficient way to animate things, since it serializes
-            // CPU and GPU. But it's simple and it is not the focus of this sample.
-            auto bc      = Buffer::SetContentParameters {}.setQueue(*device.graphics());
+            // Animate the triangle. The uploads are batched and submitted asynchronously to the same queue that
+            // renders the triangle. So there's no need to wait for them on CPU.
+            auto bc      = Buffer::SetContentParameters {};
             auto elapsed = (float) frame->index / 60.0f;
-            u0->setContent(bc.setData<float>({(float) std::sin(elapsed) * .25f, (float) std::cos(elapsed) * .25f}));
-            u1->setContent(bc.setData<float>({(float) std::sin(elapsed) * .5f + .5f, (float) std::cos(elapsed) * .5f + .5f, 1.f}));
+            ub.setContent(*u0, bc.setData<float>({(float) std::sin(elapsed) * .25f, (float) std::cos(elapsed) * .25f}));
+            ub.setContent(*u1, bc.setData<float>({(float) std::sin(elapsed) * .5f + .5f, (float) std::cos(elapsed) * .5f + .5f, 1.f}));
+            ub.submit();
 
             // acquire a command buffer
             auto c = q.begin("pipeline");
@@ -51,3 +51,91 @@ TEST_CASE("buffer-write-overflow") {
     // set content should not throw any error.
     buffer.setContent(content);
 }
+
+TEST_CASE("buffer-map-with-offset") {
+    using namespace rapid_vulkan;
+
+    auto gi = TestVulkanInstance::device->gi();
+#if RAPID_VULKAN_ENABLE_VMA
+    REQUIRE(gi->vmaAllocator);
+#endif
+
+    auto buffer = Buffer(Buffer::ConstructParameters {{"map-test"}, gi, 16}.setStaging());
+    {
+        auto m = Buffer::Map<uint32_t>(buffer);
+        REQUIRE(m.length == 4);
+        for (uint32_t i = 0; i < 4; ++i) m.data[i] = i;
+    }
+    {
+        // map the 2nd half of the buffer. The mapped pointer should point to the requested offset.
+        auto m = Buffer::Map<uint32_t>(buffer, 8);
+        REQUIRE(m.offset == 2);
+        REQUIRE(m.length == 2);
+        CHECK(2 == m.data[0]);
+        CHECK(3 == m.data[1]);
+    }
+}
+
+TEST_CASE("staging-ring") {
+    using namespace rapid_vulkan;
+
+    auto gi    = TestVulkanInstance::device->gi();
+    auto ring  = StagingRing({{"staging-ring-test"}, gi, 1024});
+    auto queue = TestVulkanInstance::device->graphics();
+    auto dst   = Buffer({{"staging-ring-dst"}, gi, 256});
+
+    // Upload through the ring many times, so that the ring wraps around.
+    for (uint32_t i = 0; i < 64; ++i) {
+        auto a = ring.allocate(256);
+        REQUIRE(a);
+        REQUIRE(!a.dedicated);
+        CHECK(a.offset + a.size <= ring.capacity());
+        memset(a.data, (int) i, a.size);
+        auto cb = queue->begin("staging-ring-test");
+        cb.handle().copyBuffer(a.buffer, dst.handle(), {{a.offset, 0, a.size}});
+        ring.release(a, queue->submit({{cb}}));
+    }
+
+    // Oversized allocation should fall back to dedicated buffer.
+    auto big = ring.allocate(4096);
+    REQUIRE(big);
+    CHECK(big.dedicated);
+    ring.release(big);
+
+    queue->waitIdle();
+    auto readback = dst.readContent(Buffer::ReadParameters {}.setQueue(*queue));
+    REQUIRE(readback.size() == 256);
+    CHECK(63 == readback[0]);
+    CHECK(63 == readback[255]);
+}
+
+TEST_CASE("upload-batch") {
+    using namespace rapid_vulkan;
+
+    auto gi    = TestVulkanInstance::device->gi();
+    auto queue = TestVulkanInstance::device->graphics();
+    auto batch = UploadBatch({{"upload-batch-test"}, queue});
+
+    std::vector<Ref<Buffer>> buffers;
+    for (uint32_t i = 0; i < 16; ++i) {
+        buffers.push_back(Ref<Buffer>::make(Buffer::ConstructParameters {{"upload-batch-buffer"}, gi, 4}));
+        batch.setContent(*buffers.back(), Buffer::SetContentParameters {}.setData(&i, 4));
+    }
+    CHECK(16 == batch.pending());
+
+    // all uploads are submitted in one go.
+    auto sid = batch.submit();
+    REQUIRE(sid);
+    CHECK(0 == batch.pending());
+    sid.wait();
+    CHECK(sid.finished());
+
+    for (uint32_t i = 0; i < 16; ++i) {
+        auto readback = buffers[i]->readContent(Buffer::ReadParameters {}.setQueue(*queue));
+        REQUIRE(readback.size() == 4);
+        CHECK(i == *(const uint32_t *) readback.data());
+    }
+
+    // submitting an empty batch is a no-op.
+    CHECK(!batch.submit());
+}
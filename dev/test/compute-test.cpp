@@ -2,6 +2,7 @@
 #include "../3rd-party/catch2/catch.hpp"
 #include "shader/argument-test.comp.spv.h"
 #include "shader/noop.comp.spv.h"
+#include "shader/specialization.comp.spv.h"
 #include "rdc.h"
 
 TEST_CASE("noop-compute") {
@@ -74,4 +75,341 @@ TEST_CASE("cs-buffer-args") {
     if (rdc) rdc.end();
     REQUIRE(c2.size() == 4);
     REQUIRE(*(const float *) c2.data() == 2.0f);
-}
\ No newline at end of file
+}
+
+TEST_CASE("descriptor-set-cache") {
+    using namespace rapid_vulkan;
+    auto at = ArgumentTestPipeline("descriptor-set-cache");
+    auto g  = TestVulkanInstance::device->graphics();
+    auto qp = CommandQueue::ConstructParameters {{"descriptor-set-cache"}, at.gi, g->family(), g->index()}.setDescriptorSetCacheCapacity(16);
+    auto q  = std::make_unique<CommandQueue>(qp);
+
+    // create 2 drawables that use different sets of buffers.
+    auto [d1, b1] = at.drawable(at.input(1.0f), 1.0f);
+    auto [d2, b2] = at.drawable(at.input(3.0f), 1.0f);
+
+    // render the 2 drawables interleaved over multiple frames. After the first frame, all sets should come from the cache.
+    for (int frame = 0; frame < 3; ++frame) {
+        auto c = q->begin("descriptor-set-cache");
+        for (int i = 0; i < 4; ++i) {
+            c.render(d1->compile());
+            Barrier().m(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead).cmdWrite(c);
+            c.render(d2->compile());
+        }
+        q->submit({c});
+    }
+    q->waitIdle();
+
+    auto r1 = b1->readContent({});
+    auto r2 = b2->readContent({});
+    REQUIRE(r1.size() == 4);
+    REQUIRE(r2.size() == 4);
+    CHECK(*(const float *) r1.data() == 2.0f);
+    CHECK(*(const float *) r2.data() == 4.0f);
+
+    // The cached sets keep the buffers alive through their draw packs, until the cache is cleared along with the queue.
+    d1 = nullptr;
+    d2 = nullptr;
+    CHECK(b1->refCount() > 1);
+    CHECK(b2->refCount() > 1);
+    q.reset();
+    CHECK(b1->refCount() == 1);
+    CHECK(b2->refCount() == 1);
+}
+
+TEST_CASE("redundant-state-filtering") {
+    using namespace rapid_vulkan;
+    auto at  = ArgumentTestPipeline("redundant-state-filtering");
+    auto src = at.input(1.0f);
+
+    // Drawables that share the pipeline and the input buffer, and only some of them share the push constant.
+    auto [d1, b1] = at.drawable(src, 1.0f);
+    auto [d2, b2] = at.drawable(src, 1.0f);
+    auto [d3, b3] = at.drawable(src, 5.0f);
+
+    // Render the same pack twice in a row, then packs that differ in the output buffer, and in the push constant.
+    auto q = TestVulkanInstance::device->graphics();
+    if (auto c = q->begin("redundant-state-filtering")) {
+        c.render(d1->compile()).render(d1->compile()).render(d2->compile()).render(d3->compile());
+        q->submit({c});
+    }
+    q->waitIdle();
+    CHECK(*(const float *) b1->readContent({}).data() == 2.0f);
+    CHECK(*(const float *) b2->readContent({}).data() == 2.0f);
+    CHECK(*(const float *) b3->readContent({}).data() == 6.0f);
+
+    // Packs that differ only in the output buffer, with another pipeline bound in between. The first bind goes through the
+    // raw handle, so the states are invalidated manually. The second one goes through the CommandBuffer object, which
+    // invalidates the states on its own. Either way, the packs should not be dispatched with the noop pipeline.
+    auto noopCs   = Shader(Shader::ConstructParameters {{"noop"}, at.gi}.setSpirv(noop_comp));
+    auto noop     = ComputePipeline({{"noop"}, &noopCs});
+    auto [d4, b4] = at.drawable(src, 1.0f);
+    auto [d5, b5] = at.drawable(src, 1.0f);
+    if (auto c = q->begin("redundant-state-filtering")) {
+        c.render(d1->compile());
+        noop.cmdDispatch(c.handle(), {1, 1, 1});
+        c.invalidateState().render(d4->compile());
+        noop.cmdDispatch(c, {1, 1, 1});
+        c.render(d5->compile());
+        q->submit({c});
+    }
+    q->waitIdle();
+    CHECK(*(const float *) b4->readContent({}).data() == 2.0f);
+    CHECK(*(const float *) b5->readContent({}).data() == 2.0f);
+}
+
+TEST_CASE("descriptor-update-template") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+    auto cs  = Shader(Shader::ConstructParameters {{"descriptor-update-template"}, gi}.setSpirv(argument_test_comp));
+    auto p   = Ref(new ComputePipeline({{"descriptor-update-template"}, &cs}));
+    if (gi->apiVersion >= VK_API_VERSION_1_1) CHECK(p->descriptorUpdateTemplate(0));
+    CHECK(!p->descriptorUpdateTemplate(100)); // out of range set index should return null template.
+
+    auto b1 = Ref(new Buffer({{"buf1"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+    auto b2 = Ref(new Buffer({{"buf2"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+    auto d  = Drawable({{"descriptor-update-template"}, p});
+    d.b({0, 0}, {{b1}});
+    d.b({0, 1}, {{b2}});
+    d.c(0, vk::ArrayProxy<const float> {1.0f});
+
+    // All descriptor infos of the set should be packed into one block, that the descriptor writes point into.
+    auto pack = d.compile();
+    REQUIRE(pack->descriptors.size() == 1);
+    REQUIRE(pack->descriptorOffsets.size() == 1);
+    REQUIRE(pack->descriptorBlock);
+    const auto & block = *pack->descriptorBlock;
+    for (const auto & w : pack->descriptors[0]) {
+        auto p0 = (const uint8_t *) w.pBufferInfo;
+        CHECK(block.data() + pack->descriptorOffsets[0] <= p0);
+        CHECK(p0 + sizeof(vk::DescriptorBufferInfo) <= block.data() + block.size());
+    }
+    CHECK(pack->dependencies.buffers.size() == 2);
+
+    // Recompiling with only the constant changed should share the descriptor block with the previous pack.
+    d.c(0, vk::ArrayProxy<const float> {2.0f});
+    auto pack2 = d.compile();
+    CHECK(pack2 != pack);
+    CHECK(pack2->descriptorBlock == pack->descriptorBlock);
+}
+
+TEST_CASE("push-constant-update") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+    auto cs  = Shader(Shader::ConstructParameters {{"push-constant-update"}, gi}.setSpirv(argument_test_comp));
+    auto p   = Ref(new ComputePipeline({{"push-constant-update"}, &cs}));
+    auto b1  = Ref(new Buffer({{"buf1"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+    auto b2  = Ref(new Buffer({{"buf2"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+    auto d   = Drawable({{"push-constant-update"}, p});
+    d.b({0, 0}, {{b1}});
+    d.b({0, 1}, {{b2}});
+
+    // Repeated updates overwrite the value in place. The pack always has one constant argument per stage.
+    for (int i = 0; i < 100; ++i) d.c(0, vk::ArrayProxy<const float> {(float) i});
+    auto pack = d.compile();
+    REQUIRE(pack->constants.size() == 1);
+    REQUIRE(pack->constants[0].value.size() >= sizeof(float));
+    CHECK(99.0f == *(const float *) pack->constants[0].value.data());
+
+    // Setting the same value again doesn't invalidate the compiled pack.
+    d.c(0, vk::ArrayProxy<const float> {99.0f});
+    CHECK(d.compile() == pack);
+
+    // A new value goes into a new pack, leaving the old one untouched.
+    d.c(0, vk::ArrayProxy<const float> {5.0f});
+    auto pack2 = d.compile();
+    CHECK(pack2 != pack);
+    CHECK(5.0f == *(const float *) pack2->constants[0].value.data());
+    CHECK(99.0f == *(const float *) pack->constants[0].value.data());
+}
+
+TEST_CASE("pipeline-cache") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+    REQUIRE(gi->pipelineCache);
+
+    // Every pipeline created by the library should go through the device wide pipeline cache.
+    auto stats  = [&]() { return gi->pipelineCache->stats(); };
+    auto total  = [&](const PipelineCache::Stats & s) { return s.hits + s.misses + s.unknown; };
+    auto before = total(stats());
+    auto noop   = Shader(Shader::ConstructParameters {{"noop"}, gi}.setSpirv(noop_comp));
+    auto p1     = ComputePipeline({{"noop-1"}, &noop});
+    auto p2     = ComputePipeline({{"noop-2"}, &noop});
+    CHECK(total(stats()) == before + 2);
+    if (gi->pipelineCreationFeedback) CHECK(stats().unknown == 0);
+
+    // Cache without path can't be saved.
+    CHECK(!PipelineCache({{"in-memory"}, gi}).save());
+
+    // Save the cache to file, then load it back.
+    auto path = std::string("rapid-vulkan-pipeline-cache-test.bin");
+    {
+        auto c = PipelineCache(PipelineCache::ConstructParameters {{"file-1"}, gi}.setPath(path));
+        CHECK(c.handle());
+        CHECK(c.save());
+    }
+    {
+        auto c = PipelineCache(PipelineCache::ConstructParameters {{"file-2"}, gi}.setPath(path));
+        CHECK(c.handle());
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("pipeline-registry") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+    REQUIRE(gi->pipelineRegistry);
+    auto & registry = *gi->pipelineRegistry;
+    registry.purge();
+
+    // Shaders with identical content should have identical hash, even if they are different objects.
+    auto cs1 = Shader(Shader::ConstructParameters {{"cs1"}, gi}.setSpirv(argument_test_comp));
+    auto cs2 = Shader(Shader::ConstructParameters {{"cs2"}, gi}.setSpirv(argument_test_comp));
+    auto cs3 = Shader(Shader::ConstructParameters {{"cs3"}, gi}.setSpirv(noop_comp));
+    CHECK(cs1.hash() == cs2.hash());
+    CHECK(cs1.hash() != cs3.hash());
+
+    // Identical parameters should return the same pipeline.
+    auto before = registry.stats();
+    auto p1     = registry.compute({{"p1"}, &cs1});
+    auto p2     = registry.compute({{"p2"}, &cs2});
+    auto p3     = registry.compute({{"p3"}, &cs3});
+    CHECK(p1 == p2);
+    CHECK(!(p1 == p3));
+    auto after = registry.stats();
+    CHECK(after.hits == before.hits + 1);
+    CHECK(after.misses == before.misses + 2);
+
+    // Pipelines created outside of the registry should share the layout too.
+    auto p4 = ComputePipeline({{"p4"}, &cs1});
+    CHECK(p4.layout() == p1->layout());
+    CHECK(p4.handle() != p1->handle());
+
+    // Objects that are still referenced should survive the purge.
+    p2.clear();
+    p3.clear();
+    registry.purge();
+    CHECK(registry.compute({{"p5"}, &cs1}) == p1);
+}
+
+TEST_CASE("async-pipeline") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+
+    // The shader is deleted right after the pipelines are created, to verify that async pipelines don't depend on it.
+    auto cs        = new Shader(Shader::ConstructParameters {{"async-pipeline"}, gi}.setSpirv(argument_test_comp));
+    auto sync      = Ref(new ComputePipeline({{"sync"}, cs}));
+    auto pipelines = std::vector<Ref<ComputePipeline>>();
+    for (int i = 0; i < 8; ++i) pipelines.push_back(Ref(new ComputePipeline(ComputePipeline::ConstructParameters {{"async"}, cs}.setAsync(true, sync))));
+
+    // Pipelines that are deleted before being compiled should be cleaned up by the worker threads.
+    for (int i = 0; i < 8; ++i) delete new ComputePipeline(ComputePipeline::ConstructParameters {{"abandoned"}, cs}.setAsync(true));
+    delete cs;
+
+    CHECK(sync->isReady());
+    for (const auto & p : pipelines) {
+        CHECK(p->fallback() == sync.get());
+        if (!p->isReady()) CHECK(!p->handle());
+        CHECK(p->wait());
+        CHECK(p->isReady());
+        CHECK(p->handle());
+    }
+
+    // Async pipeline should be usable by draw packs once it is ready.
+    auto b = Ref(new Buffer({{"buf"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+    auto d = Drawable({{"async-pipeline"}, pipelines[0]});
+    d.b({0, 0}, {{b}});
+    d.b({0, 1}, {{b}});
+    d.c(0, vk::ArrayProxy<const float> {1.0f});
+    d.dispatch(ComputePipeline::DispatchParameters {1, 1, 1});
+    auto q = CommandQueue({{"async-pipeline"}, gi, dev->graphics()->family(), dev->graphics()->index()});
+    if (auto c = q.begin("async-pipeline")) {
+        c.render(d.compile());
+        q.submit({c});
+    }
+    q.waitIdle();
+}
+
+TEST_CASE("shader-reflection-cache") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+
+    // Shaders with identical content should share the same reflection.
+    auto cs1 = Shader(Shader::ConstructParameters {{"cs1"}, gi}.setSpirv(argument_test_comp));
+    auto cs2 = Shader(Shader::ConstructParameters {{"cs2"}, gi}.setSpirv(argument_test_comp).setKeepSpirv(false));
+    REQUIRE(cs1.reflection());
+    CHECK(cs1.reflection() == cs2.reflection());
+    CHECK(cs1.checksum() == cs2.checksum());
+
+    // Shaders with different content should have different checksum and reflection.
+    auto cs3 = Shader(Shader::ConstructParameters {{"cs3"}, gi}.setSpirv(noop_comp));
+    CHECK(cs1.checksum() != cs3.checksum());
+    CHECK(cs1.reflection() != cs3.reflection());
+    CHECK(!cs1.spirv().empty());
+    CHECK(cs2.spirv().empty());
+    CHECK(!Shader::EMPTY.reflection());
+
+    // Shader w/o SPIR-V code should still be usable to create pipelines.
+    auto p1 = ComputePipeline({{"p1"}, &cs1});
+    auto p2 = ComputePipeline({{"p2"}, &cs2});
+    CHECK(p2.handle());
+    REQUIRE(p1.reflection().descriptors.size() == p2.reflection().descriptors.size());
+    CHECK(p1.reflection().descriptors[0].size() == p2.reflection().descriptors[0].size());
+    CHECK(p1.reflection().constants.size() == p2.reflection().constants.size());
+}
+
+TEST_CASE("specialization-constants") {
+    using namespace rapid_vulkan;
+    auto dev = TestVulkanInstance::device.get();
+    auto gi  = dev->gi();
+    auto cs  = Shader(Shader::ConstructParameters {{"specialization"}, gi}.setSpirv(specialization_comp));
+
+    // Named specialization constants should be reflected.
+    auto p0 = Ref(new ComputePipeline({{"default"}, &cs}));
+    auto it = p0->reflection().specializations.find("SCALE");
+    REQUIRE(it != p0->reflection().specializations.end());
+    CHECK(it->second.id == 0);
+    CHECK(it->second.size == sizeof(uint32_t));
+    CHECK(it->second.stages == vk::ShaderStageFlagBits::eCompute);
+
+    // Constants can be set either by name or by ID.
+    using CP = ComputePipeline::ConstructParameters;
+    auto p1  = Ref(new ComputePipeline(CP {{"by-name"}, &cs}.setSpecialization(SpecializationConstants().set("SCALE", 7u))));
+    auto p2  = Ref(new ComputePipeline(CP {{"by-id"}, &cs}.setSpecialization(SpecializationConstants().set(0, 9u))));
+
+    auto q   = CommandQueue({{"specialization"}, gi, dev->graphics()->family(), dev->graphics()->index()});
+    auto run = [&](Ref<ComputePipeline> p) {
+        auto b = Ref(new Buffer({{"output"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+        auto d = Drawable({{"specialization"}, p});
+        d.b({0, 0}, {{b}});
+        d.dispatch(ComputePipeline::DispatchParameters {1, 1, 1});
+        auto c = q.begin("specialization");
+        c.render(d.compile());
+        q.submit({c});
+        q.waitIdle();
+        auto r = b->readContent({});
+        REQUIRE(r.size() == 4);
+        return *(const uint32_t *) r.data();
+    };
+    CHECK(run(p0) == 1);
+    CHECK(run(p1) == 7);
+    CHECK(run(p2) == 9);
+
+    // Pipelines with different constants should not be shared by the registry.
+    auto & registry = *gi->pipelineRegistry;
+    auto   r1       = registry.compute(CP {{"r1"}, &cs}.setSpecialization(SpecializationConstants().set("SCALE", 7u)));
+    auto   r2       = registry.compute(CP {{"r2"}, &cs}.setSpecialization(SpecializationConstants().set("SCALE", 7u)));
+    auto   r3       = registry.compute(CP {{"r3"}, &cs}.setSpecialization(SpecializationConstants().set("SCALE", 8u)));
+    CHECK(r1 == r2);
+    CHECK(!(r1 == r3));
+
+    // The same value set by ID is the same pipeline.
+    auto r4 = registry.compute(CP {{"r4"}, &cs}.setSpecialization(SpecializationConstants().set(0, 7u)));
+    CHECK(r1 == r4);
+}
@@ -46,4 +46,62 @@ TEST_CASE("drawable-smoke") {
     REQUIRE(p2->dispatch.width == 4);
     REQUIRE(p2->dispatch.height == 5);
     REQUIRE(p2->dispatch.depth == 6);
-}
\ No newline at end of file
+}
+
+TEST_CASE("render-queue-sort") {
+    auto p1   = DummyPipeline::c();
+    auto p2   = DummyPipeline::c();
+    auto pack = [](Ref<const Pipeline> p, size_t width) {
+        auto d = Drawable({{}, p});
+        d.dispatch({width, 1, 1});
+        return d.compile();
+    };
+
+    // Packs should be grouped by pipeline in order of first appearance, then sorted by key.
+    auto q = RenderQueue();
+    q.add(pack(p1, 1), 3).add(pack(p2, 2), 0).add(pack(p1, 3), 1).add(pack(p2, 4), 0).add(pack(p1, 5), 2);
+    q.add({}); // empty pack is ignored.
+    REQUIRE(q.size() == 5);
+    std::vector<size_t> order;
+    for (const auto & d : q.sort()) order.push_back(d->dispatch.width);
+    CHECK(order == std::vector<size_t> {3, 5, 1, 2, 4});
+
+    q.clear();
+    CHECK(q.size() == 0);
+}
+
+TEST_CASE("draw-pack-mergeable") {
+    auto g    = DummyPipeline::g();
+    auto pack = [](Ref<const Pipeline> p, size_t vertexCount) {
+        auto d = Drawable({{}, p});
+        d.draw(GraphicsPipeline::DrawParameters {}.setNonIndexed(vertexCount));
+        return d.compile();
+    };
+
+    // Graphics draw packs that differ only in draw parameters are mergeable.
+    CHECK(pack(g, 3)->mergeable(*pack(g, 6)));
+    CHECK_FALSE(pack(g, 3)->mergeable(*pack(DummyPipeline::g(), 3)));
+
+    // Compute packs are never mergeable.
+    auto c = DummyPipeline::c();
+    auto d = Drawable({{}, c});
+    d.dispatch({1, 1, 1});
+    CHECK_FALSE(d.compile()->mergeable(*d.compile()));
+}
+
+TEST_CASE("draw-pack-pool") {
+    auto p       = DummyPipeline::c();
+    auto compile = [&](size_t width) {
+        auto d = Drawable({{}, p});
+        d.dispatch({width, 1, 1});
+        return d.compile();
+    };
+
+    // Memory of a released draw pack should be recycled by the next one.
+    auto p1 = compile(1);
+    auto a1 = (const void *) p1.get();
+    p1.clear();
+    auto p2 = compile(2);
+    CHECK(a1 == (const void *) p2.get());
+    CHECK(2 == p2->dispatch.width);
+}
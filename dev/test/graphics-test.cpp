@@ -100,4 +100,83 @@ TEST_CASE("vertex-buffer") {
     auto ptr = (const uint32_t *) pixels.storage.data();
     CHECK(0xFF00FF00 == ptr[1]);
     CHECK(0xFFFF0000 == ptr[w]);
-}
\ No newline at end of file
+}
+
+TEST_CASE("pipeline-library") {
+    using namespace rapid_vulkan;
+    auto   scene    = BlueTriangleScene("pipeline-library");
+    auto & registry = *scene.gi->pipelineRegistry;
+    auto   before   = registry.stats();
+
+    // Two pipelines that differ only in blend states. The second one reuses all libraries except the fragment output one.
+    auto gcp = scene.pipeline("pipeline-library-opaque").setFastLink(true);
+    auto p1  = GraphicsPipeline(gcp);
+    gcp.setName("pipeline-library-blend");
+    gcp.attachments[0].setBlendEnable(true).setSrcColorBlendFactor(vk::BlendFactor::eOne).setDstColorBlendFactor(vk::BlendFactor::eZero);
+    auto p2 = GraphicsPipeline(gcp);
+    CHECK(p1.isReady());
+    CHECK(p2.isReady());
+    if (scene.gi->graphicsPipelineLibrary) {
+        auto after = registry.stats();
+        CHECK(after.libraryMisses - before.libraryMisses == 5);
+        CHECK(after.libraryHits - before.libraryHits == 3);
+    }
+
+    // Wait for the optimized pipelines to replace the linked ones. Then draw with it.
+    CHECK(p1.wait());
+    CHECK(p2.wait());
+    CHECK(0xFFFF0000 == scene.render([&](CommandBuffer & c) { p2.cmdDraw(c, GraphicsPipeline::DrawParameters {}.setNonIndexed(3)); }));
+}
+
+TEST_CASE("extended-dynamic-state") {
+    using namespace rapid_vulkan;
+    if (!TestVulkanInstance::device->gi()->extendedDynamicState) return;
+    auto scene = BlueTriangleScene("extended-dynamic-state");
+    auto p     = Ref(new GraphicsPipeline(scene.pipeline("extended-dynamic-state").setExtendedDynamicState()));
+    REQUIRE(p->dynamicStates());
+
+    // One pipeline, two cull modes. Culling both faces should leave the screen green.
+    auto render = [&](vk::CullModeFlags cullMode) {
+        auto d = Drawable({{"extended-dynamic-state"}, p});
+        d.draw(GraphicsPipeline::DrawParameters {}.setNonIndexed(3));
+        d.dynamicStates(GraphicsPipeline::DynamicStates(d.dynamicStates()).setCullMode(cullMode));
+        return scene.render([&](CommandBuffer & c) { c.render(d.compile()); });
+    };
+    CHECK(0xFFFF0000 == render(vk::CullModeFlagBits::eNone));
+    CHECK(0xFF00FF00 == render(vk::CullModeFlagBits::eFrontAndBack));
+}
+
+TEST_CASE("merged-draws") {
+    using namespace rapid_vulkan;
+    auto scene = BlueTriangleScene("merged-draws");
+    auto p     = Ref(new GraphicsPipeline(scene.pipeline("merged-draws")));
+
+    // The packs differ only in draw parameters. So they are rendered with one indirect draw, if the device supports it.
+    auto rq = RenderQueue(RenderQueue::ConstructParameters {{"merged-draws"}}.setMergeDraws());
+    for (uint32_t i = 0; i < 4; ++i) {
+        auto d = Drawable({{"merged-draws"}, p});
+        d.draw(GraphicsPipeline::DrawParameters {}.setNonIndexed(3).setInstance(1, i));
+        rq.add(d.compile());
+    }
+    CHECK(0xFFFF0000 == scene.render([&](CommandBuffer & c) { CHECK(4 == rq.flush(c)); }));
+}
+
+TEST_CASE("parallel-recording") {
+    using namespace rapid_vulkan;
+    auto scene = BlueTriangleScene("parallel-recording");
+    auto p     = Ref(new GraphicsPipeline(scene.pipeline("parallel-recording")));
+
+    std::vector<Ref<const DrawPack>> packs;
+    for (uint32_t i = 0; i < 100; ++i) {
+        auto d = Drawable({{"parallel-recording"}, p});
+        d.draw(GraphicsPipeline::DrawParameters {}.setNonIndexed(3));
+        packs.push_back(d.compile());
+    }
+
+    // Record the packs on 4 threads, then execute them inside the built-in render pass.
+    auto pp = CommandBuffer::ParallelRenderParameters {}
+                  .setPacks(packs)
+                  .setRenderPass(scene.sw.renderPass(), 0, scene.frame->backbuffer->framebuffer)
+                  .setThreads(4, 16);
+    CHECK(0xFFFF0000 == scene.render([&](CommandBuffer & c) { c.renderParallel(pp); }, vk::SubpassContents::eSecondaryCommandBuffers));
+}
@@ -37,3 +37,72 @@ TEST_CASE("image-read-write") {
     CHECK(p[2] == pixels[2]);
     CHECK(p[3] == pixels[3]);
 }
+
+TEST_CASE("readback-pool") {
+    using namespace rapid_vulkan;
+    auto dev   = TestVulkanInstance::device.get();
+    auto queue = dev->graphics();
+    auto pool  = ReadbackPool({{"readback-pool-test"}, dev->gi()});
+
+    auto           image    = Image(Image::ConstructParameters {{"readback-image"}, dev->gi()}.set2D(2, 2));
+    const uint32_t pixels[] = {0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff};
+    image.setContent(Image::SetContentParameters {}.setQueue(*queue).setPixels(pixels));
+
+    auto           buffer   = Buffer({{"readback-buffer"}, dev->gi(), 16});
+    const uint32_t values[] = {1, 2, 3, 4};
+    buffer.setContent(Buffer::SetContentParameters {}.setQueue(*queue).setData(values, sizeof(values)));
+
+    auto cb = queue->begin("readback-pool-test");
+    auto r1 = pool.cmdRead(cb.handle(), image, Image::ReadContentParameters {}.setLayout(vk::ImageLayout::eTransferDstOptimal));
+    auto r2 = pool.cmdRead(cb.handle(), buffer, 8);
+    REQUIRE(!r1.empty());
+    REQUIRE(!r2.empty());
+    CHECK(r1.data().empty()); // not submitted yet.
+
+    // Copies share the submission, even if they are taken before it is set.
+    auto r3 = r2;
+    CHECK(r3.submission().empty());
+
+    auto sid = queue->submit({{cb}});
+    r1.setSubmission(sid);
+    r2.setSubmission(sid);
+    CHECK(r3.wait().size == 8);
+
+    auto d1 = r1.wait();
+    REQUIRE(d1.size == sizeof(pixels));
+    REQUIRE(r1.subresources.size() == 1);
+    CHECK(0 == memcmp(d1.data, pixels, sizeof(pixels)));
+
+    auto d2 = r2.wait();
+    REQUIRE(d2.size == 8);
+    CHECK(3 == ((const uint32_t *) d2.data)[0]);
+    CHECK(4 == ((const uint32_t *) d2.data)[1]);
+}
+
+TEST_CASE("readback-pool-reuse") {
+    using namespace rapid_vulkan;
+    auto dev    = TestVulkanInstance::device.get();
+    auto queue  = dev->graphics();
+    auto pool   = ReadbackPool({{"readback-pool-reuse"}, dev->gi()});
+    auto buffer = Buffer({{"readback-buffer"}, dev->gi(), 16});
+
+    // A buffer that is still being written by GPU is not handed out again.
+    auto cb     = queue->begin("readback-pool-reuse");
+    auto r1     = pool.cmdRead(cb.handle(), buffer);
+    auto mapped = r1.mapped;
+    auto sid    = queue->submit({cb});
+    r1.setSubmission(sid);
+    r1      = {};
+    cb      = queue->begin("readback-pool-reuse");
+    auto r2 = pool.cmdRead(cb.handle(), buffer);
+    if (!sid.finished()) CHECK(r2.mapped != mapped);
+    queue->drop(cb);
+    r2 = {}; // never submitted, so it is not reused either.
+
+    // Once the submission is finished, the buffer is reused.
+    sid.wait();
+    cb      = queue->begin("readback-pool-reuse");
+    auto r3 = pool.cmdRead(cb.handle(), buffer);
+    CHECK(r3.mapped == mapped);
+    queue->drop(cb);
+}
@@ -3,6 +3,7 @@
 #include "shader/full-screen.vert.spv.h"
 #include "shader/texture-array.frag.spv.h"
 #include "rdc.h"
+#include <thread>
 
 using namespace rapid_vulkan;
 
@@ -68,3 +69,40 @@ TEST_CASE("texture-array", "[perf]") {
     sw.cmdEndBuiltInRenderPass(c.handle());
     q->submit({c}).wait();
 }
+
+TEST_CASE("queue-contention", "[perf]") {
+    auto g = TestVulkanInstance::device->graphics();
+
+    // Many threads begin and submit small command buffers on the same queue, which is the worst case for lock contention.
+    auto run = [&](const char * name, bool pooled) {
+        auto q       = CommandQueue(CommandQueue::ConstructParameters {{name}, g->gi(), g->family(), g->index()}.setPooled(pooled));
+        auto threads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+        auto frames  = 1000;
+        auto results = std::vector<std::vector<CommandQueue::SubmissionID>>(threads);
+        {
+            ScopedTimer timer(name);
+            auto        workers = std::vector<std::thread>();
+            for (uint32_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    for (int i = 0; i < frames; ++i) {
+                        auto c = q.begin(name);
+                        results[t].push_back(q.submit({c}));
+                        if (i % 16 == 0) results[t].front().finished(); // poll for retired submissions from time to time.
+                    }
+                });
+            }
+            for (auto & w : workers) w.join();
+            q.waitIdle();
+        }
+
+        // Submissions of each thread are in order. And all of them are finished.
+        for (const auto & r : results) {
+            REQUIRE(r.size() == (size_t) frames);
+            for (size_t i = 1; i < r.size(); ++i) CHECK(r[i].newerThan(r[i - 1].index));
+            for (const auto & s : r) CHECK(s.finished());
+        }
+    };
+
+    run("queue-contention", false);
+    run("queue-contention-pooled", true);
+}
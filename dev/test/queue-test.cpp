@@ -54,4 +54,168 @@ TEST_CASE("queue-reuse") {
         auto h2 = c2.handle();
         CHECK(h1 != h2);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("queue-submission-tracking") {
+    auto q = TestVulkanInstance::device->graphics()->clone();
+
+    // Submit a bunch of command buffers. Then make sure they are retired in order.
+    std::vector<rapid_vulkan::CommandQueue::SubmissionID> submissions;
+    for (int i = 0; i < 16; ++i) submissions.push_back(q.submit({q.begin("tracking")}));
+    for (size_t i = 1; i < submissions.size(); ++i) CHECK(submissions[i].newerThan(submissions[i - 1].index));
+
+    // Wait for one in the middle. Everything submitted before it should be finished too.
+    q.wait(submissions[8]);
+    for (size_t i = 0; i <= 8; ++i) CHECK(submissions[i].finished());
+
+    q.waitIdle();
+    for (const auto & s : submissions) CHECK(s.finished());
+
+    // Submissions after idle should reuse command buffers and synchronization objects.
+    q.wait(q.submit({q.begin("tracking")}));
+}
+
+TEST_CASE("queue-pooled-command-buffers") {
+    using namespace rapid_vulkan;
+    auto g = TestVulkanInstance::device->graphics();
+    auto q = CommandQueue(CommandQueue::ConstructParameters {{"pooled"}, g->gi(), g->family(), g->index()}.setPooled(true));
+    REQUIRE(q.desc().pooled);
+
+    // record a frame with a few command buffers.
+    auto c1 = q.begin("c1");
+    auto c2 = q.begin("c2");
+    auto c3 = q.begin("c3", vk::CommandBufferLevel::eSecondary);
+    auto h1 = c1.handle();
+    REQUIRE(h1);
+    REQUIRE(c2.handle());
+    CHECK(h1 != c2.handle());
+    q.drop(c3);
+    q.wait(q.submit({{c1, c2}}));
+
+    // Once the frame is retired, the pool is reset and the same command buffer handles are handed out again.
+    auto c4 = q.begin("c4");
+    CHECK(h1 == c4.handle());
+
+    // A command buffer in flight keeps its pool from being reset.
+    auto s  = q.submit({c4});
+    auto c5 = q.begin("c5");
+    CHECK(c5.handle() != c4.handle());
+    q.wait(q.submit({c5}));
+    CHECK(s.finished());
+}
+
+TEST_CASE("queue-submit-batches") {
+    using namespace rapid_vulkan;
+    auto q  = TestVulkanInstance::device->graphics()->clone();
+    auto gi = q.gi();
+
+    // The second batch waits for the semaphore signaled by the first one.
+    auto sem     = gi->device.createSemaphore({});
+    auto c1      = q.begin("batch-1");
+    auto c2      = q.begin("batch-2");
+    auto c3      = q.begin("batch-3");
+    auto signal  = CommandQueue::SemaphoreSubmit {sem, vk::PipelineStageFlagBits2::eAllCommands};
+    auto wait    = CommandQueue::SemaphoreSubmit {sem, vk::PipelineStageFlagBits2::eTransfer};
+    auto batches = std::vector<CommandQueue::Batch> {{c1, {}, signal}, {c2, wait, {}}, {c3}};
+    auto range   = q.submitBatches(batches);
+    REQUIRE(range);
+    CHECK(range.count == 3);
+    for (uint32_t i = 1; i < range.count; ++i) CHECK(range[i].newerThan(range[i - 1].index));
+
+    // Batches finish in order. So waiting for the last one is enough.
+    range.back().wait();
+    for (uint32_t i = 0; i < range.count; ++i) CHECK(range[i].finished());
+    gi->device.destroySemaphore(sem);
+
+    // Submissions after the range continue from it.
+    auto s = q.submit({q.begin("after-batches")});
+    CHECK(s.newerThan(range.back().index));
+    s.wait();
+
+    // Batches without any valid command buffer or semaphore are not submitted.
+    CHECK_FALSE(q.submitBatches(CommandQueue::Batch {}));
+}
+
+TEST_CASE("queue-cross-queue-dependency") {
+    using namespace rapid_vulkan;
+    auto device   = TestVulkanInstance::device.get();
+    auto producer = device->compute() ? device->compute()->clone("producer") : device->graphics()->clone("producer");
+    auto consumer = device->graphics()->clone("consumer");
+
+    // The consumer waits for the producer on GPU. Then waiting for the consumer on CPU implies the producer is done too.
+    auto p1 = producer.submit({producer.begin("p1")});
+    auto p2 = producer.submit({producer.begin("p2")});
+    REQUIRE(p2);
+    auto c0 = consumer.submit({consumer.begin("c0")});
+    REQUIRE(c0);
+    auto waits = std::vector<CommandQueue::SubmissionID> {p1, p2, {}, c0}; // empty submissions are ignored.
+    if (device->gi()->timelineSemaphore) {
+        // One wait for each queue, on the newest of its submissions.
+        auto resolved = consumer.submissionWaits(waits);
+        REQUIRE(resolved.size() == 2);
+        CHECK(resolved[0].semaphore != resolved[1].semaphore);
+        CHECK(resolved[0].value == (uint64_t) p2.index);
+        CHECK(resolved[1].value == (uint64_t) c0.index);
+
+        // A batch that only waits for submissions is not dropped.
+        auto range = consumer.submitBatches(CommandQueue::Batch {{}, {}, {}, p2});
+        REQUIRE(range);
+        range.back().wait();
+    }
+    auto c = consumer.submit({{consumer.begin("c")}, {}, {}, {}, waits});
+    REQUIRE(c);
+    c.wait();
+    CHECK(p1.finished());
+    CHECK(p2.finished());
+
+    // A submission of the same queue works too.
+    auto c2 = consumer.submit({{consumer.begin("c2")}, {}, {}, {}, c});
+    REQUIRE(c2);
+    c2.wait();
+}
+
+TEST_CASE("queue-set") {
+    auto device = TestVulkanInstance::device.get();
+    auto set    = device->queues(device->graphics()->family());
+    REQUIRE(set);
+    REQUIRE(set->size() > 0);
+    CHECK((*set)[0] == device->graphics()); // the first queue of the family is the default one.
+    CHECK(device->queues(~0u) == nullptr);
+
+    // Round robin visits every queue in turn.
+    auto first = set->next();
+    for (size_t i = 1; i < set->size(); ++i) CHECK(set->next() != first);
+    CHECK(set->next() == first);
+
+    // An idle queue has no pending submission.
+    auto q = set->leastLoaded();
+    REQUIRE(q);
+    q->waitIdle();
+    CHECK(0 == q->pendingSubmissions());
+    auto s = q->submit({q->begin("queue-set")});
+    s.wait();
+    CHECK(0 == q->pendingSubmissions());
+}
+
+TEST_CASE("queue-set-priorities") {
+    using namespace rapid_vulkan;
+    auto device    = Device(Device::ConstructParameters {*TestVulkanInstance::instance}.setQueuePriorities({1.0f, 0.5f}));
+    auto family    = device.graphics()->family();
+    auto supported = device.gi()->physical.getQueueFamilyProperties()[family].queueCount;
+    auto set       = device.queues(family);
+    REQUIRE(set);
+    CHECK(set->size() == std::min<size_t>(2, supported));
+
+    // Each queue object wraps its own VkQueue.
+    std::set<std::pair<uint32_t, uint32_t>> unique;
+    for (auto q : *set) {
+        CHECK(q->family() == family);
+        unique.insert({q->family(), q->index()});
+    }
+    CHECK(unique.size() == set->size());
+
+    // Round robin rotates through all of them.
+    std::set<CommandQueue *> visited;
+    for (size_t i = 0; i < set->size(); ++i) visited.insert(set->next());
+    CHECK(visited.size() == set->size());
+}
@@ -1,13 +1,90 @@
 #include "../rv.h"
+#include "shader/argument-test.comp.spv.h"
+#include "shader/full-screen.vert.spv.h"
+#include "shader/blue-color.frag.spv.h"
 #include <memory>
 #include <chrono>
 #include <iostream>
+#include <functional>
 
 struct TestVulkanInstance {
     inline static std::unique_ptr<rapid_vulkan::Instance> instance;
     inline static std::unique_ptr<rapid_vulkan::Device>   device;
 };
 
+/// Compute pipeline of the argument-test shader, which writes the input buffer plus the push constant to the output buffer.
+struct ArgumentTestPipeline {
+    std::string                                      name;
+    const rapid_vulkan::GlobalInfo *                 gi;
+    rapid_vulkan::Shader                             cs;
+    rapid_vulkan::Ref<rapid_vulkan::ComputePipeline> p;
+
+    ArgumentTestPipeline(const std::string & name_)
+        : name(name_), gi(TestVulkanInstance::device->gi()), cs(rapid_vulkan::Shader::ConstructParameters {{name}, gi}.setSpirv(argument_test_comp)),
+          p(new rapid_vulkan::ComputePipeline({{name}, &cs})) {}
+
+    /// Create a 1-float input buffer.
+    rapid_vulkan::Ref<rapid_vulkan::Buffer> input(float value) const {
+        using namespace rapid_vulkan;
+        auto b = Ref(new Buffer({{"src"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+        b->setContent(Buffer::SetContentParameters {}.setData(vk::ArrayProxy<const float> {value}));
+        return b;
+    }
+
+    /// Create a drawable that writes src + delta to a new output buffer. Returns the drawable and the output buffer.
+    auto drawable(rapid_vulkan::Ref<rapid_vulkan::Buffer> src, float delta) const {
+        using namespace rapid_vulkan;
+        auto dst = Ref(new Buffer({{"dst"}, gi, 4, vk::BufferUsageFlagBits::eStorageBuffer}));
+        auto d   = Ref(new Drawable({{name}, p}));
+        d->b({0, 0}, {{src}});
+        d->b({0, 1}, {{dst}});
+        d->c(0, vk::ArrayProxy<const float> {delta});
+        d->dispatch(ComputePipeline::DispatchParameters {1, 1, 1});
+        return std::make_pair(d, dst);
+    }
+};
+
+/// Headless swapchain and the shaders that draw a blue full screen triangle. The frame is begun on construction.
+struct BlueTriangleScene {
+    static constexpr uint32_t w = 128;
+    static constexpr uint32_t h = 72;
+
+    const rapid_vulkan::GlobalInfo *       gi;
+    rapid_vulkan::Swapchain                sw;
+    rapid_vulkan::Shader                   vs;
+    rapid_vulkan::Shader                   fs;
+    const rapid_vulkan::Swapchain::Frame * frame;
+
+    BlueTriangleScene(const std::string & name)
+        : gi(TestVulkanInstance::device->gi()),
+          sw(rapid_vulkan::Swapchain::ConstructParameters {{name}}.setDevice(*TestVulkanInstance::device).setDimensions(w, h)),
+          vs(rapid_vulkan::Shader::ConstructParameters {{name + "-vs"}, gi}.setSpirv(full_screen_vert)),
+          fs(rapid_vulkan::Shader::ConstructParameters {{name + "-fs"}, gi}.setSpirv(blue_color_frag)), frame(sw.beginFrame()) {}
+
+    /// Parameters of the pipeline that draws the triangle, with static viewport and scissor covering the back buffer.
+    rapid_vulkan::GraphicsPipeline::ConstructParameters pipeline(const std::string & name) const {
+        return rapid_vulkan::GraphicsPipeline::ConstructParameters {{name}}
+            .setRenderPass(sw.renderPass())
+            .setVS(&vs)
+            .setFS(&fs)
+            .addStaticViewportAndScissor(0, 0, w, h);
+    }
+
+    /// Clear the back buffer to green, record the commands into the built-in render pass, then wait for the rendering to
+    /// finish. Returns color of the first pixel.
+    uint32_t render(const std::function<void(rapid_vulkan::CommandBuffer &)> & record, vk::SubpassContents contents = vk::SubpassContents::eInline) {
+        using namespace rapid_vulkan;
+        auto & q = sw.graphics();
+        auto   c = q.begin("blue-triangle");
+        sw.cmdBeginBuiltInRenderPass(c, Swapchain::BeginRenderPassParameters {}.setClearColorF({0.0f, 1.0f, 0.0f, 1.0f}).setContents(contents));
+        record(c);
+        sw.cmdEndBuiltInRenderPass(c);
+        q.submit({c}).wait();
+        auto pixels = frame->backbuffer->image->readContent({});
+        return pixels.storage.size() >= 4 ? *(const uint32_t *) pixels.storage.data() : 0;
+    }
+};
+
 struct ScopedTimer {
     std::string                                    name;
     std::chrono::high_resolution_clock::time_point start;
@@ -60,11 +60,15 @@ SOFTWARE.
 #include <stdexcept>
 #include <iomanip>
 #include <mutex>
+#include <shared_mutex>
 #include <variant>
 #include <list>
 #include <deque>
 #include <chrono>
 #include <functional>
+#include <condition_variable>
+#include <fstream>
+#include <thread>
 #include <signal.h>
 #include <inttypes.h>
 
@@ -115,6 +119,81 @@ auto ref2handle(const T & ref) -> decltype(ref->handle()) {
     return ref ? ref->handle() : decltype(ref->handle()) {};
 }
 
+/// FNV-1a hash of a block of memory. Pass the result of a previous call as the seed to hash multiple blocks.
+inline uint64_t fnv1a(const void * data, size_t size, uint64_t seed = 14695981039346656037ull) {
+    auto p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) seed = (seed ^ p[i]) * 1099511628211ull;
+    return seed;
+}
+
+/// Multiply-xorshift hash of a block of memory, that is independent of fnv1a(). Used to double check content that is
+/// matched by its fnv1a() hash. The size is part of the hash.
+inline uint64_t mix64(const void * data, size_t size, uint64_t seed = 0x9e3779b97f4a7c15ull) {
+    auto p = (const uint8_t *) data;
+    auto h = seed ^ (size * 0xff51afd7ed558ccdull);
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ p[i]) * 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/// Binary signature of the content of an object. Used as key of content addressed caches. All handles, enums and
+/// floats are stored as 64-bit integers.
+typedef std::vector<uint64_t> Signature;
+
+struct SignatureHash {
+    size_t operator()(const Signature & s) const { return (size_t) fnv1a(s.data(), s.size() * sizeof(uint64_t)); }
+};
+
+/// Thread safe pool of fixed size memory blocks. Blocks are carved out of large chunks, and are recycled through a
+/// free list. The chunks are returned to the system only when the pool is destroyed.
+class BlockPool {
+public:
+    BlockPool(size_t blockSize, size_t blocksPerChunk = 64)
+        : _blockSize((std::max(blockSize, sizeof(void *)) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)),
+          _blocksPerChunk(blocksPerChunk) {}
+
+    ~BlockPool() {
+        for (auto c : _chunks) ::operator delete(c);
+    }
+
+    size_t blockSize() const { return _blockSize; }
+
+    void * allocate() {
+        auto lock = std::lock_guard {_mutex};
+        if (!_free) grow();
+        auto p = _free;
+        _free  = *(void **) p;
+        return p;
+    }
+
+    void deallocate(void * p) {
+        if (!p) return;
+        auto lock   = std::lock_guard {_mutex};
+        *(void **) p = _free;
+        _free        = p;
+    }
+
+private:
+    size_t              _blockSize;
+    size_t              _blocksPerChunk;
+    void *              _free = nullptr; ///< head of the free list. Each free block stores the pointer to the next one.
+    std::vector<void *> _chunks;
+    std::mutex          _mutex;
+
+    void grow() {
+        auto c = (uint8_t *) ::operator new(_blockSize * _blocksPerChunk);
+        _chunks.push_back(c);
+        // Link the blocks in address order, for better locality of the subsequent allocations.
+        for (size_t i = _blocksPerChunk; i > 0; --i) {
+            auto b       = c + (i - 1) * _blockSize;
+            *(void **) b = _free;
+            _free        = b;
+        }
+    }
+};
+
 } // namespace rv_details
 
 #define RVI_ONCE_PER_SECOND(payload)                                                                           \
@@ -197,7 +276,7 @@ void threadSafeWaitForDeviceIdle(vk::Device device) {
 // Buffer
 // *********************************************************************************************************************
 
-/// TODO: Defer to VMA for memory allocations if it's enabled
+/// Allocate dedicated device memory. This is the fallback path used only when VMA allocator is not available.
 static vk::DeviceMemory allocateDeviceMemory(const GlobalInfo & g, const vk::MemoryRequirements & memRequirements, vk::MemoryPropertyFlags memoryProperties,
                                              const vk::MemoryAllocateFlags allocFlags) {
     auto memProperties = g.physical.getMemoryProperties();
@@ -220,6 +299,36 @@ static vk::DeviceMemory allocateDeviceMemory(const GlobalInfo & g, const vk::Mem
     return g.device.allocateMemory(ai);
 }
 
+/// Copy data into staging memory, then record (via the record functor) and submit the upload commands, and wait for
+/// them to finish. The staging memory comes from the device wide staging ring, when it is available.
+static void stagedUpload(const GlobalInfo & gi, const std::string & name, uint32_t family, uint32_t index, const void * data, vk::DeviceSize size,
+                         vk::DeviceSize alignment, const std::function<void(vk::CommandBuffer, vk::Buffer, vk::DeviceSize)> & record) {
+    if (auto ring = gi.stagingRing) {
+        auto staging = ring->allocate(size, alignment);
+        RVI_ASSERT(staging.data);
+        memcpy(staging.data, data, size);
+        auto & queue = ring->queue(family, index);
+        auto   sid   = CommandQueue::SubmissionID {};
+        if (auto cb = queue.begin(name.c_str())) {
+            record(cb, staging.buffer, staging.offset);
+            sid = queue.submit({{cb}});
+        }
+        ring->release(staging, sid);
+        queue.wait(sid);
+    } else {
+        auto staging = Buffer(Buffer::ConstructParameters {{name}, &gi, size}.setStaging());
+        auto m       = Buffer::Map<uint8_t>(staging);
+        RVI_ASSERT(m.data);
+        memcpy(m.data, data, size);
+        m.unmap();
+        auto queue = CommandQueue({{name}, &gi, family, index});
+        if (auto cb = queue.begin(name.c_str())) {
+            record(cb, staging.handle(), 0);
+            queue.wait(queue.submit({{cb}}));
+        }
+    }
+}
+
 class Buffer::Impl {
 public:
     Impl(Buffer & owner, const ConstructParameters & cp): _owner(owner), _gi(cp.gi) {
@@ -255,7 +364,11 @@ public:
         _desc.handle = _handle;
     }
 
-    Impl(Buffer & owner, const ImportParameters &): _owner(owner) {}
+    Impl(Buffer & owner, const ImportParameters & ip): _owner(owner), _gi(ip.gi) {
+        RVI_REQUIRE(ip.gi);
+        RVI_REQUIRE(ip.desc.handle);
+        _desc = ip.desc;
+    }
 
     ~Impl() {
 #if RAPID_VULKAN_ENABLE_VMA
@@ -311,18 +424,11 @@ public:
         }
         auto source = (const uint8_t *) params.data + srcOffset;
 
-        // copy data into the staging buffer.
-        auto staging = Buffer(ConstructParameters {{_owner.name()}, _gi, size}.setStaging());
-        auto m       = Map<uint8_t>(staging);
-        memcpy(m.data, source, size);
-        m.unmap();
-
-        // copy to the target buffer.
-        auto queue = CommandQueue({{_owner.name()}, _gi, params.queueFamily, params.queueIndex});
-        if (auto cb = queue.begin(_owner.name().c_str(), vk::CommandBufferLevel::ePrimary)) {
-            staging.cmdCopy({cb, _owner.handle(), _desc.size, dstOffset, 0, size});
-            queue.wait(queue.submit({{cb}}));
-        }
+        // copy data to staging memory, then to the target buffer.
+        stagedUpload(*_gi, _owner.name(), params.queueFamily, params.queueIndex, source, size, 16,
+                     [&](vk::CommandBuffer cb, vk::Buffer staging, vk::DeviceSize stagingOffset) {
+                         cb.copyBuffer(staging, _desc.handle, {{stagingOffset, dstOffset, size}});
+                     });
     }
 
     auto readContent(const ReadParameters & params) -> std::vector<uint8_t> {
@@ -372,27 +478,38 @@ public:
             RVI_LOGE("mapped range is invalid or empty.");
             return {};
         }
-        // TODO: VMA
-        // if (allocation) {
-        //     RVI_REQUIRE(global->vmaAllocator);
-        //     RVI_VK_REQUIRE(vmaMapMemory(global->vmaAllocator, allocation, (void **) &dst));
-        //     dst += offsetInUnitOfT;
-        // } else {
-        auto p = _gi->device.mapMemory(_memory, o, s);
+        uint8_t * p = nullptr;
+#if RAPID_VULKAN_ENABLE_VMA
+        if (_allocation) {
+            // VMA always maps the whole allocation. So we need to manually apply the offset.
+            RVI_ASSERT(_gi->vmaAllocator);
+            void * base = nullptr;
+            if (VK_SUCCESS == vmaMapMemory(_gi->vmaAllocator, _allocation, &base) && base) p = (uint8_t *) base + o;
+        } else
+#endif
+        {
+            p = (uint8_t *) _gi->device.mapMemory(_memory, o, s);
+        }
         if (!p) {
             RVI_LOGE("Failed to map buffer %s.", _owner.name().c_str());
             return {};
         }
         _mapped = true;
-        return {(uint8_t *) p, o, s};
+        return {p, o, s};
     }
 
     void unmap() {
         auto lock = std::lock_guard {_mutex};
-        if (_mapped) {
+        if (!_mapped) return;
+#if RAPID_VULKAN_ENABLE_VMA
+        if (_allocation) {
+            vmaUnmapMemory(_gi->vmaAllocator, _allocation);
+        } else
+#endif
+        {
             _gi->device.unmapMemory(_memory);
-            _mapped = false;
         }
+        _mapped = false;
     }
 
     void onNameChanged() {
@@ -724,6 +841,147 @@ struct VkFormatDesc {
     }
 };
 
+/// Helper structure to upload content to one subresource of an image.
+struct ImageUpload {
+    const uint8_t *           pixels    = nullptr; ///< the source pixels, adjusted to the clamped area.
+    vk::DeviceSize            size      = 0;       ///< size of the source pixels in bytes.
+    vk::DeviceSize            alignment = 0;       ///< required alignment of staging buffer offset.
+    vk::BufferImageCopy       region {};
+    vk::ImageSubresourceRange range {};
+
+    /// Validate the upload parameters and setup the copy region. Returns false if there's nothing to upload.
+    bool prepare(const Image::Desc & desc, const Image::SetContentParameters & params) {
+        // make sure area is aligned to block size
+        auto formatDesc = VkFormatDesc::get(desc.format);
+        if ((params.area.x % formatDesc.blockW) != 0 || (params.area.y % formatDesc.blockH) != 0 || (params.area.w % formatDesc.blockW) != 0 ||
+            (params.area.h % formatDesc.blockH) != 0) {
+            RVI_LOGE("Image::setContent: area is not aligned to block size");
+            return false;
+        }
+
+        // validate mip level and array layer.
+        if (params.mipLevel >= desc.mipLevels || params.arrayLayer >= desc.arrayLayers) {
+            RVI_LOGE("Image::setContent: subresource (mip %u, layer %u) is out of range", params.mipLevel, params.arrayLayer);
+            return false;
+        }
+
+        // validate row pitch
+        auto mipExtent = desc.extent;
+        for (uint32_t i = 0; i < params.mipLevel; ++i) {
+            mipExtent.width  = std::max(mipExtent.width / 2, 1u);
+            mipExtent.height = std::max(mipExtent.height / 2, 1u);
+            mipExtent.depth  = std::max(mipExtent.depth / 2, 1u);
+        }
+        auto width = params.area.w;
+        if (uint32_t(-1) == width) width = mipExtent.width;
+        auto rowPitch = params.pitch;
+        if (0 == rowPitch) { rowPitch = width * formatDesc.sizeBytes; }
+        if (rowPitch < width * formatDesc.sizeBytes) {
+            RVI_LOGE("Image::setContent: row pitch is too small");
+            return false;
+        }
+
+        // adjust area to fit image size
+        auto area = params.area;
+        clampRange(area.x, area.w, mipExtent.width);
+        clampRange(area.y, area.h, mipExtent.height);
+        clampRange(area.z, area.d, mipExtent.depth);
+        if (area.w == 0 || area.h == 0 || area.d == 0) return false;
+
+        // adjust pixel array pointer and size based on the clamped area.
+        // (TODO: revisit this math. could be wrong)
+        auto offset = (area.x - params.area.x) * formatDesc.sizeBytes + (area.y - params.area.y) * rowPitch + (area.z - params.area.z) * rowPitch * area.h;
+        pixels      = (const uint8_t *) params.pixels + offset;
+        size        = rowPitch * area.h * area.d - rowPitch + area.w * formatDesc.sizeBytes - offset;
+
+        // Staging buffer offset has to be multiple of both 4 and the texel block size.
+        alignment = formatDesc.sizeBytes * 4;
+
+        // Setup buffer copy regions for the subresource
+        auto aspect = Image::determineImageAspect(desc.format);
+        range       = vk::ImageSubresourceRange(aspect, params.mipLevel, 1, params.arrayLayer, 1);
+        region      = vk::BufferImageCopy()
+                     .setImageSubresource({aspect, params.mipLevel, params.arrayLayer, 1})
+                     .setImageOffset({(int) area.x, (int) area.y, (int) area.z})
+                     .setImageExtent({area.w, area.h, area.d});
+        return true;
+    }
+
+    /// Record commands to copy pixels from staging buffer to the image. The subresource is transferred to eTransferDstOptimal layout.
+    void cmdCopy(vk::CommandBuffer cb, vk::Image image, vk::Buffer staging, vk::DeviceSize stagingOffset) {
+        Barrier {}
+            .s(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer)
+            .i(image, vk::AccessFlagBits::eMemoryWrite | vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eUndefined,
+               vk::ImageLayout::eTransferDstOptimal, range)
+            .cmdWrite(cb);
+        region.setBufferOffset(stagingOffset);
+        cb.copyBufferToImage(staging, image, vk::ImageLayout::eTransferDstOptimal, {region});
+    }
+};
+
+/// Helper structure to read a range of subresources of an image into a tightly packed buffer.
+struct ImageReadback {
+    std::vector<vk::BufferImageCopy>       regions;
+    std::vector<Image::SubresourceContent> subresources;
+    vk::ImageSubresourceRange              range {};
+    vk::DeviceSize                         size = 0; ///< total size of the read back data in bytes.
+
+    /// Validate the read parameters and setup the copy regions. Returns false if there's nothing to read.
+    bool prepare(const Image::Desc & desc, const Image::ReadContentParameters & params) {
+        auto mipLevel   = params.mipLevel;
+        auto levelCount = params.levelCount;
+        auto arrayLayer = params.arrayLayer;
+        auto layerCount = params.layerCount;
+        clampRange(mipLevel, levelCount, desc.mipLevels);
+        clampRange(arrayLayer, layerCount, desc.arrayLayers);
+        if (0 == levelCount || 0 == layerCount) return false;
+
+        auto formatDesc = VkFormatDesc::get(desc.format);
+        auto aspect     = Image::determineImageAspect(desc.format);
+        auto alignment  = vk::DeviceSize(formatDesc.sizeBytes * 4); // buffer offset has to be multiple of both 4 and texel block size.
+        auto extent     = desc.extent;
+        for (uint32_t m = 0; m < mipLevel + levelCount; ++m) {
+            if (m >= mipLevel) {
+                auto rowPitch = extent.width * formatDesc.sizeBytes;
+                auto mipSize  = rowPitch * extent.height * extent.depth;
+                for (uint32_t a = arrayLayer; a < arrayLayer + layerCount; ++a) {
+                    size = (size + alignment - 1) / alignment * alignment;
+                    regions.push_back(vk::BufferImageCopy()
+                                          .setBufferOffset(size)
+                                          .setBufferRowLength(extent.width)
+                                          .setBufferImageHeight(extent.height)
+                                          .setImageSubresource({aspect, m, a, 1})
+                                          .setImageOffset({0, 0, 0})
+                                          .setImageExtent(extent));
+                    subresources.push_back({m, a, extent, rowPitch, size});
+                    size += mipSize;
+                }
+            }
+            extent.width  = std::max(extent.width / 2, 1u);
+            extent.height = std::max(extent.height / 2, 1u);
+            extent.depth  = std::max(extent.depth / 2, 1u);
+        }
+        range = vk::ImageSubresourceRange(aspect, mipLevel, levelCount, arrayLayer, layerCount);
+        return true;
+    }
+
+    /// Record commands to copy the subresources into the buffer. The subresources are transferred to eTransferSrcOptimal layout.
+    void cmdCopy(vk::CommandBuffer cb, vk::Image image, vk::ImageLayout oldLayout, vk::Buffer dst, vk::DeviceSize dstOffset) {
+        Barrier {}
+            .s(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer)
+            .i(image, vk::AccessFlagBits::eMemoryWrite | vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead, oldLayout,
+               vk::ImageLayout::eTransferSrcOptimal, range)
+            .cmdWrite(cb);
+        if (dstOffset) {
+            auto shifted = regions;
+            for (auto & r : shifted) r.bufferOffset += dstOffset;
+            cb.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, dst, shifted);
+        } else {
+            cb.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, dst, regions);
+        }
+    }
+};
+
 class Image::Impl {
 public:
     Impl(Image & o, ConstructParameters cp): _owner(o), _gi(cp.gi) {
@@ -819,123 +1077,33 @@ public:
     }
 
     void setContent(const SetContentParameters & params) {
-        // make sure area is aligned to block size
-        auto formatDesc = VkFormatDesc::get(_desc.format);
-        if ((params.area.x % formatDesc.blockW) != 0 || (params.area.y % formatDesc.blockH) != 0 || (params.area.w % formatDesc.blockW) != 0 ||
-            (params.area.h % formatDesc.blockH) != 0) {
-            RVI_LOGE("Image::setContent: area is not aligned to block size");
-            return;
-        }
-
-        // validate row pitch
-        const auto mipExtent = getMipExtent(params.mipLevel);
-        auto       width     = params.area.w;
-        if (uint32_t(-1) == width) width = mipExtent.width;
-        auto rowPitch = params.pitch;
-        if (0 == rowPitch) { rowPitch = width * formatDesc.sizeBytes; }
-        if (rowPitch < width * formatDesc.sizeBytes) {
-            RVI_LOGE("Image::setContent: row pitch is too small");
-            return;
-        }
-
-        // TODO: validate mip level and array layer.
-
-        // adjust area to fit image size
-        auto area = clampRect3D(params.area, mipExtent);
-        if (area.w == 0 || area.h == 0 || area.d == 0) return;
-
-        // adjust pixel array pointer and size based on the clamped area.
-        // (TODO: revisit this math. could be wrong)
-        auto offset   = (area.x - params.area.x) * formatDesc.sizeBytes + (area.y - params.area.y) * rowPitch + (area.z - params.area.z) * rowPitch * area.h;
-        auto pixels   = (const uint8_t *) params.pixels + offset;
-        auto dataSize = rowPitch * area.h * area.d - rowPitch + area.w * formatDesc.sizeBytes - offset;
-
-        // Copy texture data into staging buffer
-        auto staging = Buffer(Buffer::ConstructParameters {{_owner.name()}, _gi, dataSize}.setStaging());
-        auto mapped  = staging.map({});
-        RVI_ASSERT(mapped.data);
-        RVI_ASSERT(mapped.size == dataSize);
-        memcpy(mapped.data, pixels, dataSize);
-        staging.unmap();
-
-        // determine subresource aspect
-        auto aspect = determineImageAspect(_desc.format);
-
-        // Setup buffer copy regions for the subresource
-        auto copyRegion = vk::BufferImageCopy()
-                              .setImageSubresource({aspect, params.mipLevel, params.arrayLayer, 1})
-                              .setImageOffset({(int) area.x, (int) area.y, (int) area.z})
-                              .setImageExtent({area.w, area.h, area.d});
-
-        // copy image content from staging buffer to image
-        auto q = CommandQueue({{_owner.name()}, _gi, params.queueFamily, params.queueIndex});
-        auto c = q.begin(_owner.name().data());
-        if (c) {
-            auto r = vk::ImageSubresourceRange(aspect, params.mipLevel, 1, params.arrayLayer, 1);
-            Barrier {}
-                .s(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer)
-                .i(_desc.handle, vk::AccessFlagBits::eMemoryWrite | vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
-                   vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, r)
-                .cmdWrite(c);
-            c.handle().copyBufferToImage(staging, _desc.handle, vk::ImageLayout::eTransferDstOptimal, {copyRegion});
-            q.wait(q.submit({{c}}));
-        }
+        ImageUpload upload;
+        if (!upload.prepare(_desc, params)) return;
+        stagedUpload(*_gi, _owner.name(), params.queueFamily, params.queueIndex, upload.pixels, upload.size, upload.alignment,
+                     [&](vk::CommandBuffer c, vk::Buffer staging, vk::DeviceSize stagingOffset) { upload.cmdCopy(c, _desc.handle, staging, stagingOffset); });
     }
 
     Content readContent(const ReadContentParameters & params) {
-        // uint32_t mipLevel   = params.mipLevel;
-        // uint32_t levelCount = params.layerCount;
-        // uint32_t arrayLayer = params.arrayLayer;
-        // uint32_t layerCount = params.layerCount;
-        // clampRange(mipLevel, levelCount, _desc.mipLevels);
-        // clampRange(arrayLayer, layerCount, _desc.arrayLayers);
-        // if (0 == levelCount || 0 == layerCount) return {};
-
-        auto formatDesc = VkFormatDesc::get(_desc.format);
-        auto aspect     = determineImageAspect(_desc.format);
-        auto mipExtents = buildMipExtentArray();
-
-        Content                          content;
-        std::vector<vk::BufferImageCopy> copyRegions;
-        vk::DeviceSize                   dataSize = 0;
-        for (uint32_t m = 0; m < mipExtents.size(); ++m) {
-            auto extent   = mipExtents[m];
-            auto rowPitch = extent.width * formatDesc.sizeBytes;
-            auto mipSize  = rowPitch * extent.height * extent.depth;
-            for (uint32_t a = 0; a < _desc.arrayLayers; ++a) {
-                copyRegions.push_back(vk::BufferImageCopy()
-                                          .setBufferOffset(dataSize)
-                                          .setBufferRowLength(extent.width)
-                                          .setBufferImageHeight(extent.height)
-                                          .setImageSubresource({aspect, m, a, 1})
-                                          .setImageOffset({0, 0, 0})
-                                          .setImageExtent(extent));
-                content.subresources.push_back({m, a, extent, rowPitch, dataSize});
-                dataSize += mipSize;
-            }
-        }
+        ImageReadback readback;
+        if (!readback.prepare(_desc, params)) return {};
 
         // Allocate staging buffer
-        auto staging = Buffer(Buffer::ConstructParameters {{_owner.name()}, _gi, dataSize}.setStaging());
+        auto staging = Buffer(Buffer::ConstructParameters {{_owner.name()}, _gi, readback.size}.setStaging());
 
         // Copy image content into the staging buffer
         auto q = CommandQueue({{_owner.name()}, _gi, params.queueFamily, params.queueIndex});
         auto c = q.begin(_owner.name().data());
         if (c) {
-            auto r = vk::ImageSubresourceRange(aspect, 0, _desc.mipLevels, 0, _desc.arrayLayers);
-            Barrier {}
-                .s(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer)
-                .i(_desc.handle, vk::AccessFlagBits::eMemoryWrite | vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
-                   vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal, r)
-                .cmdWrite(c);
-            c.handle().copyImageToBuffer(_desc.handle, vk::ImageLayout::eTransferSrcOptimal, staging, copyRegions);
+            readback.cmdCopy(c, _desc.handle, params.layout, staging, 0);
             q.wait(q.submit({c}));
         }
 
         // read data out of the staging buffer
-        auto mapped = staging.map({});
-        RVI_ASSERT(mapped.size == dataSize);
+        Content content;
+        auto    mapped = staging.map({});
+        RVI_ASSERT(mapped.size == readback.size);
         content.storage.assign(mapped.data, mapped.data + mapped.size);
+        content.subresources = std::move(readback.subresources);
 
         // done
         content.format = _desc.format;
@@ -972,8 +1140,10 @@ private:
     Desc               _desc;
     vk::Image          _handle {};
     vk::DeviceMemory   _memory {};
-    VmaAllocation      _allocation {};
-    mutable ViewMap    _views;
+#if RAPID_VULKAN_ENABLE_VMA
+    VmaAllocation _allocation {};
+#endif
+    mutable ViewMap _views;
 
 private:
     vk::ImageViewType determineViewType(vk::ImageViewType candidate, const vk::ImageSubresourceRange & range) const {
@@ -997,36 +1167,6 @@ private:
             return vk::ImageViewType::e3D;
         }
     }
-
-    static Rect3D clampRect3D(Rect3D rect, const vk::Extent3D & extent) {
-        clampRange(rect.x, rect.w, extent.width);
-        clampRange(rect.y, rect.h, extent.height);
-        clampRange(rect.z, rect.d, extent.depth);
-        return rect;
-    }
-
-    vk::Extent3D getMipExtent(size_t level) const {
-        auto extent = _desc.extent;
-        for (size_t i = 0; i < level; ++i) {
-            extent.width  = std::max(extent.width / 2, 1u);
-            extent.height = std::max(extent.height / 2, 1u);
-            extent.depth  = std::max(extent.depth / 2, 1u);
-        }
-        return extent;
-    }
-
-    std::vector<vk::Extent3D> buildMipExtentArray() const {
-        std::vector<vk::Extent3D> result;
-        result.reserve(_desc.mipLevels);
-        auto extent = _desc.extent;
-        for (size_t i = 0; i < _desc.mipLevels; ++i) {
-            result.push_back(extent);
-            extent.width  = std::max(extent.width / 2, 1u);
-            extent.height = std::max(extent.height / 2, 1u);
-            extent.depth  = std::max(extent.depth / 2, 1u);
-        }
-        return result;
-    }
 };
 
 Image::SetContentParameters & Image::SetContentParameters::setQueue(const CommandQueue & queue) {
@@ -1082,13 +1222,21 @@ auto Image::readContent(const ReadContentParameters & p) -> Content { return _im
 // Shader
 // *********************************************************************************************************************
 
+static std::shared_ptr<const PipelineReflection> reflectShader(uint64_t hash, uint64_t checksum, vk::ArrayProxy<const uint32_t> spirv,
+                                                               const std::string & entry);
+
 Shader Shader::EMPTY({});
 
 Shader::Shader(const ConstructParameters & params): Root(params), _gi(params.gi) {
     if (params.spirv.empty()) return; // Constructing an empty shader module. Not an error.
-    _handle = _gi->device.createShaderModule({{}, params.spirv.size() * sizeof(uint32_t), params.spirv.data()}, _gi->allocator);
-    _entry  = params.entry;
-    _spirv.assign(params.spirv.begin(), params.spirv.end());
+    _handle     = _gi->device.createShaderModule({{}, params.spirv.size() * sizeof(uint32_t), params.spirv.data()}, _gi->allocator);
+    _entry      = params.entry;
+    _hash       = rv_details::fnv1a(params.spirv.data(), params.spirv.size() * sizeof(uint32_t));
+    _hash       = rv_details::fnv1a(_entry.c_str(), _entry.size() + 1, _hash);
+    _checksum   = rv_details::mix64(params.spirv.data(), params.spirv.size() * sizeof(uint32_t));
+    _checksum   = rv_details::mix64(_entry.c_str(), _entry.size() + 1, _checksum);
+    _reflection = reflectShader(_hash, _checksum, params.spirv, _entry);
+    if (params.keepSpirv) _spirv.assign(params.spirv.begin(), params.spirv.end());
 }
 
 Shader::~Shader() { _gi->safeDestroy(_handle); }
@@ -1121,9 +1269,9 @@ public:
 
     ~RenderPass();
 
-    void cmdBegin(vk::CommandBuffer, vk::RenderPassBeginInfo) const;
+    void cmdBegin(vk::CommandBuffer, vk::RenderPassBeginInfo, vk::SubpassContents = vk::SubpassContents::eInline) const;
 
-    void cmdNext(vk::CommandBuffer) const;
+    void cmdNext(vk::CommandBuffer, vk::SubpassContents = vk::SubpassContents::eInline) const;
 
     void cmdEnd(vk::CommandBuffer) const;
 
@@ -1199,6 +1347,7 @@ RenderPass::RenderPass(const ConstructParameters & cp): Root(cp), _gi(cp.gi) {
     ci.setSubpasses(subpasses);
     ci.setDependencies(cp.dependencies);
     _handle = _gi->device.createRenderPass(ci, _gi->allocator);
+    if (_gi->pipelineRegistry) _gi->pipelineRegistry->addRenderPass(_handle, ci);
 
 #if RAPID_VULKAN_ENABLE_DEBUG_BUILD
     _cp = cp;
@@ -1206,14 +1355,17 @@ RenderPass::RenderPass(const ConstructParameters & cp): Root(cp), _gi(cp.gi) {
 #endif
 }
 
-RenderPass::~RenderPass() { _gi->safeDestroy(_handle); }
+RenderPass::~RenderPass() {
+    if (_gi->pipelineRegistry) _gi->pipelineRegistry->removeRenderPass(_handle);
+    _gi->safeDestroy(_handle);
+}
 
-void RenderPass::cmdBegin(vk::CommandBuffer cb, vk::RenderPassBeginInfo info) const {
+void RenderPass::cmdBegin(vk::CommandBuffer cb, vk::RenderPassBeginInfo info, vk::SubpassContents contents) const {
     info.setRenderPass(_handle);
-    cb.beginRenderPass(info, vk::SubpassContents::eInline);
+    cb.beginRenderPass(info, contents);
 }
 
-void RenderPass::cmdNext(vk::CommandBuffer cb) const { cb.nextSubpass(vk::SubpassContents::eInline); }
+void RenderPass::cmdNext(vk::CommandBuffer cb, vk::SubpassContents contents) const { cb.nextSubpass(contents); }
 
 void RenderPass::cmdEnd(vk::CommandBuffer cb) const { cb.endRenderPass(); }
 
@@ -1383,7 +1535,7 @@ static PipelineReflection convertRefl(std::map<uint32_t, MergedDescriptorSet> &
     return refl;
 }
 
-static void convertVertexInputs(PipelineReflection & refl, vk::ArrayProxy<SpvReflectInterfaceVariable *> vertexInputs) {
+static void convertVertexInputs(PipelineReflection & refl, vk::ArrayProxy<SpvReflectInterfaceVariable * const> vertexInputs) {
     for (auto i : vertexInputs) {
         auto name = std::string(i->name);
         if (name.substr(0, 3) == "gl_") continue; // skip OpenGL's reserved inputs.
@@ -1391,98 +1543,502 @@ static void convertVertexInputs(PipelineReflection & refl, vk::ArrayProxy<SpvRef
     }
 }
 
-static PipelineReflection reflectShaders(const std::string & pipelineName, vk::ArrayProxy<const Shader * const> shaders) {
-    RVI_ASSERT(!shaders.empty());
+/// Scan the SPIR-V code for named specialization constants.
+static void reflectSpecializationConstants(PipelineReflection & refl, vk::ArrayProxy<const uint32_t> spirv, vk::ShaderStageFlagBits stage) {
+    std::unordered_map<uint32_t, std::string> names;     // key is result ID
+    std::unordered_map<uint32_t, uint32_t>    specIds;   // key is result ID, value is constant ID
+    std::unordered_map<uint32_t, uint32_t>    typeSizes; // key is type ID, value is size in bytes
+    std::map<uint32_t, uint32_t>              constants; // key is result ID, value is type ID
+
+    // Skip the 5 words of module header. Then walk through all instructions.
+    for (size_t i = 5; i < spirv.size();) {
+        auto   p     = spirv.data() + i;
+        auto   op    = p[0] & 0xFFFF;
+        size_t count = p[0] >> 16;
+        if (0 == count || i + count > spirv.size()) break; // corrupted code.
+        switch (op) {
+        case SpvOpName:
+            if (count > 2) names[p[1]] = std::string((const char *) (p + 2), strnlen((const char *) (p + 2), (count - 2) * sizeof(uint32_t)));
+            break;
+        case SpvOpDecorate:
+            if (count > 3 && SpvDecorationSpecId == p[2]) specIds[p[1]] = p[3];
+            break;
+        case SpvOpTypeBool:
+            typeSizes[p[1]] = sizeof(VkBool32);
+            break;
+        case SpvOpTypeInt:
+        case SpvOpTypeFloat:
+            typeSizes[p[1]] = p[2] / 8;
+            break;
+        case SpvOpSpecConstantTrue:
+        case SpvOpSpecConstantFalse:
+        case SpvOpSpecConstant:
+            constants[p[2]] = p[1];
+            break;
+        default:
+            break;
+        }
+        i += count;
+    }
+
+    for (const auto & [result, type] : constants) {
+        auto id   = specIds.find(result);
+        auto name = names.find(result);
+        if (id == specIds.end() || name == names.end() || name->second.empty()) continue; // unnamed constant can only be referenced by ID.
+        refl.specializations[name->second] = {id->second, typeSizes[type], stage};
+    }
+}
 
+/// Reflect one shader module with spirv-reflect.
+static PipelineReflection reflectSpirv(vk::ArrayProxy<const uint32_t> spirv, const std::string & entry) {
     // The first uint32_t is set index. The 2nd one is shader variable name.
     std::map<uint32_t, MergedDescriptorSet> merged;
 
-    std::vector<SpvReflectInterfaceVariable *> vertexInputs;
+    SpvReflectShaderModule module;
+    SpvReflectResult       result = spvReflectCreateShaderModule(spirv.size() * sizeof(uint32_t), spirv.data(), &module);
+    RVI_REQUIRE(result == SPV_REFLECT_RESULT_SUCCESS);
 
-    PipelineReflection::ConstantLayout constants;
+    // Extract descriptor sets from the shader.
+    auto sets = enumerateShaderVariables<SpvReflectDescriptorSet>(module, spvReflectEnumerateEntryPointDescriptorSets, entry.c_str());
+    for (const auto & set : sets) mergeDescriptorSet(merged[set->set], module, {set->binding_count, set->bindings});
 
-    std::vector<SpvReflectShaderModule> modules;
+    // Convert descriptors. Have to do it before destroying the module, since the merged set references data in it.
+    auto refl = convertRefl(merged);
 
-    for (const auto & shader : shaders) {
-        // ignore null shader pointer
-        if (!shader) continue;
+    // enumerate push constants
+    auto pc = enumerateShaderVariables<SpvReflectBlockVariable>(module, spvReflectEnumeratePushConstantBlocks);
+    for (const auto & c : pc) {
+        auto & sc = refl.constants[(vk::ShaderStageFlagBits) module.shader_stage];
+        sc.begin  = std::min(sc.begin, (uint32_t) c->offset);
+        sc.end    = std::max(sc.end, (uint32_t) (c->offset + c->size));
+    }
 
-        // Ignore shader w/o spirv code
-        auto spirv = shader->spirv();
-        if (spirv.empty()) continue;
+    // Enumerate vertex shader inputs
+    if (module.shader_stage == SPV_REFLECT_SHADER_STAGE_VERTEX_BIT) {
+        convertVertexInputs(refl, enumerateShaderVariables<SpvReflectInterfaceVariable>(module, spvReflectEnumerateInputVariables));
+    }
 
-        SpvReflectShaderModule module;
-        SpvReflectResult       result = spvReflectCreateShaderModule(spirv.size() * sizeof(uint32_t), spirv.data(), &module);
-        RVI_REQUIRE(result == SPV_REFLECT_RESULT_SUCCESS);
+    // Enumerate specialization constants. spirv-reflect doesn't support them yet.
+    reflectSpecializationConstants(refl, spirv, (vk::ShaderStageFlagBits) module.shader_stage);
 
-        // Extract descriptor sets from each shader, then merge together.
-        auto sets = enumerateShaderVariables<SpvReflectDescriptorSet>(module, spvReflectEnumerateEntryPointDescriptorSets, shader->entry().c_str());
-        for (const auto & set : sets) mergeDescriptorSet(merged[set->set], module, {set->binding_count, set->bindings});
+    spvReflectDestroyShaderModule(&module);
+    return refl;
+}
 
-        // enumerate push constants
-        auto pc = enumerateShaderVariables<SpvReflectBlockVariable>(module, spvReflectEnumeratePushConstantBlocks);
-        for (const auto & c : pc) {
-            auto & sc = constants[(vk::ShaderStageFlagBits) module.shader_stage];
-            sc.begin  = std::min(sc.begin, (uint32_t) c->offset);
-            sc.end    = std::max(sc.end, (uint32_t) (c->offset + c->size));
-        }
+// ---------------------------------------------------------------------------------------------------------------------
+/// Get reflection of the shader code. The result is memoized by the hash of the shader, so repeated shaders are
+/// reflected only once. A hit is verified against the checksum and the entry point of the shader, so shaders with
+/// colliding hash are never handed each other's reflection. Reflection is device independent, so the cache is shared by
+/// the whole process. It only holds weak references, to let the reflection go away along with the last shader that uses it.
+static std::shared_ptr<const PipelineReflection> reflectShader(uint64_t hash, uint64_t checksum, vk::ArrayProxy<const uint32_t> spirv,
+                                                               const std::string & entry) {
+    struct Entry {
+        uint64_t                                checksum {};
+        std::string                             entry;
+        std::weak_ptr<const PipelineReflection> reflection;
+    };
+    static std::mutex                          mutex;
+    static std::unordered_map<uint64_t, Entry> cache;
+
+    // Returns the cached reflection, if the entry is of the same shader. Sets the flag, if it is of another live shader.
+    auto lookup = [&](const Entry & e, bool & collided) -> std::shared_ptr<const PipelineReflection> {
+        auto r   = e.reflection.lock();
+        collided = r && (e.checksum != checksum || e.entry != entry);
+        return collided ? nullptr : r;
+    };
 
-        // Enumerate vertex shader inputs
-        if (module.shader_stage == SPV_REFLECT_SHADER_STAGE_VERTEX_BIT) {
-            vertexInputs = enumerateShaderVariables<SpvReflectInterfaceVariable>(module, spvReflectEnumerateInputVariables);
-        }
+    bool collided = false;
+    {
+        auto lock = std::lock_guard {mutex};
+        auto iter = cache.find(hash);
+        if (iter != cache.end())
+            if (auto r = lookup(iter->second, collided)) return r;
+    }
+    std::shared_ptr<const PipelineReflection> r = std::make_shared<PipelineReflection>(reflectSpirv(spirv, entry));
+    auto                                      lock = std::lock_guard {mutex};
+    auto &                                    e    = cache[hash];
+    if (auto existing = lookup(e, collided)) return existing; // another thread has reflected the same shader in the mean time.
+    if (collided) {
+        // Leave the entry to the shader that owns it. This one gets a private copy of its own reflection.
+        RVI_LOGW("Shader hash collision: 0x%016" PRIx64 ". The shader is reflected without being cached.", hash);
+        return r;
+    }
+    e = {checksum, entry, r};
+    if (0 == (cache.size() % 256)) {
+        // purge expired entries every once a while.
+        for (auto iter = cache.begin(); iter != cache.end();) iter = iter->second.reflection.expired() ? cache.erase(iter) : std::next(iter);
+    }
+    return r;
+}
 
-        // store module to module list. we can't delete it yet, because the convertRefl() function still references data in it.
-        modules.push_back(module);
+// ---------------------------------------------------------------------------------------------------------------------
+/// Merge reflection of one shader into the reflection of the pipeline.
+static void mergeReflection(PipelineReflection & dst, const PipelineReflection & src) {
+    if (dst.descriptors.size() < src.descriptors.size()) dst.descriptors.resize(src.descriptors.size());
+    for (size_t s = 0; s < src.descriptors.size(); ++s) {
+        auto &       ds = dst.descriptors[s];
+        const auto & ss = src.descriptors[s];
+        if (ds.size() < ss.size()) ds.resize(ss.size());
+        for (size_t b = 0; b < ss.size(); ++b) {
+            const auto & sd = ss[b];
+            auto &       dd = ds[b];
+            if (sd.names.empty()) continue;
+            if (dd.names.empty()) {
+                dd = sd;
+                continue;
+            }
+            // check for possible conflict
+            if (dd.binding.descriptorType != sd.binding.descriptorType)
+                RVI_LOGE("Shader variable %s has conflicting types: %d != %d", sd.names.begin()->c_str(), (int) dd.binding.descriptorType,
+                         (int) sd.binding.descriptorType);
+            dd.binding.stageFlags |= sd.binding.stageFlags;
+            dd.names.insert(sd.names.begin(), sd.names.end());
+        }
     }
+    for (const auto & [stage, c] : src.constants) {
+        auto & dc = dst.constants[stage];
+        dc.begin  = std::min(dc.begin, c.begin);
+        dc.end    = std::max(dc.end, c.end);
+    }
+    for (const auto & [location, v] : src.vertex) dst.vertex[location] = v;
+    for (const auto & [name, c] : src.specializations) {
+        auto iter = dst.specializations.find(name);
+        if (iter == dst.specializations.end()) {
+            dst.specializations[name] = c;
+        } else if (iter->second.id != c.id) {
+            RVI_LOGE("Specialization constant %s has conflicting IDs: %u != %u", name.c_str(), iter->second.id, c.id);
+        } else {
+            iter->second.stages |= c.stages;
+        }
+    }
+}
 
-    // Convert program descriptors
-    auto refl = convertRefl(merged);
-
-    // Convert vertex shader inputs
-    convertVertexInputs(refl, vertexInputs);
-
-    // Store push constants
-    refl.constants = constants;
-
-    // Destroy all modules.
-    for (auto & m : modules) spvReflectDestroyShaderModule(&m);
-
-    // done
+static PipelineReflection reflectShaders(const std::string & pipelineName, vk::ArrayProxy<const Shader * const> shaders) {
+    RVI_ASSERT(!shaders.empty());
+    PipelineReflection refl;
+    for (const auto & shader : shaders) {
+        // Ignore null or empty shader.
+        if (!shader || !shader->reflection()) continue;
+        mergeReflection(refl, *shader->reflection());
+    }
     refl.name = pipelineName;
     return refl;
 }
 
 // *********************************************************************************************************************
-// PipelineLayout
+// Pipeline Cache
 // *********************************************************************************************************************
 
-// ---------------------------------------------------------------------------------------------------------------------
-/// A wrapper class for VkPipelineLayout
-class PipelineLayout : public Root {
+class PipelineCache::Impl {
 public:
-    struct ConstructParameters : public Root::ConstructParameters {
-        vk::ArrayProxy<const Shader * const> shaders;
-    };
+    Impl(PipelineCache & owner, const ConstructParameters & cp): _owner(owner), _gi(cp.gi), _path(cp.path), _workerCount(cp.workerCount) {
+        RVI_REQUIRE(cp.gi);
+        auto data = load();
+        _handle   = _gi->device.createPipelineCache(vk::PipelineCacheCreateInfo().setInitialDataSize(data.size()).setPInitialData(data.data()),
+                                                    _gi->allocator);
+        onNameChanged();
+    }
 
-    PipelineLayout(const ConstructParameters &);
+    ~Impl() {
+        stop();
+        if (!_path.empty()) save();
+        _gi->safeDestroy(_handle);
+    }
 
-    ~PipelineLayout() override;
+    vk::PipelineCache handle() const { return _handle; }
 
-    const GlobalInfo & gi() const;
+    Stats stats() const { return {_hits, _misses, _unknown}; }
 
-    /// @brief Returns the underlying Vulkan handle.
-    vk::PipelineLayout handle() const;
+    bool save() const {
+        if (_path.empty() || !_handle) return false;
+        auto data = _gi->device.getPipelineCacheData(_handle);
+        auto file = std::ofstream(_path, std::ios::binary | std::ios::trunc);
+        if (!file.write((const char *) data.data(), (std::streamsize) data.size())) {
+            RVI_LOGE("Failed to save pipeline cache %s to file %s.", _owner.name().c_str(), _path.c_str());
+            return false;
+        }
+        RVI_LOGI("Pipeline cache %s saved to %s (%zu bytes).", _owner.name().c_str(), _path.c_str(), data.size());
+        return true;
+    }
 
-    const PipelineReflection & reflection() const;
+    /// Create pipelines in one batch. Returned array has one pipeline for each create info.
+    template<typename CREATE_INFO>
+    std::vector<vk::Pipeline> create(vk::ArrayProxy<const CREATE_INFO> cis) {
+        if (!_gi->pipelineCreationFeedback) {
+            _unknown += cis.size();
+            return createPipelines<CREATE_INFO>(cis);
+        }
 
-protected:
-    void onNameChanged(const std::string &) override;
+        // Chain the creation feedback structure to find out if the pipeline is found in the cache or not.
+        auto                                                   copies = std::vector<CREATE_INFO>(cis.begin(), cis.end());
+        std::vector<vk::PipelineCreationFeedback>              feedbacks(copies.size());
+        std::vector<std::vector<vk::PipelineCreationFeedback>> stages(copies.size());
+        std::vector<vk::PipelineCreationFeedbackCreateInfo>    fcis(copies.size());
+        for (size_t i = 0; i < copies.size(); ++i) {
+            stages[i].resize(stageCount(copies[i]));
+            fcis[i].setPPipelineCreationFeedback(&feedbacks[i]).setPipelineStageCreationFeedbacks(stages[i]);
+            fcis[i].pNext   = copies[i].pNext;
+            copies[i].pNext = &fcis[i];
+        }
+        auto pipelines = createPipelines<CREATE_INFO>(copies);
+        for (const auto & f : feedbacks) {
+            if (!(f.flags & vk::PipelineCreationFeedbackFlagBits::eValid))
+                ++_unknown;
+            else if (f.flags & vk::PipelineCreationFeedbackFlagBits::eApplicationPipelineCacheHit)
+                ++_hits;
+            else
+                ++_misses;
+        }
+        return pipelines;
+    }
+
+    template<typename CREATE_INFO>
+    void createAsync(const CREATE_INFO & ci, std::function<void(vk::Pipeline)> && callback) {
+        auto lock = std::lock_guard {_jobMutex};
+        if (_workers.empty()) {
+            // Start the worker threads on the first async request.
+            auto count = _workerCount ? _workerCount : std::max(1u, std::thread::hardware_concurrency() / 2);
+            for (uint32_t i = 0; i < count; ++i) _workers.emplace_back([this] { work(); });
+        }
+        _jobs.push_back({std::move(callback)});
+        if constexpr (std::is_same_v<CREATE_INFO, vk::GraphicsPipelineCreateInfo>)
+            _jobs.back().graphics = ci;
+        else
+            _jobs.back().compute = ci;
+        _jobSignal.notify_one();
+    }
+
+    void onNameChanged() {
+        if (_handle) setVkHandleName(_gi->device, _handle, _owner.name());
+    }
 
 private:
-    class Impl;
-    Impl * _impl = nullptr;
-};
+    /// A pending async pipeline creation request. Only one of the create info is valid.
+    struct Job {
+        std::function<void(vk::Pipeline)>              callback;
+        std::optional<vk::GraphicsPipelineCreateInfo> graphics;
+        std::optional<vk::ComputePipelineCreateInfo>  compute;
+    };
+
+    /// Max number of pipelines created by one driver call.
+    static constexpr size_t MAX_BATCH_SIZE = 16;
+
+    PipelineCache &          _owner;
+    const GlobalInfo *       _gi {};
+    std::string              _path;
+    vk::PipelineCache        _handle {};
+    std::atomic<uint64_t>    _hits {};
+    std::atomic<uint64_t>    _misses {};
+    std::atomic<uint64_t>    _unknown {};
+    uint32_t                 _workerCount {};
+    std::vector<std::thread> _workers;
+    std::deque<Job>          _jobs;
+    std::mutex               _jobMutex;
+    std::condition_variable  _jobSignal;
+    bool                     _quit = false;
+
+private:
+    static uint32_t stageCount(const vk::GraphicsPipelineCreateInfo & ci) { return ci.stageCount; }
+
+    static uint32_t stageCount(const vk::ComputePipelineCreateInfo &) { return 1; }
+
+    vk::Result createPipelines(const vk::GraphicsPipelineCreateInfo * cis, uint32_t count, vk::Pipeline * pipelines) {
+        return _gi->device.createGraphicsPipelines(_handle, count, cis, _gi->allocator, pipelines);
+    }
+
+    vk::Result createPipelines(const vk::ComputePipelineCreateInfo * cis, uint32_t count, vk::Pipeline * pipelines) {
+        return _gi->device.createComputePipelines(_handle, count, cis, _gi->allocator, pipelines);
+    }
+
+    /// Create pipelines in one driver call. Failed ones are null in the returned array. If the batch fails, the pipelines
+    /// that are created are kept, and the failed ones are retried one by one. So one bad pipeline doesn't fail the others.
+    template<typename CREATE_INFO>
+    std::vector<vk::Pipeline> createPipelines(vk::ArrayProxy<const CREATE_INFO> cis) {
+        std::vector<vk::Pipeline> pipelines(cis.size());
+        auto                      result = createPipelines(cis.data(), cis.size(), pipelines.data());
+        if (vk::Result::eSuccess == result) return pipelines;
+        for (uint32_t i = 0; i < cis.size(); ++i) {
+            if (pipelines[i]) continue;
+            if (cis.size() > 1) result = createPipelines(cis.data() + i, 1, &pipelines[i]);
+            if (vk::Result::eSuccess != result) {
+                RVI_LOGE("Failed to create pipeline: %s", vk::to_string(result).c_str());
+                _gi->safeDestroy(pipelines[i]); // in case the driver returns a partial handle.
+            }
+        }
+        return pipelines;
+    }
+
+    void work() {
+        for (;;) {
+            // Grab a batch of jobs of the same type. Leave some for the other workers, if the queue is short.
+            std::vector<Job> batch;
+            {
+                auto lock = std::unique_lock {_jobMutex};
+                _jobSignal.wait(lock, [&] { return _quit || !_jobs.empty(); });
+                if (_quit) return;
+                auto size     = std::min(MAX_BATCH_SIZE, (_jobs.size() + _workers.size() - 1) / _workers.size());
+                bool graphics = _jobs.front().graphics.has_value();
+                while (!_jobs.empty() && batch.size() < size && _jobs.front().graphics.has_value() == graphics) {
+                    batch.push_back(std::move(_jobs.front()));
+                    _jobs.pop_front();
+                }
+            }
+            run(batch);
+        }
+    }
+
+    void run(std::vector<Job> & batch) {
+        std::vector<vk::Pipeline> pipelines;
+        if (batch.front().graphics) {
+            std::vector<vk::GraphicsPipelineCreateInfo> cis;
+            for (const auto & j : batch) cis.push_back(*j.graphics);
+            pipelines = create<vk::GraphicsPipelineCreateInfo>(cis);
+        } else {
+            std::vector<vk::ComputePipelineCreateInfo> cis;
+            for (const auto & j : batch) cis.push_back(*j.compute);
+            pipelines = create<vk::ComputePipelineCreateInfo>(cis);
+        }
+        RVI_ASSERT(pipelines.size() == batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) batch[i].callback(pipelines[i]);
+    }
+
+    /// Stop all worker threads. Cancel pending requests.
+    void stop() {
+        {
+            auto lock = std::lock_guard {_jobMutex};
+            _quit     = true;
+        }
+        _jobSignal.notify_all();
+        for (auto & w : _workers) w.join();
+        _workers.clear();
+        for (auto & j : _jobs) j.callback({});
+        _jobs.clear();
+    }
+
+    /// Load cache data from the file. Returns empty data, if the file is missing or is created by a different driver/device.
+    std::vector<uint8_t> load() const {
+        if (_path.empty()) return {};
+        auto file = std::ifstream(_path, std::ios::binary);
+        if (!file) return {}; // it is normal that the cache file does not exist yet.
+        auto data = std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        // Validate the header (VkPipelineCacheHeaderVersionOne): headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID.
+        uint32_t header[4] {};
+        if (data.size() < sizeof(header) + VK_UUID_SIZE) {
+            RVI_LOGW("Pipeline cache file %s is ignored: file is too small.", _path.c_str());
+            return {};
+        }
+        memcpy(header, data.data(), sizeof(header));
+        auto props = _gi->physical.getProperties();
+        if (header[0] < sizeof(header) + VK_UUID_SIZE || header[1] != (uint32_t) vk::PipelineCacheHeaderVersion::eOne || header[2] != props.vendorID ||
+            header[3] != props.deviceID || 0 != memcmp(data.data() + sizeof(header), props.pipelineCacheUUID.data(), VK_UUID_SIZE)) {
+            RVI_LOGW("Pipeline cache file %s is ignored: it is created by a different driver or device.", _path.c_str());
+            return {};
+        }
+        RVI_LOGI("Pipeline cache %s loaded from %s (%zu bytes).", _owner.name().c_str(), _path.c_str(), data.size());
+        return data;
+    }
+};
+
+PipelineCache::PipelineCache(const ConstructParameters & cp): Root(cp) { _impl = new Impl(*this, cp); }
+PipelineCache::~PipelineCache() {
+    delete _impl;
+    _impl = nullptr;
+}
+auto PipelineCache::handle() const -> vk::PipelineCache { return _impl->handle(); }
+auto PipelineCache::stats() const -> Stats { return _impl->stats(); }
+bool PipelineCache::save() const { return _impl->save(); }
+auto PipelineCache::createGraphicsPipeline(const vk::GraphicsPipelineCreateInfo & ci) -> vk::Pipeline {
+    auto p = _impl->create<vk::GraphicsPipelineCreateInfo>(ci)[0];
+    if (!p) RVI_THROW("Failed to create graphics pipeline.");
+    return p;
+}
+auto PipelineCache::createComputePipeline(const vk::ComputePipelineCreateInfo & ci) -> vk::Pipeline {
+    auto p = _impl->create<vk::ComputePipelineCreateInfo>(ci)[0];
+    if (!p) RVI_THROW("Failed to create compute pipeline.");
+    return p;
+}
+void PipelineCache::createGraphicsPipelineAsync(const vk::GraphicsPipelineCreateInfo & ci, std::function<void(vk::Pipeline)> callback) {
+    _impl->createAsync(ci, std::move(callback));
+}
+void PipelineCache::createComputePipelineAsync(const vk::ComputePipelineCreateInfo & ci, std::function<void(vk::Pipeline)> callback) {
+    _impl->createAsync(ci, std::move(callback));
+}
+void PipelineCache::onNameChanged(const std::string &) { _impl->onNameChanged(); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Create pipeline with the device wide pipeline cache, if there's one.
+static vk::Pipeline createPipeline(const GlobalInfo & gi, const vk::GraphicsPipelineCreateInfo & ci) {
+    if (gi.pipelineCache) return gi.pipelineCache->createGraphicsPipeline(ci);
+    return gi.device.createGraphicsPipeline(nullptr, ci, gi.allocator).value;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Create pipeline with the device wide pipeline cache, if there's one.
+static vk::Pipeline createPipeline(const GlobalInfo & gi, const vk::ComputePipelineCreateInfo & ci) {
+    if (gi.pipelineCache) return gi.pipelineCache->createComputePipeline(ci);
+    return gi.device.createComputePipeline(nullptr, ci, gi.allocator).value;
+}
+
+// *********************************************************************************************************************
+// PipelineLayout
+// *********************************************************************************************************************
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Size of the descriptor info structure of the descriptor type. Returns 0 for unsupported type.
+static size_t descriptorInfoSize(vk::DescriptorType t) {
+    switch (t) {
+    case vk::DescriptorType::eSampler:
+    case vk::DescriptorType::eCombinedImageSampler:
+    case vk::DescriptorType::eSampledImage:
+    case vk::DescriptorType::eStorageImage:
+    case vk::DescriptorType::eInputAttachment:
+        return sizeof(vk::DescriptorImageInfo);
+    case vk::DescriptorType::eUniformBuffer:
+    case vk::DescriptorType::eStorageBuffer:
+    case vk::DescriptorType::eUniformBufferDynamic:
+    case vk::DescriptorType::eStorageBufferDynamic:
+        return sizeof(vk::DescriptorBufferInfo);
+    default:
+        return 0;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Descriptor infos of one set are packed into one block: one array for each non-empty binding, in binding order, each
+/// array starting at 8-byte aligned offset. This is the layout consumed by the descriptor update template of the
+/// pipeline layout. Drawable uses the same layout to pack descriptor infos into DrawPack.
+static size_t alignDescriptorInfoOffset(size_t offset) { return (offset + 7) & ~(size_t) 7; }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// A wrapper class for VkPipelineLayout
+class PipelineLayout : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        vk::ArrayProxy<const Shader * const> shaders;
+    };
+
+    PipelineLayout(const ConstructParameters &);
+
+    ~PipelineLayout() override;
+
+    const GlobalInfo & gi() const;
+
+    /// @brief Returns the underlying Vulkan handle.
+    vk::PipelineLayout handle() const;
+
+    const PipelineReflection & reflection() const;
+
+    /// @brief Returns the descriptor update template of the set. Null if not available.
+    vk::DescriptorUpdateTemplate descriptorUpdateTemplate(uint32_t set) const;
+
+protected:
+    void onNameChanged(const std::string &) override;
+
+private:
+    class Impl;
+    Impl * _impl = nullptr;
+};
 
 class PipelineLayout::Impl {
 public:
@@ -1507,6 +2063,35 @@ public:
             _setLayouts[s] = _gi->device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo {}.setBindings(bindings), _gi->allocator);
         }
 
+        // create descriptor update templates (core since Vulkan 1.1)
+        if (_gi->apiVersion >= VK_API_VERSION_1_1) {
+            _templates.resize(_setLayouts.size());
+            for (uint32_t s = 0; s < _templates.size(); ++s) {
+                std::vector<vk::DescriptorUpdateTemplateEntry> entries;
+                size_t                                         offset = 0;
+                for (const auto & d : _reflection.descriptors[s]) {
+                    // Zero-count bindings (e.g. runtime sized arrays) are not part of the set layout. They must not take an entry
+                    // either, or the offsets of the following entries would not match the info block packed by Drawable.
+                    if (d.empty() || 0 == d.binding.descriptorCount) continue;
+                    auto size = descriptorInfoSize(d.binding.descriptorType);
+                    if (0 == size) {
+                        // unsupported descriptor type. no template for this set.
+                        entries.clear();
+                        break;
+                    }
+                    offset = alignDescriptorInfoOffset(offset);
+                    entries.push_back({d.binding.binding, 0, d.binding.descriptorCount, d.binding.descriptorType, offset, size});
+                    offset += size * d.binding.descriptorCount;
+                }
+                if (entries.empty()) continue;
+                auto ci = vk::DescriptorUpdateTemplateCreateInfo()
+                              .setDescriptorUpdateEntries(entries)
+                              .setTemplateType(vk::DescriptorUpdateTemplateType::eDescriptorSet)
+                              .setDescriptorSetLayout(_setLayouts[s]);
+                _templates[s] = _gi->device.createDescriptorUpdateTemplate(ci, _gi->allocator);
+            }
+        }
+
         // create push constant array
         std::vector<vk::PushConstantRange> pc;
         pc.reserve(_reflection.constants.size());
@@ -1523,6 +2108,8 @@ public:
     }
 
     ~Impl() {
+        for (auto & t : _templates) { _gi->safeDestroy(t); }
+        _templates.clear();
         for (auto & s : _setLayouts) { _gi->safeDestroy(s); }
         _setLayouts.clear();
         _gi->safeDestroy(_handle);
@@ -1532,6 +2119,10 @@ public:
 
     vk::PipelineLayout handle() const { return _handle; }
 
+    vk::DescriptorUpdateTemplate descriptorUpdateTemplate(uint32_t set) const {
+        return set < _templates.size() ? _templates[set] : vk::DescriptorUpdateTemplate {};
+    }
+
     const PipelineReflection & reflection() const { return _reflection; }
 
     void onNameChanged() {
@@ -1539,11 +2130,12 @@ public:
     }
 
 private:
-    PipelineLayout &                     _owner;
-    const GlobalInfo *                   _gi = nullptr;
-    PipelineReflection                   _reflection;
-    vk::PipelineLayout                   _handle;
-    std::vector<vk::DescriptorSetLayout> _setLayouts;
+    PipelineLayout &                          _owner;
+    const GlobalInfo *                        _gi = nullptr;
+    PipelineReflection                        _reflection;
+    vk::PipelineLayout                        _handle;
+    std::vector<vk::DescriptorSetLayout>      _setLayouts;
+    std::vector<vk::DescriptorUpdateTemplate> _templates; ///< one for each descriptor set. Empty if not supported.
 };
 
 PipelineLayout::PipelineLayout(const ConstructParameters & cp): Root(cp) { _impl = new Impl(*this, cp.shaders); }
@@ -1554,8 +2146,414 @@ PipelineLayout::~PipelineLayout() {
 auto PipelineLayout::gi() const -> const GlobalInfo & { return _impl->gi(); }
 auto PipelineLayout::handle() const -> vk::PipelineLayout { return _impl->handle(); }
 auto PipelineLayout::reflection() const -> const PipelineReflection & { return _impl->reflection(); }
+auto PipelineLayout::descriptorUpdateTemplate(uint32_t set) const -> vk::DescriptorUpdateTemplate { return _impl->descriptorUpdateTemplate(set); }
 void PipelineLayout::onNameChanged(const std::string &) { _impl->onNameChanged(); }
 
+// *********************************************************************************************************************
+// Pipeline Registry
+// *********************************************************************************************************************
+
+static uint64_t floatBits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+/// Append identity of the shader to the signature. Both hashes of the content are signed, so shaders whose hash() collides
+/// still sign differently. Empty shader signs as zeros.
+static void signShader(rv_details::Signature & sig, const Shader * s) {
+    bool valid = s && s->handle();
+    sig.push_back(valid ? s->hash() : 0);
+    sig.push_back(valid ? s->checksum() : 0);
+}
+
+/// Get values of the specialization constants keyed by constant ID. Names are resolved to IDs via reflection of the shader
+/// stage. Constants set by name take precedence over the ones set by ID. Names that can't be resolved are skipped, with a
+/// warning if the pipeline name is provided.
+static std::map<uint32_t, SpecializationConstants::Value> resolveSpecialization(const SpecializationConstants & sc, const PipelineReflection * refl,
+                                                                               vk::ShaderStageFlagBits stage, const std::string * pipelineName) {
+    auto values = sc.ids;
+    for (const auto & [name, v] : sc.names) {
+        const PipelineReflection::SpecializationConstant * c = nullptr;
+        if (refl) {
+            auto iter = refl->specializations.find(name);
+            if (iter != refl->specializations.end() && (iter->second.stages & stage)) c = &iter->second;
+        }
+        if (!c) {
+            if (pipelineName)
+                RVI_LOGW("Pipeline %s: specialization constant %s is not found in shader stage %s.", pipelineName->c_str(), name.c_str(),
+                         vk::to_string(stage).c_str());
+            continue;
+        }
+        if (c->size != v.size) {
+            if (pipelineName)
+                RVI_LOGW("Pipeline %s: specialization constant %s expects %u bytes value, but %u bytes are provided.", pipelineName->c_str(),
+                         name.c_str(), c->size, v.size);
+            continue;
+        }
+        values[c->id] = v;
+    }
+    return values;
+}
+
+/// Append values of the specialization constants to the signature. The constants are signed by ID, after resolving the names.
+/// So constants set by name and by ID sign the same, as long as they end up with the same values.
+static void signSpecialization(rv_details::Signature & sig, const SpecializationConstants & sc, const Shader * shader, vk::ShaderStageFlagBits stage) {
+    auto refl   = (shader && shader->reflection()) ? shader->reflection().get() : nullptr;
+    auto values = resolveSpecialization(sc, refl, stage, nullptr);
+    sig.push_back(values.size());
+    for (const auto & [id, v] : values) {
+        sig.push_back(id | (uint64_t) v.size << 32);
+        sig.push_back(v.bits);
+    }
+}
+
+/// Append the parts of the render pass description that matter for render pass compatibility to the signature. Load
+/// and store operations and image layouts are left out. Returns false, if the description can't be signed.
+static bool signRenderPass(rv_details::Signature & sig, const vk::RenderPassCreateInfo & ci) {
+    if (ci.pNext) return false; // extension structures are not signed.
+
+    auto u   = [&](uint64_t v) { sig.push_back(v); };
+    auto ref = [&](const vk::AttachmentReference * r) { u(r ? r->attachment : VK_ATTACHMENT_UNUSED); };
+
+    u((VkRenderPassCreateFlags) ci.flags);
+    u(ci.attachmentCount);
+    for (uint32_t i = 0; i < ci.attachmentCount; ++i) {
+        const auto & a = ci.pAttachments[i];
+        u((VkAttachmentDescriptionFlags) a.flags | (uint64_t) a.format << 32);
+        u((uint64_t) a.samples);
+    }
+    u(ci.subpassCount);
+    for (uint32_t i = 0; i < ci.subpassCount; ++i) {
+        const auto & s = ci.pSubpasses[i];
+        u((VkSubpassDescriptionFlags) s.flags | (uint64_t) s.pipelineBindPoint << 32);
+        u(s.inputAttachmentCount);
+        for (uint32_t j = 0; j < s.inputAttachmentCount; ++j) ref(&s.pInputAttachments[j]);
+        u(s.colorAttachmentCount);
+        for (uint32_t j = 0; j < s.colorAttachmentCount; ++j) {
+            ref(&s.pColorAttachments[j]);
+            ref(s.pResolveAttachments ? &s.pResolveAttachments[j] : nullptr);
+        }
+        ref(s.pDepthStencilAttachment);
+        u(s.preserveAttachmentCount);
+        for (uint32_t j = 0; j < s.preserveAttachmentCount; ++j) u(s.pPreserveAttachments[j]);
+    }
+    u(ci.dependencyCount);
+    for (uint32_t i = 0; i < ci.dependencyCount; ++i) {
+        const auto & d = ci.pDependencies[i];
+        u(d.srcSubpass | (uint64_t) d.dstSubpass << 32);
+        u((VkPipelineStageFlags) d.srcStageMask | (uint64_t) (VkPipelineStageFlags) d.dstStageMask << 32);
+        u((VkAccessFlags) d.srcAccessMask | (uint64_t) (VkAccessFlags) d.dstAccessMask << 32);
+        u((VkDependencyFlags) d.dependencyFlags);
+    }
+    return true;
+}
+
+/// State subsets of graphics pipeline. Values match VkGraphicsPipelineLibraryFlagBitsEXT.
+enum GraphicsStateSubset : uint32_t {
+    VERTEX_INPUT_STATES      = 0x1,
+    PRE_RASTERIZATION_STATES = 0x2,
+    FRAGMENT_SHADER_STATES   = 0x4,
+    FRAGMENT_OUTPUT_STATES   = 0x8,
+    ALL_GRAPHICS_STATES      = 0xF,
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Generate signature of the graphics pipeline states that belong to the subsets. Returns false, if the states can't be
+/// signed. The render pass is signed by the ID of its description (see PipelineRegistry::Impl::renderPassId()), instead
+/// of the handle.
+static bool signGraphicsStates(rv_details::Signature & sig, const GraphicsPipeline::ConstructParameters & cp, uint32_t subsets, uint64_t pass) {
+    // extension structures and sample masks are not signed.
+    if (cp.ia.pNext || cp.tess.pNext || cp.rast.pNext || cp.msaa.pNext || cp.msaa.pSampleMask || cp.depth.pNext) return false;
+
+    auto u = [&](uint64_t v) { sig.push_back(v); };
+    auto f = [&](float v) { sig.push_back(floatBits(v)); };
+
+    auto stage = [&](vk::ShaderStageFlagBits s, const Shader * shader) {
+        signShader(sig, shader);
+        auto iter = cp.specializations.find(s);
+        u(iter != cp.specializations.end());
+        if (iter != cp.specializations.end()) signSpecialization(sig, iter->second, shader, s);
+    };
+
+    u(subsets);
+
+    // Render pass and dynamic states are shared by all subsets, except vertex input.
+    if (subsets & ~VERTEX_INPUT_STATES) {
+        u(pass);
+        u(cp.subpass);
+    }
+    u(cp.dynamic.size());
+    for (const auto & [k, v] : cp.dynamic) {
+        u((uint64_t) k);
+        u(v);
+    }
+    u(cp.extendedDynamicState);
+
+    if (subsets & VERTEX_INPUT_STATES) {
+        u(cp.va.size());
+        for (const auto & a : cp.va) {
+            u(a.location | (uint64_t) a.binding << 32);
+            u(a.offset | (uint64_t) a.format << 32);
+        }
+        u(cp.vb.size());
+        for (const auto & b : cp.vb) {
+            u(b.binding | (uint64_t) b.stride << 32);
+            u((uint64_t) b.inputRate);
+        }
+        u((VkPipelineInputAssemblyStateCreateFlags) cp.ia.flags);
+        u((uint64_t) cp.ia.topology | (uint64_t) cp.ia.primitiveRestartEnable << 32);
+    }
+
+    if (subsets & PRE_RASTERIZATION_STATES) {
+        stage(vk::ShaderStageFlagBits::eVertex, cp.vs);
+        u((VkPipelineTessellationStateCreateFlags) cp.tess.flags | (uint64_t) cp.tess.patchControlPoints << 32);
+        u(cp.viewports.size());
+        for (const auto & v : cp.viewports) {
+            f(v.x), f(v.y), f(v.width), f(v.height), f(v.minDepth), f(v.maxDepth);
+        }
+        u(cp.scissors.size());
+        for (const auto & r : cp.scissors) {
+            u((uint32_t) r.offset.x | (uint64_t) (uint32_t) r.offset.y << 32);
+            u(r.extent.width | (uint64_t) r.extent.height << 32);
+        }
+        const auto & r = cp.rast;
+        u((VkPipelineRasterizationStateCreateFlags) r.flags);
+        u(r.depthClampEnable | (uint64_t) r.rasterizerDiscardEnable << 32);
+        u((uint64_t) r.polygonMode | (uint64_t) (VkCullModeFlags) r.cullMode << 32);
+        u((uint64_t) r.frontFace | (uint64_t) r.depthBiasEnable << 32);
+        f(r.depthBiasConstantFactor), f(r.depthBiasClamp), f(r.depthBiasSlopeFactor), f(r.lineWidth);
+    }
+
+    if (subsets & FRAGMENT_SHADER_STATES) {
+        stage(vk::ShaderStageFlagBits::eFragment, cp.fs);
+        const auto & d = cp.depth;
+        u((VkPipelineDepthStencilStateCreateFlags) d.flags);
+        u(d.depthTestEnable | (uint64_t) d.depthWriteEnable << 32);
+        u((uint64_t) d.depthCompareOp | (uint64_t) d.depthBoundsTestEnable << 32);
+        u(d.stencilTestEnable);
+        for (const auto & op : {d.front, d.back}) {
+            u((uint64_t) op.failOp | (uint64_t) op.passOp << 32);
+            u((uint64_t) op.depthFailOp | (uint64_t) op.compareOp << 32);
+            u(op.compareMask | (uint64_t) op.writeMask << 32);
+            u(op.reference);
+        }
+        f(d.minDepthBounds), f(d.maxDepthBounds);
+    }
+
+    // multisample states are used by both fragment shader and fragment output subsets.
+    if (subsets & (FRAGMENT_SHADER_STATES | FRAGMENT_OUTPUT_STATES)) {
+        const auto & m = cp.msaa;
+        u((VkPipelineMultisampleStateCreateFlags) m.flags);
+        u((uint64_t) m.rasterizationSamples | (uint64_t) m.sampleShadingEnable << 32);
+        f(m.minSampleShading);
+        u(m.alphaToCoverageEnable | (uint64_t) m.alphaToOneEnable << 32);
+    }
+
+    if (subsets & FRAGMENT_OUTPUT_STATES) {
+        u(cp.attachments.size());
+        for (const auto & a : cp.attachments) {
+            u(a.blendEnable | (uint64_t) (VkColorComponentFlags) a.colorWriteMask << 32);
+            u((uint64_t) a.srcColorBlendFactor | (uint64_t) a.dstColorBlendFactor << 32);
+            u((uint64_t) a.srcAlphaBlendFactor | (uint64_t) a.dstAlphaBlendFactor << 32);
+            u((uint64_t) a.colorBlendOp | (uint64_t) a.alphaBlendOp << 32);
+        }
+        for (auto c : cp.blendConstants) f(c);
+    }
+
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Generate signature of all states of the graphics pipeline. Returns false, if the states can't be signed.
+static bool signPipeline(rv_details::Signature & sig, const GraphicsPipeline::ConstructParameters & cp, uint64_t pass) {
+    sig.push_back((uint64_t) vk::PipelineBindPoint::eGraphics);
+    if (!signGraphicsStates(sig, cp, ALL_GRAPHICS_STATES, pass)) return false;
+    sig.push_back((uint64_t) (VkPipeline) cp.baseHandle);
+    sig.push_back((uint32_t) cp.baseIndex);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Generate signature of the compute pipeline.
+static bool signPipeline(rv_details::Signature & sig, const ComputePipeline::ConstructParameters & cp) {
+    sig.push_back((uint64_t) vk::PipelineBindPoint::eCompute);
+    signShader(sig, cp.cs);
+    signSpecialization(sig, cp.specialization, cp.cs, vk::ShaderStageFlagBits::eCompute);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+struct GraphicsPipelineStates;
+
+/// Pipeline library of one state subset of graphics pipeline (VK_EXT_graphics_pipeline_library). The handle is null, if
+/// the extension is not available.
+class PipelineLibrary : public Root {
+public:
+    PipelineLibrary(const GraphicsPipelineStates & states, uint32_t subset, Ref<PipelineLayout> layout);
+
+    ~PipelineLibrary() override { _gi->safeDestroy(_handle); }
+
+    vk::Pipeline handle() const { return _handle; }
+
+private:
+    const GlobalInfo *  _gi {};
+    vk::Pipeline        _handle {};
+    Ref<PipelineLayout> _layout; ///< the layout that the library is compiled against. Also keeps its handle from being reused.
+};
+
+class PipelineRegistry::Impl {
+public:
+    Impl(const ConstructParameters & cp) { RVI_REQUIRE(cp.gi); }
+
+    ~Impl() {
+        // Release pipelines first, since they are referencing the libraries and layouts.
+        _graphics.clear();
+        _compute.clear();
+        _libraries.clear();
+        _layouts.clear();
+    }
+
+    template<typename T>
+    Ref<T> pipeline(const typename T::ConstructParameters & cp) {
+        rv_details::Signature sig;
+        if (!sign(sig, cp)) {
+            ++_stats.uncached;
+            return Ref<T>::make(cp);
+        }
+        auto & map = pipelines<T>();
+        return find(map, std::move(sig), _stats.hits, _stats.misses, [&] { return Ref<T>::make(cp); });
+    }
+
+    Ref<PipelineLayout> layout(const std::string & name, vk::ArrayProxy<const Shader * const> shaders) {
+        rv_details::Signature sig;
+        for (auto s : shaders) signShader(sig, s);
+        return find(_layouts, std::move(sig), _stats.layoutHits, _stats.layoutMisses,
+                    [&] { return Ref<PipelineLayout>::make(PipelineLayout::ConstructParameters {{name}, shaders}); });
+    }
+
+    /// Get the pipeline library of the state subset. Create a new one if not found.
+    Ref<PipelineLibrary> library(const GraphicsPipelineStates & states, uint32_t subset, Ref<PipelineLayout> layout);
+
+    void addRenderPass(vk::RenderPass pass, const vk::RenderPassCreateInfo & ci) {
+        if (!pass) return;
+        rv_details::Signature sig;
+        if (!signRenderPass(sig, ci)) return; // the render pass stays unknown. So pipelines using it are not cached.
+        auto lock = std::lock_guard {_mutex};
+        // Render passes with identical description are compatible. So they share the same ID, thus the same pipelines.
+        auto id                      = _passDescriptions.try_emplace(std::move(sig), _passDescriptions.size() + 1).first->second;
+        _passes[(VkRenderPass) pass] = id;
+    }
+
+    void removeRenderPass(vk::RenderPass pass) {
+        auto lock = std::lock_guard {_mutex};
+        _passes.erase((VkRenderPass) pass);
+    }
+
+    Stats stats() const {
+        auto lock = std::lock_guard {_mutex};
+        return _stats;
+    }
+
+    size_t purge() {
+        auto   lock  = std::lock_guard {_mutex};
+        size_t count = purge(_graphics) + purge(_compute);
+        count += purge(_libraries); // purge libraries and layouts after pipelines, since pipelines are referencing them.
+        count += purge(_layouts);
+        return count;
+    }
+
+private:
+    template<typename T>
+    using Map = std::unordered_map<rv_details::Signature, Ref<T>, rv_details::SignatureHash>;
+
+    Map<GraphicsPipeline> _graphics;
+    Map<ComputePipeline>  _compute;
+    Map<PipelineLibrary>  _libraries;
+    Map<PipelineLayout>   _layouts;
+    Stats                 _stats {};
+    mutable std::mutex    _mutex;
+
+    /// IDs of the render pass descriptions. IDs start from 1. 0 is reserved for null render pass.
+    std::unordered_map<rv_details::Signature, uint64_t, rv_details::SignatureHash> _passDescriptions;
+    std::unordered_map<VkRenderPass, uint64_t>                                     _passes; ///< description ID of each known render pass.
+
+private:
+    /// Get the ID of the render pass description. Returns false, if the render pass is not known to the registry.
+    bool renderPassId(vk::RenderPass pass, uint64_t & id) const {
+        id = 0;
+        if (!pass) return true;
+        auto lock = std::lock_guard {_mutex};
+        auto iter = _passes.find((VkRenderPass) pass);
+        if (iter == _passes.end()) return false;
+        id = iter->second;
+        return true;
+    }
+
+    bool sign(rv_details::Signature & sig, const GraphicsPipeline::ConstructParameters & cp) const {
+        uint64_t pass;
+        return renderPassId(cp.pass, pass) && signPipeline(sig, cp, pass);
+    }
+
+    bool sign(rv_details::Signature & sig, const ComputePipeline::ConstructParameters & cp) const { return signPipeline(sig, cp); }
+
+    template<typename T>
+    Map<T> & pipelines() {
+        if constexpr (std::is_same_v<T, GraphicsPipeline>)
+            return _graphics;
+        else
+            return _compute;
+    }
+
+    /// Look up the object in the map. Create a new one if not found. The creation is done outside of the lock, so that
+    /// slow pipeline compilation on one thread does not block others.
+    template<typename T, typename CREATE>
+    Ref<T> find(Map<T> & map, rv_details::Signature && sig, uint64_t & hits, uint64_t & misses, CREATE create) {
+        {
+            auto lock = std::lock_guard {_mutex};
+            auto iter = map.find(sig);
+            if (iter != map.end()) {
+                ++hits;
+                return iter->second;
+            }
+        }
+        auto p    = create();
+        auto lock = std::lock_guard {_mutex};
+        auto iter = map.try_emplace(std::move(sig), p);
+        if (iter.second)
+            ++misses;
+        else
+            ++hits; // Another thread has created the same object in the mean time. Use that one.
+        return iter.first->second;
+    }
+
+    template<typename T>
+    static size_t purge(Map<T> & map) {
+        size_t count = 0;
+        for (auto iter = map.begin(); iter != map.end();) {
+            if (1 == iter->second->refCount()) {
+                iter = map.erase(iter);
+                ++count;
+            } else {
+                ++iter;
+            }
+        }
+        return count;
+    }
+};
+
+PipelineRegistry::PipelineRegistry(const ConstructParameters & cp): Root(cp) { _impl = new Impl(cp); }
+PipelineRegistry::~PipelineRegistry() {
+    delete _impl;
+    _impl = nullptr;
+}
+auto PipelineRegistry::graphics(const GraphicsPipeline::ConstructParameters & cp) -> Ref<GraphicsPipeline> { return _impl->pipeline<GraphicsPipeline>(cp); }
+auto PipelineRegistry::compute(const ComputePipeline::ConstructParameters & cp) -> Ref<ComputePipeline> { return _impl->pipeline<ComputePipeline>(cp); }
+void PipelineRegistry::addRenderPass(vk::RenderPass pass, const vk::RenderPassCreateInfo & ci) { _impl->addRenderPass(pass, ci); }
+void PipelineRegistry::removeRenderPass(vk::RenderPass pass) { _impl->removeRenderPass(pass); }
+auto PipelineRegistry::stats() const -> Stats { return _impl->stats(); }
+size_t PipelineRegistry::purge() { return _impl->purge(); }
+
 // *********************************************************************************************************************
 // Pipeline
 // *********************************************************************************************************************
@@ -1563,37 +2561,103 @@ void PipelineLayout::onNameChanged(const std::string &) { _impl->onNameChanged()
 class Pipeline::Impl {
 public:
     Impl(Pipeline & owner, vk::PipelineBindPoint bindPoint, vk::ArrayProxy<const Shader * const> shaders): _bindPoint(bindPoint) {
-        _layout.reset(new PipelineLayout({{owner.name()}, shaders}));
+        // share the pipeline layout with other pipelines using the same shaders, if there's a registry.
+        auto gi = (!shaders.empty() && shaders.front()) ? shaders.front()->gi() : nullptr;
+        if (auto registry = gi ? gi->pipelineRegistry : nullptr)
+            _layout = registry->_impl->layout(owner.name(), shaders);
+        else
+            _layout.reset(new PipelineLayout({{owner.name()}, shaders}));
     }
 
     ~Impl() {
-        if (_handle) {
-            RVI_ASSERT(_layout);
-            _layout->gi().safeDestroy(_handle);
+        if (_async) {
+            // Detach from the pending async creation. The worker thread will destroy the pipeline once it is created.
+            auto lock      = std::lock_guard {_async->mutex};
+            _async->owner = nullptr;
         }
+        auto handle = vk::Pipeline(_handle.load());
+        for (auto h : _retired) _layout->gi().safeDestroy(h);
+        _layout->gi().safeDestroy(handle);
     }
 
     vk::PipelineBindPoint bindPoint() const { return _bindPoint; }
 
-    vk::Pipeline handle() const { return _handle; }
+    vk::Pipeline handle() const { return vk::Pipeline(_handle.load(std::memory_order_acquire)); }
 
     PipelineLayout & layout() const { return *_layout; }
 
+    bool isReady() const { return (bool) handle(); }
+
+    bool wait() const {
+        if (_async) {
+            auto lock = std::unique_lock {_async->mutex};
+            _async->signal.wait(lock, [&] { return _async->done; });
+        }
+        return isReady();
+    }
+
+    const Pipeline * fallback() const { return _fallback.get(); }
+
+    void setFallback(Ref<const Pipeline> fallback) { _fallback = std::move(fallback); }
+
+    /// Set or replace the pipeline handle. Null handle is ignored, which keeps the current one, if any. Replaced handles
+    /// are kept alive until the pipeline is deleted, since they could still be referenced by pending command buffers.
     void setHandle(vk::Pipeline newHandle, const std::string & newName) {
-        const auto & gi = _layout->gi();
-        gi.safeDestroy(_handle); // destroy old handle
-        _handle = newHandle;     // store new handle
-        if (newHandle) setName(newName);
+        if (!newHandle) return;
+        setVkHandleName(_layout->gi().device, newHandle, newName);
+        auto old = vk::Pipeline(_handle.exchange((VkPipeline) newHandle, std::memory_order_acq_rel));
+        if (old) _retired.push_back(old);
     }
 
     void setName(const std::string & name) {
-        if (_handle) setVkHandleName(_layout->gi().device, _handle, name);
+        if (auto h = handle()) setVkHandleName(_layout->gi().device, h, name);
+    }
+
+    /// Keep the pipeline libraries alive, as long as the pipeline linked from them is alive.
+    void setLibraries(std::vector<Ref<PipelineLibrary>> libraries) { _libraries = std::move(libraries); }
+
+    /// Create the pipeline on the worker threads of the pipeline cache. The states object keeps everything referenced by
+    /// the create info alive, until the pipeline is created.
+    template<typename CREATE_INFO>
+    void createAsync(const CREATE_INFO & ci, std::shared_ptr<const void> states, const std::string & name) {
+        const auto & gi = _layout->gi();
+        if (!gi.pipelineCache) {
+            setHandle(createPipeline(gi, ci), name);
+            return;
+        }
+        _async        = std::make_shared<AsyncState>();
+        _async->owner = this;
+        auto callback = [async = _async, keepAlive = std::move(states), device = &gi, name](vk::Pipeline p) {
+            auto lock = std::lock_guard {async->mutex};
+            if (async->owner)
+                async->owner->setHandle(p, name);
+            else
+                device->safeDestroy(p); // the pipeline object is already deleted.
+            async->done = true;
+            async->signal.notify_all();
+        };
+        if constexpr (std::is_same_v<CREATE_INFO, vk::GraphicsPipelineCreateInfo>)
+            gi.pipelineCache->createGraphicsPipelineAsync(ci, std::move(callback));
+        else
+            gi.pipelineCache->createComputePipelineAsync(ci, std::move(callback));
     }
 
 private:
-    vk::PipelineBindPoint _bindPoint;
-    Ref<PipelineLayout>   _layout;
-    vk::Pipeline          _handle;
+    /// State shared between the pipeline and the worker thread that is creating it.
+    struct AsyncState {
+        std::mutex              mutex;
+        std::condition_variable signal;
+        Impl *                  owner = nullptr; ///< null, if the pipeline object is deleted before the creation is done.
+        bool                    done  = false;
+    };
+
+    vk::PipelineBindPoint             _bindPoint;
+    Ref<PipelineLayout>               _layout;
+    std::atomic<VkPipeline>           _handle {};
+    std::vector<vk::Pipeline>         _retired; ///< replaced handles.
+    std::vector<Ref<PipelineLibrary>> _libraries;
+    std::shared_ptr<AsyncState>       _async;
+    Ref<const Pipeline>               _fallback;
 };
 
 Pipeline::Pipeline(const std::string & name, vk::PipelineBindPoint bindPoint, vk::ArrayProxy<const Shader * const> shaders): Root({name}) {
@@ -1606,22 +2670,194 @@ Pipeline::~Pipeline() {
 auto Pipeline::bindPoint() const -> vk::PipelineBindPoint { return _impl->bindPoint(); }
 auto Pipeline::handle() const -> vk::Pipeline { return _impl->handle(); }
 auto Pipeline::layout() const -> vk::PipelineLayout { return _impl->layout().handle(); }
+bool Pipeline::isReady() const { return _impl->isReady(); }
+bool Pipeline::wait() const { return _impl->wait(); }
+auto Pipeline::fallback() const -> const Pipeline * { return _impl->fallback(); }
 auto Pipeline::reflection() const -> const PipelineReflection & { return _impl->layout().reflection(); }
+auto Pipeline::descriptorUpdateTemplate(uint32_t set) const -> vk::DescriptorUpdateTemplate { return _impl->layout().descriptorUpdateTemplate(set); }
 void Pipeline::onNameChanged(const std::string &) { return _impl->setName(name()); }
 
 // *********************************************************************************************************************
 // Graphics Pipeline
 // *********************************************************************************************************************
 
+/// Specialization constants of one shader stage, packed into the layout of VkSpecializationInfo.
+struct PackedSpecialization {
+    RVI_NO_COPY_NO_MOVE(PackedSpecialization);
+
+    std::vector<vk::SpecializationMapEntry> entries;
+    std::vector<uint8_t>                    data;
+    vk::SpecializationInfo                  info;
+
+    PackedSpecialization() = default;
+
+    /// Pack the constants. Names are resolved to constant IDs via reflection. Returns null, if there's no constant.
+    const vk::SpecializationInfo * pack(const SpecializationConstants & sc, const PipelineReflection & refl, vk::ShaderStageFlagBits stage,
+                                        const std::string & pipelineName) {
+        auto values = resolveSpecialization(sc, &refl, stage, &pipelineName);
+        if (values.empty()) return nullptr;
+        for (const auto & [id, v] : values) {
+            entries.push_back({id, (uint32_t) data.size(), v.size});
+            auto p = (const uint8_t *) &v.bits; // assume little endian.
+            data.insert(data.end(), p, p + v.size);
+        }
+        info.setMapEntries(entries);
+        info.dataSize = data.size();
+        info.pData    = data.data();
+        return &info;
+    }
+};
+
+/// States in GraphicsPipeline::DynamicStates.
+static constexpr vk::DynamicState EXTENDED_DYNAMIC_STATES[] = {
+    vk::DynamicState::eCullMode,        vk::DynamicState::eFrontFace,      vk::DynamicState::ePrimitiveTopology,    vk::DynamicState::eDepthTestEnable,
+    vk::DynamicState::eDepthWriteEnable, vk::DynamicState::eDepthCompareOp, vk::DynamicState::eDepthBoundsTestEnable, vk::DynamicState::eStencilTestEnable,
+};
+
+/// Everything referenced by the graphics pipeline create info. Async pipelines keep it alive until the pipeline is
+/// created. They also make private copies of the shader modules, since the shaders could be deleted in the mean time.
+/// Shaders that don't keep their SPIR-V code are used as is.
+struct GraphicsPipelineStates {
+    RVI_NO_COPY_NO_MOVE(GraphicsPipelineStates);
+
+    const GlobalInfo *                             gi;
+    GraphicsPipeline::ConstructParameters          params;
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    std::vector<std::string>                       entries;
+    std::vector<vk::ShaderModule>                  modules; ///< private copies of the shader modules.
+    PackedSpecialization                           specializations[2];
+    vk::PipelineVertexInputStateCreateInfo         vertex;
+    vk::PipelineViewportStateCreateInfo            viewport;
+    std::vector<vk::DynamicState>                  dynamicStates;
+    vk::PipelineDynamicStateCreateInfo             dynamic;
+    vk::PipelineColorBlendStateCreateInfo          blend;
+    vk::GraphicsPipelineCreateInfo                 ci;
+
+    GraphicsPipelineStates(const GraphicsPipeline::ConstructParameters & p, const PipelineLayout & layout, bool copyShaders)
+        : gi(p.vs->gi()), params(p) {
+        // create shader stage array
+        entries.reserve(2); // so the entry strings won't be reallocated.
+        auto addStage = [&](vk::ShaderStageFlagBits stage, const Shader * s) {
+            auto module = s->handle();
+            auto spirv  = s->spirv();
+            if (copyShaders && !spirv.empty()) {
+                module     = gi->device.createShaderModule({{}, spirv.size() * sizeof(uint32_t), spirv.data()}, gi->allocator);
+                modules.push_back(module);
+            }
+            entries.push_back(s->entry());
+            auto sc   = params.specializations.find(stage);
+            auto spec = sc == params.specializations.end() ? nullptr
+                                                           : specializations[stages.size()].pack(sc->second, layout.reflection(), stage, params.name);
+            stages.push_back({{}, stage, module, entries.back().c_str(), spec});
+        };
+        addStage(vk::ShaderStageFlagBits::eVertex, params.vs);
+        if (params.fs) addStage(vk::ShaderStageFlagBits::eFragment, params.fs);
+        for (const auto & [stage, sc] : params.specializations) {
+            if (vk::ShaderStageFlagBits::eVertex == stage || (vk::ShaderStageFlagBits::eFragment == stage && params.fs)) continue;
+            RVI_LOGW("Pipeline %s: specialization constants of shader stage %s are ignored, since the pipeline has no such stage.", params.name.c_str(),
+                     vk::to_string(stage).c_str());
+        }
+
+        // setup vertex input stage
+        vertex.setVertexAttributeDescriptions(params.va).setVertexBindingDescriptions(params.vb);
+
+        // setup viewport and scissor states.
+        viewport.setViewports(params.viewports);
+        viewport.setScissors(params.scissors);
+
+        // setup dynamic states
+        for (const auto & [s, v] : params.dynamic) {
+            dynamicStates.push_back(s);
+            switch (s) {
+            case vk::DynamicState::eViewport:
+                viewport.setViewportCount((uint32_t) v);
+                viewport.setPViewports(nullptr);
+                break;
+            case vk::DynamicState::eViewportWithCount:
+                viewport.setViewports({});
+                break;
+            case vk::DynamicState::eScissor:
+                viewport.setScissorCount((uint32_t) v);
+                viewport.setPScissors(nullptr);
+                break;
+            case vk::DynamicState::eScissorWithCount:
+                viewport.setScissors({});
+                break;
+            default:
+                // do nothing
+                break;
+            }
+        }
+        if (params.extendedDynamicState && gi->extendedDynamicState) {
+            for (auto s : EXTENDED_DYNAMIC_STATES)
+                if (!params.dynamic.count(s)) dynamicStates.push_back(s);
+        }
+        dynamic.setDynamicStates(dynamicStates);
+
+        // setup blend stage
+        blend.setAttachments(params.attachments);
+        blend.blendConstants = params.blendConstants;
+
+        // setup the create info
+        ci = vk::GraphicsPipelineCreateInfo({}, (uint32_t) stages.size(), stages.data(), &vertex, &params.ia, &params.tess, &viewport, &params.rast,
+                                            &params.msaa, &params.depth, &blend, &dynamic, layout.handle(), params.pass, params.subpass, params.baseHandle,
+                                            params.baseIndex);
+    }
+
+    ~GraphicsPipelineStates() {
+        for (auto & m : modules) gi->safeDestroy(m);
+    }
+};
+
+PipelineLibrary::PipelineLibrary(const GraphicsPipelineStates & states, uint32_t subset, Ref<PipelineLayout> layout)
+    : Root({format("%s (library 0x%x)", states.params.name.c_str(), subset)}), _gi(states.gi), _layout(std::move(layout)) {
+    RVI_ASSERT(_layout && _layout->handle() == states.ci.layout);
+#ifdef VK_EXT_graphics_pipeline_library
+    // Keep only the shader stages of the subset. Other states that don't belong to the subset are ignored by the driver.
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    for (const auto & s : states.stages) {
+        auto subsetOfStage = (s.stage == vk::ShaderStageFlagBits::eFragment) ? FRAGMENT_SHADER_STATES : PRE_RASTERIZATION_STATES;
+        if (subset & subsetOfStage) stages.push_back(s);
+    }
+    auto lib = vk::GraphicsPipelineLibraryCreateInfoEXT(vk::GraphicsPipelineLibraryFlagsEXT(subset));
+    auto ci  = states.ci;
+    ci.setPNext(&lib).setFlags(vk::PipelineCreateFlagBits::eLibraryKHR).setStages(stages);
+    ci.setBasePipelineHandle({}).setBasePipelineIndex(-1);
+    _handle = createPipeline(*_gi, ci);
+    if (_handle) setVkHandleName(_gi->device, _handle, name());
+#else
+    (void) subset;
+#endif
+}
+
+auto PipelineRegistry::Impl::library(const GraphicsPipelineStates & states, uint32_t subset, Ref<PipelineLayout> layout) -> Ref<PipelineLibrary> {
+    // Libraries are compiled against the pipeline layout. So the layout is part of the signature. The handle is unique, since the
+    // library holds a reference to the layout. So the layout can't be destroyed, and its handle reused, while the library is cached.
+    rv_details::Signature sig;
+    sig.push_back((uint64_t) (VkPipelineLayout) layout->handle());
+    uint64_t pass;
+    if (!renderPassId(states.params.pass, pass) || !signGraphicsStates(sig, states.params, subset, pass))
+        return Ref<PipelineLibrary>::make(states, subset, std::move(layout));
+    return find(_libraries, std::move(sig), _stats.libraryHits, _stats.libraryMisses, [&] { return Ref<PipelineLibrary>::make(states, subset, layout); });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Fast-link the libraries of all state subsets into a complete pipeline. Returns null, if any of the library is null.
+static vk::Pipeline linkPipeline(const GraphicsPipelineStates & states, const std::vector<Ref<PipelineLibrary>> & libraries) {
+    std::vector<vk::Pipeline> handles;
+    for (const auto & l : libraries) {
+        if (!l->handle()) return {};
+        handles.push_back(l->handle());
+    }
+    auto info = vk::PipelineLibraryCreateInfoKHR(handles);
+    auto ci   = vk::GraphicsPipelineCreateInfo().setPNext(&info).setLayout(states.ci.layout);
+    return createPipeline(*states.gi, ci);
+}
+
 GraphicsPipeline::GraphicsPipeline(const ConstructParameters & params): Pipeline(params.name, vk::PipelineBindPoint::eGraphics, {params.vs, params.fs}) {
-    // create shader stage array
     RVI_REQUIRE(params.vs, "Vertex shader is required for graphics pipeline.");
-    auto gi           = params.vs->gi();
-    auto shaderStages = std::vector<vk::PipelineShaderStageCreateInfo>();
-    shaderStages.push_back({{}, vk::ShaderStageFlagBits::eVertex, params.vs->handle(), params.vs->entry().c_str()});
-    if (params.fs) shaderStages.push_back({{}, vk::ShaderStageFlagBits::eFragment, params.fs->handle(), params.fs->entry().c_str()});
 
-    // setup vertex input stage
+    // validate vertex input stage
     const auto & refl = _impl->layout().reflection();
     if (refl.vertex.size() != params.va.size()) {
         RVI_LOGE("Failed to create graphics pipeline (%s): vertex input stage requires %zu attributes, but only %zu are provided.", params.name.c_str(),
@@ -1644,55 +2880,60 @@ GraphicsPipeline::GraphicsPipeline(const ConstructParameters & params): Pipeline
             return;
         }
     }
-    auto vertex = vk::PipelineVertexInputStateCreateInfo().setVertexAttributeDescriptions(params.va).setVertexBindingDescriptions(params.vb);
 
-    // setup viewport and scissor states.
-    auto viewport = vk::PipelineViewportStateCreateInfo();
-    viewport.setViewports(params.viewports);
-    viewport.setScissors(params.scissors);
+    // Record default values of the dynamic states.
+    const auto & gi = *params.vs->gi();
+    _dynamic        = params.extendedDynamicState && gi.extendedDynamicState;
+    _defaultStates.setCullMode(params.rast.cullMode).setFrontFace(params.rast.frontFace).setTopology(params.ia.topology);
+    _defaultStates.setDepth(params.depth.depthTestEnable, params.depth.depthWriteEnable, params.depth.depthCompareOp);
+    _defaultStates.setDepthBoundsTest(params.depth.depthBoundsTestEnable).setStencilTest(params.depth.stencilTestEnable);
 
-    // setup dynamic states
-    std::vector<vk::DynamicState> dynamicStates;
-    for (const auto & [s, v] : params.dynamic) {
-        dynamicStates.push_back(s);
-        switch (s) {
-        case vk::DynamicState::eViewport:
-            viewport.setViewportCount((uint32_t) v);
-            viewport.setPViewports(nullptr);
-            break;
-        case vk::DynamicState::eViewportWithCount:
-            viewport.setViewports({});
-            break;
-        case vk::DynamicState::eScissor:
-            viewport.setScissorCount((uint32_t) v);
-            viewport.setPScissors(nullptr);
-            break;
-        case vk::DynamicState::eScissorWithCount:
-            viewport.setScissors({});
-            break;
-        default:
-            // do nothing
-            break;
+    // create the pipeline.
+    _impl->setFallback(params.fallback);
+    if (params.fastLink && gi.graphicsPipelineLibrary && gi.pipelineRegistry) {
+        // Link the pipeline from shared libraries of each state subset. Only subsets that are not seen before are compiled.
+        std::vector<Ref<PipelineLibrary>> libraries;
+        {
+            auto states = GraphicsPipelineStates(params, _impl->layout(), false);
+            for (uint32_t subset = VERTEX_INPUT_STATES; subset <= FRAGMENT_OUTPUT_STATES; subset <<= 1)
+                libraries.push_back(gi.pipelineRegistry->_impl->library(states, subset, Ref<PipelineLayout>(&_impl->layout())));
+            _impl->setHandle(linkPipeline(states, libraries), name());
+        }
+        if (_impl->isReady()) {
+            _impl->setLibraries(std::move(libraries));
+            // Compile the fully optimized version in background. It replaces the linked one once ready.
+            if (params.optimize && gi.pipelineCache) {
+                auto states = std::make_shared<GraphicsPipelineStates>(params, _impl->layout(), true);
+                _impl->createAsync(states->ci, states, name());
+            }
+            return;
         }
+        RVI_LOGW("Failed to fast-link graphics pipeline (%s). Fall back to regular compilation.", params.name.c_str());
     }
-    vk::PipelineDynamicStateCreateInfo dynamicCI({}, dynamicStates);
-
-    // setup blend stage
-    auto blend           = vk::PipelineColorBlendStateCreateInfo {}.setAttachments(params.attachments);
-    blend.blendConstants = params.blendConstants;
-
-    // setup the create info
-    auto ci = vk::GraphicsPipelineCreateInfo({}, (uint32_t) shaderStages.size(), shaderStages.data(), &vertex, &params.ia, &params.tess, &viewport,
-                                             &params.rast, &params.msaa, &params.depth, &blend, &dynamicCI, _impl->layout().handle(), params.pass,
-                                             params.subpass, params.baseHandle, params.baseIndex);
+    if (params.async) {
+        auto states = std::make_shared<GraphicsPipelineStates>(params, _impl->layout(), true);
+        _impl->createAsync(states->ci, states, name());
+    } else {
+        auto states = GraphicsPipelineStates(params, _impl->layout(), false);
+        _impl->setHandle(createPipeline(*states.gi, states.ci), name());
+    }
+}
 
-    // create the shader.
-    _impl->setHandle(gi->device.createGraphicsPipeline(nullptr, ci, gi->allocator).value, name());
+void GraphicsPipeline::DynamicStates::cmdSet(vk::CommandBuffer cb) const {
+    cb.setCullMode(cullMode);
+    cb.setFrontFace(frontFace);
+    cb.setPrimitiveTopology(topology);
+    cb.setDepthTestEnable(depthTestEnable);
+    cb.setDepthWriteEnable(depthWriteEnable);
+    cb.setDepthCompareOp(depthCompareOp);
+    cb.setDepthBoundsTestEnable(depthBoundsTestEnable);
+    cb.setStencilTestEnable(stencilTestEnable);
 }
 
 void GraphicsPipeline::cmdDraw(vk::CommandBuffer cb, const DrawParameters & dp) const {
     if (!_impl->handle()) return;
     cb.bindPipeline(vk::PipelineBindPoint::eGraphics, _impl->handle());
+    if (_dynamic) _defaultStates.cmdSet(cb);
     if (dp.indexCount) {
         // indexed draw
         cb.drawIndexed(dp.indexCount, dp.instanceCount, dp.firstIndex, dp.vertexOffset, dp.firstInstance);
@@ -1702,27 +2943,71 @@ void GraphicsPipeline::cmdDraw(vk::CommandBuffer cb, const DrawParameters & dp)
     }
 }
 
+void GraphicsPipeline::cmdDraw(const CommandBuffer & cb, const DrawParameters & dp) const {
+    cb.invalidateState();
+    cmdDraw(cb.handle(), dp);
+}
+
 // *********************************************************************************************************************
 // Compute Pipeline
 // *********************************************************************************************************************
 
-ComputePipeline::ComputePipeline(const ConstructParameters & params): Pipeline(params.name, vk::PipelineBindPoint::eCompute, {params.cs}) {
+/// Everything referenced by the compute pipeline create info. See GraphicsPipelineStates for details.
+struct ComputePipelineStates {
+    RVI_NO_COPY_NO_MOVE(ComputePipelineStates);
+
+    const GlobalInfo *            gi;
+    std::string                   entry;
+    vk::ShaderModule              module {}; ///< private copy of the shader module.
+    PackedSpecialization          specialization;
     vk::ComputePipelineCreateInfo ci;
-    ci.setStage({{}, vk::ShaderStageFlagBits::eCompute, params.cs->handle(), params.cs->entry().c_str()});
-    ci.setLayout(_impl->layout().handle());
-    auto gi = params.cs->gi();
-    _impl->setHandle(gi->device.createComputePipeline(nullptr, ci, gi->allocator).value, name());
+
+    ComputePipelineStates(const ComputePipeline::ConstructParameters & p, const PipelineLayout & layout, bool copyShader)
+        : gi(p.cs->gi()), entry(p.cs->entry()) {
+        auto spirv = p.cs->spirv();
+        if (copyShader && !spirv.empty()) module = gi->device.createShaderModule({{}, spirv.size() * sizeof(uint32_t), spirv.data()}, gi->allocator);
+        auto spec = specialization.pack(p.specialization, layout.reflection(), vk::ShaderStageFlagBits::eCompute, p.name);
+        ci.setStage({{}, vk::ShaderStageFlagBits::eCompute, module ? module : p.cs->handle(), entry.c_str(), spec});
+        ci.setLayout(layout.handle());
+    }
+
+    ~ComputePipelineStates() { gi->safeDestroy(module); }
+};
+
+ComputePipeline::ComputePipeline(const ConstructParameters & params): Pipeline(params.name, vk::PipelineBindPoint::eCompute, {params.cs}) {
+    _impl->setFallback(params.fallback);
+    if (params.async) {
+        auto states = std::make_shared<ComputePipelineStates>(params, _impl->layout(), true);
+        _impl->createAsync(states->ci, states, name());
+    } else {
+        auto states = ComputePipelineStates(params, _impl->layout(), false);
+        _impl->setHandle(createPipeline(*states.gi, states.ci), name());
+    }
 }
 
 void ComputePipeline::cmdDispatch(vk::CommandBuffer cb, const DispatchParameters & dp) const {
+    if (!_impl->handle()) return;
     cb.bindPipeline(vk::PipelineBindPoint::eCompute, _impl->handle());
     cb.dispatch((uint32_t) dp.width, (uint32_t) dp.height, (uint32_t) dp.depth);
 }
 
+void ComputePipeline::cmdDispatch(const CommandBuffer & cb, const DispatchParameters & dp) const {
+    cb.invalidateState();
+    cmdDispatch(cb.handle(), dp);
+}
+
 // *********************************************************************************************************************
 // Drawable & DrawPack
 // *********************************************************************************************************************
 
+static inline bool sameConstants(const std::vector<DrawPack::ConstantArgument> & a, const std::vector<DrawPack::ConstantArgument> & b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].stages != b[i].stages || a[i].offset != b[i].offset || a[i].value != b[i].value) return false;
+    }
+    return true;
+}
+
 static inline bool sameDescriptorSet(const std::vector<vk::WriteDescriptorSet> & a, const std::vector<vk::WriteDescriptorSet> & b) {
     if (a.size() != b.size()) return false;
     for (uint32_t i = 0; i < a.size(); ++i) {
@@ -1766,46 +3051,107 @@ static inline bool sameDescriptorSet(const std::vector<vk::WriteDescriptorSet> &
     return true;
 }
 
-void DrawPack::cmdRender(vk::CommandBuffer cb, const RenderParameters & rp) const {
-    if (!pipeline) return;
+// Draw packs are compiled and released at high frequency. So they are allocated out of a dedicated pool. The pool is
+// never destroyed, since draw packs could be released during static destruction.
+static rv_details::BlockPool & drawPackPool() {
+    static auto pool = new rv_details::BlockPool(sizeof(DrawPack), 256);
+    return *pool;
+}
+
+void * DrawPack::operator new(size_t size) {
+    // Classes derived from DrawPack don't fit into the pool blocks.
+    if (size > drawPackPool().blockSize()) return ::operator new(size);
+    return drawPackPool().allocate();
+}
+
+void DrawPack::operator delete(void * p, size_t size) {
+    if (size > drawPackPool().blockSize())
+        ::operator delete(p);
+    else
+        drawPackPool().deallocate(p);
+}
+
+bool DrawPack::cmdRender(vk::CommandBuffer cb, const RenderParameters & rp) const {
+    if (!pipeline) return false;
+
+    // Substitute the fallback pipeline, while the pipeline is still being compiled. Skip the draw, if there's none.
+    auto handle = pipeline->handle();
+    if (!handle && pipeline->fallback()) handle = pipeline->fallback()->handle();
+    if (!handle) return false;
 
     auto layout = pipeline->layout();
     auto bp     = pipeline->bindPoint();
 
-    cb.bindPipeline(bp, pipeline->handle());
+    // The previous draw pack is only useful, if it left its states in the same bind point and pipeline layout.
+    auto prev = (rp.previous && rp.previous->pipeline->bindPoint() == bp && rp.previous->pipeline->layout() == layout) ? rp.previous : nullptr;
+
+    if (!rp.boundPipeline || *rp.boundPipeline != handle) {
+        cb.bindPipeline(bp, handle);
+        if (rp.boundPipeline) *rp.boundPipeline = handle;
+    }
+
+    // Dynamic states survive pipeline binds, as long as the previous pipeline has them dynamic too.
+    if (hasDynamicStates && (!prev || !prev->hasDynamicStates || prev->dynamicStates != dynamicStates)) dynamicStates.cmdSet(cb);
 
     for (uint32_t s = 0; s < descriptors.size(); ++s) {
         auto & w = descriptors[s];
         if (w.empty()) continue;
 
         // check if the descriptor set is changed or not.
-        if (rp.previous && s < rp.previous->descriptors.size() && sameDescriptorSet(rp.previous->descriptors[s], w)) continue;
-
-        auto set = rp.descriptorSetAllocator(*pipeline, s);
-        for (auto & d : w) const_cast<vk::WriteDescriptorSet &>(d).dstSet = set;
-        rp.device.updateDescriptorSets(w, {});
+        if (prev && s < prev->descriptors.size() && sameDescriptorSet(prev->descriptors[s], w)) continue;
+
+        // Look for a cached set with the same content first. It is ready to use without being updated.
+        auto set = rp.descriptorSetLookup ? rp.descriptorSetLookup(*pipeline, s, w) : vk::DescriptorSet {};
+        if (!set) {
+            set = rp.descriptorSetAllocator(*pipeline, s);
+            auto t = pipeline->descriptorUpdateTemplate(s);
+            if (t && descriptorBlock && s < descriptorOffsets.size()) {
+                // Update the whole set with one call, out of the packed descriptor info block.
+                rp.device.updateDescriptorSetWithTemplate(set, t, descriptorBlock->data() + descriptorOffsets[s]);
+            } else {
+                for (auto & d : w) const_cast<vk::WriteDescriptorSet &>(d).dstSet = set;
+                rp.device.updateDescriptorSets(w, {});
+            }
+        }
         cb.bindDescriptorSets(bp, layout, s, 1, &set, 0, nullptr);
     }
 
-    for (const auto & c : constants) cb.pushConstants(layout, c.stages, c.offset, (uint32_t) c.value.size(), c.value.data());
+    // Push constants stay valid across draws with the same pipeline layout.
+    if (!prev || !sameConstants(prev->constants, constants)) {
+        for (const auto & c : constants) cb.pushConstants(layout, c.stages, c.offset, (uint32_t) c.value.size(), c.value.data());
+    }
 
     if (vk::PipelineBindPoint::eGraphics == bp) {
-        if (!vertexBuffers.empty()) {
+        // Vertex and index buffer bindings are independent of the pipeline. So they are compared to the previous pack regardless of its layout.
+        auto pg = (rp.previous && rp.previous->pipeline->bindPoint() == bp) ? rp.previous : nullptr;
+        if (!vertexBuffers.empty() && !(pg && pg->vertexBuffers == vertexBuffers && pg->vertexOffsets == vertexOffsets)) {
             RVI_ASSERT(vertexBuffers.size() == vertexOffsets.size());
-            std::vector<vk::Buffer> handles(vertexBuffers.size());
-            std::transform(vertexBuffers.begin(), vertexBuffers.end(), handles.begin(), [](const auto & v) { return v->handle(); });
-            cb.bindVertexBuffers(0, (uint32_t) vertexBuffers.size(), handles.data(), vertexOffsets.data());
+            // Bind in batches out of a stack array, to avoid heap allocation on every draw.
+            constexpr size_t BATCH = 16;
+            vk::Buffer       handles[BATCH];
+            for (size_t first = 0; first < vertexBuffers.size(); first += BATCH) {
+                auto count = std::min(BATCH, vertexBuffers.size() - first);
+                for (size_t i = 0; i < count; ++i) handles[i] = vertexBuffers[first + i]->handle();
+                cb.bindVertexBuffers((uint32_t) first, (uint32_t) count, handles, vertexOffsets.data() + first);
+            }
         }
 
         if (indexBuffer) {
             // indexed draw
             auto ib = indexBuffer->handle();
             if (ib) {
-                cb.bindIndexBuffer(ib, indexOffset, indexType);
-                cb.drawIndexed(draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+                if (!(pg && pg->indexBuffer == indexBuffer && pg->indexOffset == indexOffset && pg->indexType == indexType))
+                    cb.bindIndexBuffer(ib, indexOffset, indexType);
+                if (rp.indirectBuffer)
+                    cb.drawIndexedIndirect(rp.indirectBuffer, rp.indirectOffset, rp.indirectCount, sizeof(vk::DrawIndexedIndirectCommand));
+                else
+                    cb.drawIndexed(draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
             } else {
                 RVI_LOGW("DrawPack %s has an invalid/empty index buffer.", name().c_str());
             }
+        } else if (rp.indirectBuffer) {
+            // non-indexed indirect draw
+            cb.drawIndirect(rp.indirectBuffer, rp.indirectOffset, rp.indirectCount, sizeof(vk::DrawIndirectCommand));
         } else {
             // non-indexed draw
             cb.draw(draw.vertexCount, draw.instanceCount, draw.firstVertex, draw.firstInstance);
@@ -1815,6 +3161,20 @@ void DrawPack::cmdRender(vk::CommandBuffer cb, const RenderParameters & rp) cons
     } else {
         RVI_THROW("Invalid pipeline bind point");
     }
+    return true;
+}
+
+bool DrawPack::mergeable(const DrawPack & rhs) const {
+    if (!pipeline || pipeline != rhs.pipeline || vk::PipelineBindPoint::eGraphics != pipeline->bindPoint()) return false;
+    if (indexBuffer != rhs.indexBuffer || (indexBuffer && (indexOffset != rhs.indexOffset || indexType != rhs.indexType))) return false;
+    if (vertexBuffers != rhs.vertexBuffers || vertexOffsets != rhs.vertexOffsets) return false;
+    if (hasDynamicStates != rhs.hasDynamicStates || (hasDynamicStates && dynamicStates != rhs.dynamicStates)) return false;
+    if (!sameConstants(constants, rhs.constants)) return false;
+    if (descriptors.size() != rhs.descriptors.size()) return false;
+    for (size_t s = 0; s < descriptors.size(); ++s) {
+        if (!sameDescriptorSet(descriptors[s], rhs.descriptors[s])) return false;
+    }
+    return true;
 }
 
 /// Represent a single pipeline descriptor (buffer/image/sampler)
@@ -2030,6 +3390,19 @@ public:
     void reset() {
         _descriptors.clear();
         _constants.clear();
+        if (_pipeline) {
+            // One block for each shader stage that has push constants. The blocks never grow after this point.
+            for (const auto & [stage, range] : _pipeline->reflection().constants) {
+                if (range.empty()) continue;
+                auto & b = _constants.emplace_back();
+                b.stage  = stage;
+                b.begin  = range.begin;
+                b.data.resize(range.end - range.begin);
+            }
+        }
+        auto gp        = dynamic_cast<const GraphicsPipeline *>(_pipeline.get());
+        auto defaults  = gp ? gp->dynamicStates() : nullptr;
+        _dynamicStates = defaults ? *defaults : GraphicsPipeline::DynamicStates {};
         _cachedPack.reset();
         _dirty.setAll();
     }
@@ -2046,9 +3419,21 @@ public:
 
     void set(size_t offset, size_t size, const void * data, vk::ShaderStageFlags stages) {
         if (0 == data || 0 == size || !stages) return; // ignore empty data.
-        _constants.push_back({stages, (uint32_t) offset});
-        _constants.back().value.assign((const uint8_t *) data, (const uint8_t *) data + size);
-        _dirty.constants = true;
+        for (auto & b : _constants) {
+            if (!(stages & b.stage)) continue;
+            // Bytes that are out of the range used by the stage are ignored.
+            auto first = std::max((size_t) b.begin, offset);
+            auto last  = std::min(b.begin + b.data.size(), offset + size);
+            if (first >= last) continue;
+            auto dst = b.data.data() + (first - b.begin);
+            auto src = (const uint8_t *) data + (first - offset);
+            if (b.written && 0 == memcmp(dst, src, last - first)) continue; // value is not changed.
+            memcpy(dst, src, last - first);
+            b.written        = true;
+            b.dirtyBegin     = std::min(b.dirtyBegin, (uint32_t) (first - b.begin));
+            b.dirtyEnd       = std::max(b.dirtyEnd, (uint32_t) (last - b.begin));
+            _dirty.constants = true;
+        }
     }
 
     void set(const vk::ArrayProxy<const BufferView> & vertexBuffers) {
@@ -2077,6 +3462,15 @@ public:
         _dirty.graphicsOrDispatch = true;
     }
 
+    void set(const GraphicsPipeline::DynamicStates & ds) {
+        if (_pipeline->bindPoint() != vk::PipelineBindPoint::eGraphics) return;
+        if (ds == _dynamicStates) return;
+        _dynamicStates            = ds;
+        _dirty.graphicsOrDispatch = true;
+    }
+
+    const GraphicsPipeline::DynamicStates & dynamicStates() const { return _dynamicStates; }
+
     Ref<const DrawPack> compile() const {
         // if the pipeline is not ready, return a failsafe pack.
         if (!_pipeline) return failsafe();
@@ -2089,8 +3483,7 @@ public:
 
         // The drawable is changed since the last call to compile(0). We can't directly
         // modify the cached pack, since it may be used for rendering. Instead, we'll
-        // create a new pack to store the compile result.
-        // TODO: use a pool for faster memory allocation and better memory locality.
+        // create a new pack to store the compile result. The pack is allocated out of the draw pack pool.
         auto newPack = Ref<DrawPack>(new DrawPack({_owner.name()}));
         if (_cachedPack) {
             // copy content of the cached pack to the new one.
@@ -2117,6 +3510,7 @@ public:
         }
 
         // done
+        for (auto & b : _constants) b.clearDirtyRange();
         _cachedPack = newPack;
         _dirty.clearAll();
         return newPack;
@@ -2137,15 +3531,33 @@ private:
     };
     static_assert(sizeof(DirtyFlags) == sizeof(uint64_t));
 
+    /// Push constant values of one shader stage, covering the range used by the stage.
+    struct ConstantBlock {
+        vk::ShaderStageFlagBits stage {};
+        uint32_t                begin = 0;
+        std::vector<uint8_t>    data;            ///< value of bytes [begin, begin + data.size()).
+        bool                    written = false; ///< true, if any byte of the block is set.
+
+        /// Range of bytes (relative to begin) that are changed since the last compile.
+        mutable uint32_t dirtyBegin = (uint32_t) -1;
+        mutable uint32_t dirtyEnd   = 0;
+
+        void clearDirtyRange() const {
+            dirtyBegin = (uint32_t) -1;
+            dirtyEnd   = 0;
+        }
+    };
+
     Drawable &                                             _owner;
     Ref<const Pipeline>                                    _pipeline;
     std::unordered_map<DescriptorIdentifier, ArgumentImpl> _descriptors;
-    std::vector<DrawPack::ConstantArgument>                _constants;
+    std::vector<ConstantBlock>                             _constants;
     std::vector<BufferView>                                _vertexBuffers;
     BufferView                                             _indexBuffer;
     vk::IndexType                                          _indexType = vk::IndexType::eUint16;
     GraphicsPipeline::DrawParameters                       _drawParameters;
     ComputePipeline::DispatchParameters                    _dispatchParameters;
+    GraphicsPipeline::DynamicStates                        _dynamicStates;
     mutable Ref<const DrawPack>                            _cachedPack;
     mutable DirtyFlags                                     _dirty {};
 
@@ -2158,13 +3570,17 @@ private:
     void copyStates(const DrawPack & from, DrawPack & to) const {
         const_cast<Ref<const Pipeline> &>(to.pipeline) = from.pipeline;
         to.descriptors                                 = from.descriptors;
+        to.descriptorBlock                             = from.descriptorBlock; // shared, so the descriptor writes remain valid.
+        to.descriptorOffsets                           = from.descriptorOffsets;
         to.dependencies                                = from.dependencies;
         to.constants.assign(from.constants.begin(), from.constants.end());
         to.vertexBuffers.assign(from.vertexBuffers.begin(), from.vertexBuffers.end());
         to.vertexOffsets.assign(from.vertexOffsets.begin(), from.vertexOffsets.end());
-        to.indexBuffer = from.indexBuffer;
-        to.indexOffset = from.indexOffset;
-        to.indexType   = from.indexType;
+        to.indexBuffer      = from.indexBuffer;
+        to.indexOffset      = from.indexOffset;
+        to.indexType        = from.indexType;
+        to.hasDynamicStates = from.hasDynamicStates;
+        to.dynamicStates    = from.dynamicStates;
         // draw and dispatch parameters are store in a union. So we only need to copy the one with larger size.
         if constexpr (sizeof(to.draw) >= sizeof(to.dispatch)) {
             to.draw = from.draw;
@@ -2180,32 +3596,31 @@ private:
         return iter == _descriptors.end() ? nullptr : iter->second._impl;
     }
 
-    std::vector<std::tuple<vk::PushConstantRange, const uint8_t *>> getConstant(vk::ShaderStageFlags stages, uint32_t begin, uint32_t end) const {
-        if (!stages) return {};
-        if (begin >= end) return {};
-        std::vector<std::tuple<vk::PushConstantRange, const uint8_t *>> v;
-        for (auto & c : _constants) {
-            vk::PushConstantRange range {};
-            range.stageFlags = c.stages & stages;
-            if (!range.stageFlags) continue;
-            range.offset = std::max(c.offset, begin);
-            end          = std::min((uint32_t) (c.offset + c.value.size()), end);
-            if (range.offset >= end) continue;
-            range.size = end - range.offset;
-            v.push_back({range, c.value.data() + range.offset - c.offset});
-        }
-        return v;
-    }
+    /// Location of one descriptor info array in the packed descriptor info block.
+    struct DescriptorInfoArray {
+        size_t       offset;
+        const void * source;
+        size_t       size;
+        bool         buffer; ///< true for buffer infos, false for image infos.
+    };
 
     bool compileDescriptors(DrawPack & pack) const {
         const auto & refl = _pipeline->reflection();
         pack.dependencies.clear();
         pack.descriptors.clear();
         pack.descriptors.resize(refl.descriptors.size());
-        auto dep = DrawPack::Dependencies();
+        pack.descriptorBlock.reset();
+        pack.descriptorOffsets.assign(refl.descriptors.size(), 0);
+        auto dep    = DrawPack::Dependencies();
+        auto infos  = std::vector<DescriptorInfoArray>(); // info arrays of each write, of all sets.
+        auto offset = size_t(0);
         for (uint32_t si = 0; si < refl.descriptors.size(); ++si) {
             const auto & s      = refl.descriptors[si];
             auto         writes = std::vector<vk::WriteDescriptorSet>();
+
+            // Infos of each set start at aligned offset. So the layout within the set matches the update template.
+            offset                     = alignDescriptorInfoOffset(offset);
+            pack.descriptorOffsets[si] = offset;
             for (uint32_t i = 0; i < s.size(); ++i) {
                 if (s[i].empty()) continue;
                 const auto & b = s[i].binding;
@@ -2232,7 +3647,11 @@ private:
                     return false;
                 }
 
+                // Always write exactly the number of descriptors of the binding, since that is what the update template
+                // expects. Zero-count bindings are skipped above, same as in the template.
                 auto & value = a->value();
+                auto   count = b.descriptorCount;
+                offset       = alignDescriptorInfoOffset(offset);
                 if (auto buf = std::get_if<Argument::Impl::BufferArgs>(&value)) {
                     for (size_t j = 0; j < buf->buffers.size(); ++j) {
                         const auto & v = buf->buffers[j];
@@ -2241,13 +3660,9 @@ private:
                                      si, i, j);
                             return false;
                         }
-                        dep.buffers.insert(v.buffer);
+                        dep.buffers.push_back(v.buffer);
                     }
-                    // Store a copy of buffer info in the DrawPack class. So its value is not affected by changes in the Drawable class after compilation.
-                    auto blob = std::make_shared<std::vector<uint8_t>>((uint8_t *) buf->infos.data(), (uint8_t *) (buf->infos.data() + buf->infos.size()));
-                    RVI_ASSERT(blob->size() == buf->infos.size() * sizeof(vk::DescriptorBufferInfo));
-                    dep.blobs.push_back(blob);
-                    w.setDescriptorCount((uint32_t) buf->infos.size()).setPBufferInfo((vk::DescriptorBufferInfo *) blob->data());
+                    infos.push_back({offset, buf->infos.data(), count * sizeof(vk::DescriptorBufferInfo), true});
                 } else if (auto img = std::get_if<Argument::Impl::ImageArgs>(&value)) {
                     if (b.descriptorType == vk::DescriptorType::eSampler || b.descriptorType == vk::DescriptorType::eCombinedImageSampler) {
                         for (size_t j = 0; j < img->images.size(); ++j) {
@@ -2257,7 +3672,7 @@ private:
                                          i, j);
                                 return false;
                             }
-                            dep.samplers.insert(v.sampler);
+                            dep.samplers.push_back(v.sampler);
                         }
                     }
                     if (b.descriptorType != vk::DescriptorType::eSampler) {
@@ -2268,13 +3683,10 @@ private:
                                          si, i, j);
                                 return false;
                             }
-                            if (v.image) dep.images.insert(v.image);
+                            if (v.image) dep.images.push_back(v.image);
                         }
                     }
-                    auto blob = std::make_shared<std::vector<uint8_t>>((uint8_t *) img->infos.data(), (uint8_t *) (img->infos.data() + img->infos.size()));
-                    RVI_ASSERT(blob->size() == img->infos.size() * sizeof(vk::DescriptorImageInfo));
-                    dep.blobs.emplace_back(blob);
-                    w.setDescriptorCount((uint32_t) img->infos.size()).setPImageInfo((vk::DescriptorImageInfo *) blob->data());
+                    infos.push_back({offset, img->infos.data(), count * sizeof(vk::DescriptorImageInfo), false});
                 } else {
                     // we should not reach here, since we have already checked the type compatibility.
                     RAPID_VULKAN_ASSERT(false, "should never reach here.");
@@ -2284,26 +3696,66 @@ private:
                 w.setDstBinding(b.binding);
                 w.setDescriptorType(b.descriptorType);
                 // must set descriptor count explicitly in case that the argument has more descriptors than the binding requires.
-                if (b.descriptorCount > 0) w.setDescriptorCount(b.descriptorCount);
+                w.setDescriptorCount(count);
                 writes.push_back(w);
+                offset += infos.back().size;
             }
+
             pack.descriptors[si] = std::move(writes);
-            pack.dependencies    = std::move(dep);
         }
+
+        // Store a copy of descriptor infos of all sets in one block in the DrawPack class. So its value is not affected by changes in the
+        // Drawable class after compilation. Infos of each set are laid out to be consumed by the descriptor update template of the pipeline directly.
+        if (!infos.empty()) {
+            auto   block = std::make_shared<std::vector<uint8_t>>(offset);
+            size_t k     = 0;
+            for (auto & writes : pack.descriptors) {
+                for (auto & w : writes) {
+                    const auto & a = infos[k++];
+                    auto         p = block->data() + a.offset;
+                    memcpy(p, a.source, a.size);
+                    if (a.buffer)
+                        w.setPBufferInfo((const vk::DescriptorBufferInfo *) p);
+                    else
+                        w.setPImageInfo((const vk::DescriptorImageInfo *) p);
+                }
+            }
+            RVI_ASSERT(k == infos.size());
+            pack.descriptorBlock = block;
+        }
+
+        // Keep the dependencies in flat sorted arrays, instead of trees of individually allocated nodes.
+        auto flatten = [](auto & v) {
+            std::sort(v.begin(), v.end());
+            v.erase(std::unique(v.begin(), v.end()), v.end());
+        };
+        flatten(dep.buffers);
+        flatten(dep.images);
+        flatten(dep.samplers);
+        pack.dependencies = std::move(dep);
         return true;
     }
 
     bool compileConstants(DrawPack & pack) const {
-        pack.constants.clear();
-        const auto & reflection = _pipeline->reflection();
-        for (const auto & kv : reflection.constants) {
-            if (kv.second.empty()) continue;
-            auto v = getConstant(kv.first, kv.second.begin, kv.second.end);
-            if (v.empty()) {
-                RVI_LOGW("Drawable (%s) validate error: push constant range %s is not set.", _owner.name().c_str(), vk::to_string(kv.first).c_str());
+        for (const auto & b : _constants) {
+            if (!b.written) {
+                RVI_LOGW("Drawable (%s) validate error: push constant range %s is not set.", _owner.name().c_str(), vk::to_string(b.stage).c_str());
                 return false;
             }
-            for (const auto & [pcr, data] : v) pack.constants.push_back({pcr.stageFlags, pcr.offset, {data, data + pcr.size}});
+        }
+
+        // The pack carries the values of the previous compile, if it has one constant argument for each block. Then only
+        // the dirty ranges need to be updated. Otherwise, copy the blocks as a whole.
+        if (pack.constants.size() == _constants.size()) {
+            for (size_t i = 0; i < _constants.size(); ++i) {
+                const auto & b = _constants[i];
+                auto &       c = pack.constants[i];
+                RVI_ASSERT(c.stages == b.stage && c.offset == b.begin && c.value.size() == b.data.size());
+                if (b.dirtyBegin < b.dirtyEnd) memcpy(c.value.data() + b.dirtyBegin, b.data.data() + b.dirtyBegin, b.dirtyEnd - b.dirtyBegin);
+            }
+        } else {
+            pack.constants.clear();
+            for (const auto & b : _constants) pack.constants.push_back({b.stage, b.begin, b.data});
         }
         return true;
     }
@@ -2337,6 +3789,10 @@ private:
             pack.indexType   = _indexType;
         }
 
+        auto gp               = dynamic_cast<const GraphicsPipeline *>(_pipeline.get());
+        pack.hasDynamicStates = gp && gp->dynamicStates();
+        pack.dynamicStates    = _dynamicStates;
+
         // done
         pack.draw = _drawParameters;
         return true;
@@ -2396,6 +3852,11 @@ auto Drawable::dispatch(const ComputePipeline::DispatchParameters & v) -> Drawab
     _impl->set(v);
     return *this;
 }
+auto Drawable::dynamicStates(const GraphicsPipeline::DynamicStates & v) -> Drawable & {
+    _impl->set(v);
+    return *this;
+}
+auto Drawable::dynamicStates() const -> const GraphicsPipeline::DynamicStates & { return _impl->dynamicStates(); }
 auto Drawable::compile() const -> Ref<const DrawPack> { return _impl->compile(); };
 
 // *********************************************************************************************************************
@@ -2453,69 +3914,324 @@ private:
         RVI_REQUIRE(!cp.bindings.empty());
         RVI_REQUIRE(cp.maxSets > 0);
 
-        _gi      = cp.gi;
-        _maxSets = (uint32_t) cp.maxSets;
+        _gi      = cp.gi;
+        _maxSets = (uint32_t) cp.maxSets;
+
+        auto bindings = std::vector<vk::DescriptorSetLayoutBinding> {};
+        auto sizesMap = std::map<vk::DescriptorType, uint32_t> {};
+        for (const auto & b : cp.bindings) {
+            if (0 == b.descriptorCount) continue; // skip empty descriptor
+            bindings.push_back(b);
+            sizesMap[b.descriptorType] += b.descriptorCount;
+        }
+        if (bindings.empty()) return; // no descriptor to allocate
+
+        // create set layout
+        _layout = _gi->device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo {}.setBindings(bindings), _gi->allocator);
+
+        // setup pool size array
+        _sizes.reserve(sizesMap.size());
+        for (const auto & kv : sizesMap) _sizes.push_back({kv.first, kv.second * _maxSets});
+
+        // done
+        updateName();
+    }
+
+    void destruct() {
+        if (!_gi) return;
+        _gi->safeDestroy(_layout);
+        _gi->safeDestroy(_pool);
+        for (auto & p : _full) { _gi->safeDestroy(p); }
+        _full.clear();
+        _gi = nullptr;
+    }
+};
+
+// *********************************************************************************************************************
+// Command Buffer/Pool/Queue
+// *********************************************************************************************************************
+
+/// Identify descriptor sets of compatible layouts.
+struct DescriptorPoolKey {
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+
+    bool operator<(const DescriptorPoolKey & rhs) const {
+        if (bindings.size() != rhs.bindings.size()) return bindings.size() < rhs.bindings.size();
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            const auto & a = bindings[i];
+            const auto & b = rhs.bindings[i];
+            if (a.binding != b.binding) return a.binding < b.binding;
+            if (a.descriptorType != b.descriptorType) return a.descriptorType < b.descriptorType;
+            if (a.descriptorCount != b.descriptorCount) return a.descriptorCount < b.descriptorCount;
+            if (a.stageFlags != b.stageFlags) return a.stageFlags < b.stageFlags;
+        }
+        return false;
+    }
+
+    /// Build the key of the specified descriptor set of the pipeline. Returns empty key, if the set index is out of range.
+    static DescriptorPoolKey make(const Pipeline & p, uint32_t setIndex) {
+        DescriptorPoolKey key;
+        const auto &      refl = p.reflection();
+        if (setIndex >= refl.descriptors.size()) return key;
+        for (const auto & d : refl.descriptors[setIndex]) { key.bindings.push_back(d.binding); }
+        return key;
+    }
+};
+
+/// A cache of descriptor sets keyed by the set layout and the content of the set. Cached sets are reused by command
+/// buffers across frames without being written again. Sets that are in use by any command buffer that is not retired
+/// yet are never evicted. Others are evicted in LRU order when the cache is full. All methods are thread safe.
+class DescriptorSetCache {
+    struct PoolSlot;
+
+    /// Binary signature of the descriptor set content.
+    typedef rv_details::Signature Signature;
+
+public:
+    struct Entry {
+        vk::DescriptorSet            set {};
+        Ref<const DrawPack>          owner;     ///< the draw pack that keeps resources referenced by the set alive.
+        size_t                       users = 0; ///< number of unretired command buffers that are using the set.
+        PoolSlot *                   slot {};
+        const Signature *            key {};
+        std::list<Entry *>::iterator lru {};
+    };
+
+    DescriptorSetCache(const GlobalInfo * gi, const std::string & name, size_t capacity): _gi(gi), _name(name), _capacity(capacity) {}
+
+    ~DescriptorSetCache() {
+        if (_inUse) RVI_LOGW("Descriptor set cache %s is destroyed with %zu sets in use.", _name.c_str(), _inUse);
+    }
+
+    /// Get a descriptor set with the specified content. The returned entry is in use until released. Returns null if
+    /// the content can't be cached.
+    Entry * acquire(const DescriptorPoolKey & key, const std::vector<vk::WriteDescriptorSet> & writes, Ref<const DrawPack> owner) {
+        Signature sig;
+        if (key.bindings.empty() || !sign(sig, key, writes)) return nullptr;
+
+        auto lock = std::lock_guard {_mutex};
+        auto iter = _entries.find(sig);
+        if (iter != _entries.end()) {
+            // Cache hit. Move the entry to the front of the LRU list.
+            auto & e = iter->second;
+            _lru.splice(_lru.begin(), _lru, e.lru);
+            if (0 == e.users++) ++_inUse;
+            return &e;
+        }
+
+        // Cache miss. Evict the least recently used entry that is not in use, if the cache is full.
+        if (_entries.size() >= _capacity) evict();
 
-        auto bindings = std::vector<vk::DescriptorSetLayoutBinding> {};
-        auto sizesMap = std::map<vk::DescriptorType, uint32_t> {};
-        for (const auto & b : cp.bindings) {
-            if (0 == b.descriptorCount) continue; // skip empty descriptor
-            bindings.push_back(b);
-            sizesMap[b.descriptorType] += b.descriptorCount;
+        auto & slot = _pools.try_emplace(key, DescriptorPool::ConstructParameters {{_name}, _gi, key.bindings}).first->second;
+        auto   set  = vk::DescriptorSet {};
+        if (slot.free.empty()) {
+            set = slot.pool.allocate();
+        } else {
+            set = slot.free.back();
+            slot.free.pop_back();
         }
-        if (bindings.empty()) return; // no descriptor to allocate
+        auto copy = writes;
+        for (auto & w : copy) w.dstSet = set;
+        _gi->device.updateDescriptorSets(copy, {});
+
+        auto & kv = *_entries.emplace(std::move(sig), Entry {}).first;
+        auto & e  = kv.second;
+        e.set     = set;
+        e.owner   = std::move(owner);
+        e.users   = 1;
+        e.slot    = &slot;
+        e.key     = &kv.first;
+        e.lru     = _lru.insert(_lru.begin(), &e);
+        ++_inUse;
+        return &e;
+    }
+
+    /// Release an entry returned by acquire(), once the command buffer that uses it is retired.
+    void release(Entry * e) {
+        if (!e) return;
+        auto lock = std::lock_guard {_mutex};
+        RVI_ASSERT(e->users > 0);
+        if (0 == --e->users) --_inUse;
+    }
 
-        // create set layout
-        _layout = _gi->device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo {}.setBindings(bindings), _gi->allocator);
+private:
+    struct PoolSlot {
+        DescriptorPool                 pool;
+        std::vector<vk::DescriptorSet> free; ///< sets of evicted entries. Ready to be rewritten.
 
-        // setup pool size array
-        _sizes.reserve(sizesMap.size());
-        for (const auto & kv : sizesMap) _sizes.push_back({kv.first, kv.second * _maxSets});
+        PoolSlot(const DescriptorPool::ConstructParameters & cp): pool(cp) {}
+    };
 
-        // done
-        updateName();
+    typedef std::unordered_map<Signature, Entry, rv_details::SignatureHash> EntryMap;
+
+    const GlobalInfo *                    _gi {};
+    std::string                           _name;
+    size_t                                _capacity {};
+    size_t                                _inUse {}; ///< number of entries that are in use.
+    std::map<DescriptorPoolKey, PoolSlot> _pools;
+    EntryMap                              _entries;
+    std::list<Entry *>                    _lru; ///< entries sorted from most to least recently used.
+    std::mutex                            _mutex;
+
+private:
+    void evict() {
+        for (auto i = _lru.rbegin(); i != _lru.rend(); ++i) {
+            auto e = *i;
+            if (e->users) continue;
+            e->slot->free.push_back(e->set);
+            _lru.erase(std::next(i).base());
+            auto key = *e->key; // copy the key, since it is owned by the entry being erased.
+            _entries.erase(key);
+            return;
+        }
     }
 
-    void destruct() {
-        if (!_gi) return;
-        _gi->safeDestroy(_layout);
-        _gi->safeDestroy(_pool);
-        for (auto & p : _full) { _gi->safeDestroy(p); }
-        _full.clear();
-        _gi = nullptr;
+    static bool sign(Signature & sig, const DescriptorPoolKey & key, const std::vector<vk::WriteDescriptorSet> & writes) {
+        for (const auto & b : key.bindings) {
+            sig.push_back(b.binding | (uint64_t) b.descriptorType << 32);
+            sig.push_back(b.descriptorCount | (uint64_t) (VkShaderStageFlags) b.stageFlags << 32);
+        }
+        for (const auto & w : writes) {
+            sig.push_back(w.dstBinding | (uint64_t) w.dstArrayElement << 32);
+            sig.push_back(w.descriptorCount | (uint64_t) w.descriptorType << 32);
+            for (uint32_t j = 0; j < w.descriptorCount; ++j) {
+                switch (w.descriptorType) {
+                case vk::DescriptorType::eSampler:
+                case vk::DescriptorType::eCombinedImageSampler:
+                case vk::DescriptorType::eSampledImage:
+                case vk::DescriptorType::eStorageImage:
+                case vk::DescriptorType::eInputAttachment:
+                    sig.push_back((uint64_t) (VkSampler) w.pImageInfo[j].sampler);
+                    sig.push_back((uint64_t) (VkImageView) w.pImageInfo[j].imageView);
+                    sig.push_back((uint64_t) w.pImageInfo[j].imageLayout);
+                    break;
+                case vk::DescriptorType::eUniformTexelBuffer:
+                case vk::DescriptorType::eStorageTexelBuffer:
+                    sig.push_back((uint64_t) (VkBufferView) w.pTexelBufferView[j]);
+                    break;
+                case vk::DescriptorType::eUniformBuffer:
+                case vk::DescriptorType::eStorageBuffer:
+                case vk::DescriptorType::eUniformBufferDynamic:
+                case vk::DescriptorType::eStorageBufferDynamic:
+                    sig.push_back((uint64_t) (VkBuffer) w.pBufferInfo[j].buffer);
+                    sig.push_back(w.pBufferInfo[j].offset);
+                    sig.push_back(w.pBufferInfo[j].range);
+                    break;
+                default:
+                    return false; // unsupported descriptor type
+                }
+            }
+        }
+        return true;
     }
 };
 
-// *********************************************************************************************************************
-// Command Buffer/Pool/Queue
-// *********************************************************************************************************************
+/// A command pool shared by all command buffers that are recorded by the same thread, in pooled mode. Command buffers
+/// are allocated linearly out of the pool, and are released all together with one vkResetCommandPool call, once all of
+/// them are retired. The pool is not thread safe by itself. All methods and members are accessed with the mutex of the
+/// owning thread's context (CommandQueue::Impl::ThreadContext::mutex) held: allocate() by begin(), release() by
+/// recycle(), and the sealed flag by threadPool(), deactivate() and seal(). Pools only move to another context through
+/// reclaim(), which holds both contexts' mutexes.
+struct SharedCommandPool {
+    const GlobalInfo *             gi {};
+    vk::CommandPool                handle {};
+    std::vector<vk::CommandBuffer> buffers[2] {};      ///< allocated command buffers, indexed by level (primary, secondary).
+    size_t                         used[2] {};         ///< number of command buffers in use, indexed by level.
+    size_t                         outstanding = 0;    ///< number of command buffers that are not retired yet.
+    bool                           sealed      = true; ///< true, if the pool is not the current pool of any thread.
+
+    SharedCommandPool(const GlobalInfo * gi_, uint32_t family): gi(gi_) {
+        handle = gi->device.createCommandPool(vk::CommandPoolCreateInfo().setQueueFamilyIndex(family), gi->allocator);
+    }
+
+    ~SharedCommandPool() {
+        RVI_ASSERT(0 == outstanding);
+        gi->safeDestroy(handle); // this frees all command buffers allocated from it.
+    }
+
+    /// Returns true if the pool can be handed over to another thread.
+    bool idle() const { return sealed && 0 == outstanding; }
+
+    vk::CommandBuffer allocate(vk::CommandBufferLevel level) {
+        auto   i = vk::CommandBufferLevel::ePrimary == level ? 0 : 1;
+        auto & v = buffers[i];
+        if (used[i] == v.size()) {
+            // Grow by doubling to amortize the allocation cost. The command buffers are kept across pool resets.
+            auto count = std::max<uint32_t>(4, (uint32_t) v.size());
+            auto more  = gi->device.allocateCommandBuffers({handle, level, count});
+            v.insert(v.end(), more.begin(), more.end());
+        }
+        ++outstanding;
+        return v[used[i]++];
+    }
+
+    void release() {
+        RVI_ASSERT(outstanding > 0);
+        if (--outstanding > 0) return;
+        // All command buffers are retired. Reset them all at once.
+        gi->device.resetCommandPool(handle);
+        used[0] = used[1] = 0;
+    }
+};
 
 class CommandBuffer::Impl : public CommandBuffer {
 public:
-    Impl(CommandQueue & queue, const std::string & name_, vk::CommandBufferLevel level): _queue(queue), _name(name_), _level(level) {
+    Impl(CommandQueue & queue, const std::string & name_, vk::CommandBufferLevel level, std::shared_ptr<SharedCommandPool> shared,
+         std::shared_ptr<DescriptorSetCache> descriptorCache, const vk::CommandBufferInheritanceInfo * inheritance)
+        : _queue(queue), _name(name_), _level(level), _descriptorCache(std::move(descriptorCache)) {
         const auto & d = queue.desc();
-        _pool          = d.gi->device.createCommandPool(vk::CommandPoolCreateInfo().setQueueFamilyIndex(d.family), d.gi->allocator);
-        wakeup();
+        if (!d.pooled) _pool = d.gi->device.createCommandPool(vk::CommandPoolCreateInfo().setQueueFamilyIndex(d.family), d.gi->allocator);
+        wakeup(level, std::move(shared), inheritance);
     }
 
     ~Impl() {
         clear();
+        for (auto & b : _indirectBlocks) b.buffer->unmap();
+        _indirectBlocks.clear();
         _queue.desc().gi->safeDestroy(_pool);
     }
 
     // Wake up a newly created or previously hibernated command buffer. Make it ready for command recording.
-    void wakeup() {
+    // In pooled mode, the command buffer is allocated out of the shared pool. Otherwise, out of its own pool.
+    void wakeup(vk::CommandBufferLevel level, std::shared_ptr<SharedCommandPool> shared, const vk::CommandBufferInheritanceInfo * inheritance) {
         clear();
-        _state = RECORDING;
-        vk::CommandBufferAllocateInfo info;
-        info.commandPool        = _pool;
-        info.level              = _level;
-        info.commandBufferCount = 1;
-        _handle                 = _queue.desc().gi->device.allocateCommandBuffers(info)[0];
+        _state  = RECORDING;
+        _level  = level;
+        _thread = std::this_thread::get_id();
+        if (shared) {
+            _shared = std::move(shared);
+            _handle = _shared->allocate(_level);
+        } else {
+            RVI_ASSERT(_pool);
+            vk::CommandBufferAllocateInfo info;
+            info.commandPool        = _pool;
+            info.level              = _level;
+            info.commandBufferCount = 1;
+            _handle                 = _queue.desc().gi->device.allocateCommandBuffers(info)[0];
+        }
         setVkHandleName(_queue.desc().gi->device, _handle, _name);
-        _handle.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+        // Secondary command buffers always require inheritance info. They continue the render pass, if there's one.
+        auto inherited = inheritance ? *inheritance : vk::CommandBufferInheritanceInfo {};
+        auto bi        = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        if (vk::CommandBufferLevel::eSecondary == _level) {
+            bi.setPInheritanceInfo(&inherited);
+            if (inherited.renderPass) bi.flags |= vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+        }
+        _handle.begin(bi);
     }
 
+    const std::shared_ptr<SharedCommandPool> & shared() const { return _shared; }
+
+    /// The thread that began the command buffer. It is returned to the free list of this thread once retired.
+    std::thread::id thread() const { return _thread; }
+
+    /// Secondary command buffers executed by this one.
+    const std::vector<std::shared_ptr<Impl>> & children() const { return _children; }
+
+    /// Hand over the secondary command buffers to the caller, for them to be recycled.
+    std::vector<std::shared_ptr<Impl>> takeChildren() { return std::move(_children); }
+
     void hibernate() {
         _state = FINISHED;
         clear();
@@ -2527,10 +4243,42 @@ public:
             RVI_LOGE("Failed to enqueue drawable: command buffer %s is not in RECORDING state!", _name.c_str());
             return;
         }
-        d->cmdRender(_handle, {_queue.desc().gi->device, [&](const Pipeline & p, uint32_t i) { return allocateDescriptorSet(p, i); }, _last.get()});
-        _last = d;
+        if (record(d, {}, 0, 0)) updateResourceReferenceList(*d);
+    }
+
+    void renderParallel(const ParallelRenderParameters &); // defined after CommandQueue::Impl.
+
+    /// Forget the states left by the last draw pack, so the next one records all of its states.
+    void invalidateState() {
+        _last          = {};
+        _boundPipeline = nullptr;
+    }
+
+    void render(vk::ArrayProxy<const Ref<const DrawPack>> packs) {
+        if (RECORDING != _state) {
+            RVI_LOGE("Failed to enqueue drawables: command buffer %s is not in RECORDING state!", _name.c_str());
+            return;
+        }
+        auto merge = _queue.desc().gi->multiDrawIndirect;
+        auto p     = packs.data();
+        for (uint32_t i = 0; i < packs.size();) {
+            if (!p[i] || !*p[i]) {
+                ++i; // ignore empty draw pack
+                continue;
+            }
 
-        updateResourceReferenceList(*d);
+            // Look for the run of draw packs that differ only in draw parameters.
+            uint32_t n = 1;
+            if (merge) {
+                while (i + n < packs.size() && n < MAX_MERGED_DRAWS && p[i + n] && p[i]->mergeable(*p[i + n])) ++n;
+            }
+            if (n > 1) {
+                renderMerged(p + i, n);
+            } else if (record(p[i], {}, 0, 0)) {
+                updateResourceReferenceList(*p[i]);
+            }
+            i += n;
+        }
     }
 
     const std::string & name() const { return _name; }
@@ -2562,40 +4310,35 @@ private:
         FINISHED,
     };
 
-    struct DescriptorPoolKey {
-        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    typedef std::map<DescriptorPoolKey, DescriptorPool> DescriptorPoolMap;
 
-#ifdef _MSC_VER
-#pragma warning(push)
-#pragma warning(disable : 4702) // unreachable code
-#endif
-        bool operator<(const DescriptorPoolKey & rhs) const {
-            if (bindings.size() != rhs.bindings.size()) return bindings.size() < rhs.bindings.size();
-            for (size_t i = 0; i < bindings.size(); ++i) {
-                const auto & a = bindings[i];
-                const auto & b = rhs.bindings[i];
-                if (a.binding != b.binding) return a.binding < b.binding;
-                if (a.descriptorType != b.descriptorType) return a.descriptorType < b.descriptorType;
-                if (a.descriptorCount != b.descriptorCount) return a.descriptorCount < b.descriptorCount;
-                return a.stageFlags < b.stageFlags;
-            }
-            return false;
-        }
+    struct IndirectBlock {
+        Ref<Buffer>    buffer;
+        uint8_t *      data = nullptr; // persistently mapped address of the buffer.
+        vk::DeviceSize used = 0;
     };
-#ifdef _MSC_VER
-#pragma warning(pop)
-#endif
 
-    typedef std::map<DescriptorPoolKey, DescriptorPool> DescriptorPoolMap;
-
-    CommandQueue &         _queue;
-    std::string            _name;
-    vk::CommandBufferLevel _level {};
-    vk::CommandPool        _pool; // one pool for each command buffer for simplicity and for multithread safety.
-    vk::CommandBuffer      _handle {};
-    State                  _state = RECORDING;
-    DescriptorPoolMap      _descriptorPools;
-    Ref<const DrawPack>    _last;
+    // Guaranteed minimum of VkPhysicalDeviceLimits::maxDrawIndirectCount, when multiDrawIndirect is enabled.
+    static constexpr uint32_t MAX_MERGED_DRAWS = 65535;
+
+    static constexpr vk::DeviceSize INDIRECT_BLOCK_SIZE = 64 * 1024;
+
+    CommandQueue &                           _queue;
+    std::string                              _name;
+    vk::CommandBufferLevel                   _level {};
+    std::thread::id                          _thread {};       // the thread that began the command buffer.
+    vk::CommandPool                          _pool;            // one pool for each command buffer for multithread safety. Null in pooled mode.
+    std::shared_ptr<SharedCommandPool>       _shared;          // the shared pool that the command buffer is allocated from, in pooled mode.
+    std::shared_ptr<DescriptorSetCache>      _descriptorCache; // the queue's descriptor set cache. Null if caching is disabled.
+    std::vector<DescriptorSetCache::Entry *> _cachedSets;      // cached descriptor sets used by this command buffer.
+    vk::CommandBuffer                        _handle {};
+    State                                    _state = RECORDING;
+    DescriptorPoolMap                        _descriptorPools;
+    Ref<const DrawPack>                      _last;
+    vk::Pipeline                             _boundPipeline {};
+    std::vector<IndirectBlock>               _indirectBlocks;    // host visible buffers of indirect draw commands.
+    size_t                                   _indirectBlock = 0; // index of the block that is being allocated from.
+    std::vector<std::shared_ptr<Impl>>       _children;          // secondary command buffers executed by this one.
 
     std::set<Ref<const Pipeline>> _pipelines;
     std::set<Ref<const Buffer>>   _buffers;
@@ -2607,25 +4350,95 @@ private:
 private:
     void clear() {
         auto gi = _queue.desc().gi;
-        gi->safeDestroy(_handle, _pool);
-        gi->device.resetCommandPool(_pool);
+        if (_shared) {
+            // Command buffers of shared pool are released all together when the pool is reset.
+            _handle = nullptr;
+            _shared->release();
+            _shared.reset();
+        } else if (_pool) {
+            gi->safeDestroy(_handle, _pool);
+            gi->device.resetCommandPool(_pool);
+        }
         for (auto & p : _descriptorPools) p.second.purge();
-        _last = {};
+        for (auto e : _cachedSets) _descriptorCache->release(e);
+        _cachedSets.clear();
+        invalidateState();
+        for (auto & b : _indirectBlocks) b.used = 0; // the buffers are reused, since the GPU is done with them.
+        _indirectBlock = 0;
         _pipelines.clear();
         _buffers.clear();
         _images.clear();
         _samplers.clear();
     }
 
+    bool record(const Ref<const DrawPack> & d, vk::Buffer indirectBuffer, vk::DeviceSize indirectOffset, uint32_t indirectCount) {
+        DrawPack::RenderParameters rp {_queue.desc().gi->device, [&](const Pipeline & p, uint32_t i) { return allocateDescriptorSet(p, i); }, _last.get()};
+        if (_descriptorCache) {
+            rp.descriptorSetLookup = [&](const Pipeline & p, uint32_t i, const std::vector<vk::WriteDescriptorSet> & w) {
+                return lookupDescriptorSet(p, i, w, d);
+            };
+        }
+        rp.boundPipeline  = &_boundPipeline;
+        rp.indirectBuffer = indirectBuffer;
+        rp.indirectOffset = indirectOffset;
+        rp.indirectCount  = indirectCount;
+        if (!d->cmdRender(_handle, rp)) return false; // pipeline is not ready yet.
+
+        // Don't carry states over from a draw pack that is rendered with its fallback pipeline, since the fallback could
+        // have different static states.
+        _last = (d->pipeline->handle() == _boundPipeline) ? d : Ref<const DrawPack> {};
+        return true;
+    }
+
+    /// Render mergeable draw packs with one indirect draw call. The states are recorded out of the first pack.
+    void renderMerged(const Ref<const DrawPack> * packs, uint32_t count) {
+        bool           indexed = (bool) packs[0]->indexBuffer;
+        auto           stride  = indexed ? sizeof(vk::DrawIndexedIndirectCommand) : sizeof(vk::DrawIndirectCommand);
+        vk::DeviceSize offset  = 0;
+        auto &         block   = allocateIndirect(stride * count, offset);
+        for (uint32_t i = 0; i < count; ++i) {
+            const auto & p = packs[i]->draw;
+            if (indexed) {
+                auto c = vk::DrawIndexedIndirectCommand(p.indexCount, p.instanceCount, p.firstIndex, p.vertexOffset, p.firstInstance);
+                memcpy(block.data + offset + stride * i, &c, sizeof(c));
+            } else {
+                auto c = vk::DrawIndirectCommand(p.vertexCount, p.instanceCount, p.firstVertex, p.firstInstance);
+                memcpy(block.data + offset + stride * i, &c, sizeof(c));
+            }
+        }
+        if (!record(packs[0], block.buffer->handle(), offset, count)) return;
+        for (uint32_t i = 0; i < count; ++i) updateResourceReferenceList(*packs[i]);
+    }
+
+    /// Allocate space for indirect draw commands. The blocks are recycled when the command buffer is reset.
+    IndirectBlock & allocateIndirect(vk::DeviceSize size, vk::DeviceSize & offset) {
+        for (; _indirectBlock < _indirectBlocks.size(); ++_indirectBlock) {
+            auto & b = _indirectBlocks[_indirectBlock];
+            auto   o = (b.used + 15) / 16 * 16;
+            if (o + size <= b.buffer->desc().size) {
+                b.used = o + size;
+                offset = o;
+                return b;
+            }
+        }
+        auto cp   = Buffer::ConstructParameters {{_name}, _queue.desc().gi, std::max(size, INDIRECT_BLOCK_SIZE)};
+        cp.usage  = vk::BufferUsageFlagBits::eIndirectBuffer;
+        cp.memory = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+        auto & b  = _indirectBlocks.emplace_back();
+        b.buffer  = Ref<Buffer>::make(cp);
+        b.data    = b.buffer->map({}).data;
+        RVI_REQUIRE(b.data, "Failed to map indirect draw buffer of command buffer %s.", _name.c_str());
+        b.used = size;
+        offset = 0;
+        return b;
+    }
+
     vk::DescriptorSet allocateDescriptorSet(const Pipeline & p, uint32_t setIndex) {
-        const auto & refl = p.reflection();
-        if (setIndex >= refl.descriptors.size()) {
+        if (setIndex >= p.reflection().descriptors.size()) {
             RVI_LOGE("Failed to allocate descriptor set: set index %d is out of range!", setIndex);
             return {};
         }
-        const auto &      set = refl.descriptors[setIndex];
-        DescriptorPoolKey key;
-        for (const auto & d : set) { key.bindings.push_back(d.binding); }
+        auto key  = DescriptorPoolKey::make(p, setIndex);
         auto iter = _descriptorPools.find(key);
         if (iter == _descriptorPools.end()) {
             auto inserted = _descriptorPools.emplace(key, DescriptorPool::ConstructParameters {{_name}, _queue.desc().gi, key.bindings});
@@ -2635,6 +4448,13 @@ private:
         return iter->second.allocate();
     }
 
+    vk::DescriptorSet lookupDescriptorSet(const Pipeline & p, uint32_t setIndex, const std::vector<vk::WriteDescriptorSet> & writes, Ref<const DrawPack> d) {
+        auto e = _descriptorCache->acquire(DescriptorPoolKey::make(p, setIndex), writes, d);
+        if (!e) return {};
+        _cachedSets.push_back(e);
+        return e->set;
+    }
+
     void updateResourceReferenceList(const DrawPack &) {
         //
         // RVI_ASSERT(false, "not implemented yet.");
@@ -2657,137 +4477,424 @@ auto CommandBuffer::render(Ref<const DrawPack> d) -> CommandBuffer & {
     if (_impl) _impl->render(d);
     return *this;
 }
+auto CommandBuffer::render(vk::ArrayProxy<const Ref<const DrawPack>> packs) const -> const CommandBuffer & {
+    if (_impl) _impl->render(packs);
+    return *this;
+}
+auto CommandBuffer::render(vk::ArrayProxy<const Ref<const DrawPack>> packs) -> CommandBuffer & {
+    if (_impl) _impl->render(packs);
+    return *this;
+}
+auto CommandBuffer::renderParallel(const ParallelRenderParameters & params) -> CommandBuffer & {
+    if (_impl) _impl->renderParallel(params);
+    return *this;
+}
+auto CommandBuffer::invalidateState() const -> const CommandBuffer & {
+    if (_impl) _impl->invalidateState();
+    return *this;
+}
+
+// *********************************************************************************************************************
+// Render Queue
+// *********************************************************************************************************************
+
+class RenderQueue::Impl {
+public:
+    Impl(const ConstructParameters & cp): _mergeDraws(cp.mergeDraws) {}
+
+    void add(Ref<const DrawPack> d, uint32_t key) {
+        if (!d || !*d) return; // ignore empty draw pack
+        _packs.push_back(std::move(d));
+        _userKeys.push_back(key);
+    }
+
+    size_t size() const { return _packs.size(); }
+
+    void clear() {
+        _packs.clear();
+        _userKeys.clear();
+    }
+
+    const std::vector<Ref<const DrawPack>> & sort() {
+        if (_packs.size() < 2) return _packs;
+
+        // Map pipelines, descriptor contents and vertex inputs to dense IDs, in order of first appearance. Dense IDs
+        // keep most of the radix sort passes trivial, which are then skipped.
+        _pipelineIds.clear();
+        _descriptorIds.clear();
+        _vertexIds.clear();
+        _keys.resize(_packs.size());
+        for (size_t i = 0; i < _packs.size(); ++i) {
+            const auto & d  = *_packs[i];
+            auto         p  = denseId(_pipelineIds, (uint64_t) (uintptr_t) d.pipeline.get()) & 0xFFFF;
+            auto         ds = denseId(_descriptorIds, hashDescriptors(d)) & 0xFFFFFF;
+            auto         vb = denseId(_vertexIds, hashVertexInputs(d)) & 0xFFFFFF;
+            _keys[i]        = {p << 48 | ds << 24 | vb, _userKeys[i], (uint32_t) i};
+        }
+        radixSort();
+
+        // Reorder the packs.
+        _sorted.clear();
+        _sorted.reserve(_packs.size());
+        for (size_t i = 0; i < _keys.size(); ++i) {
+            _sorted.push_back(std::move(_packs[_keys[i].index]));
+            _userKeys[i] = _keys[i].user;
+        }
+        _packs.swap(_sorted);
+        _sorted.clear();
+        return _packs;
+    }
+
+    size_t flush(CommandBuffer & cb) {
+        sort();
+        if (_mergeDraws) {
+            cb.render(vk::ArrayProxy<const Ref<const DrawPack>>((uint32_t) _packs.size(), _packs.data()));
+        } else {
+            for (const auto & d : _packs) cb.render(d);
+        }
+        auto count = _packs.size();
+        clear();
+        return count;
+    }
+
+private:
+    struct Key {
+        uint64_t state; ///< pipeline, descriptor and vertex input IDs.
+        uint32_t user;  ///< user provided key.
+        uint32_t index; ///< index into the pack array.
+    };
+
+    typedef std::unordered_map<uint64_t, uint64_t> IdMap;
+
+    bool                             _mergeDraws = false;
+    std::vector<Ref<const DrawPack>> _packs;
+    std::vector<uint32_t>            _userKeys;
+
+    // Scratch buffers that are reused by each sort, to avoid memory allocations.
+    std::vector<Ref<const DrawPack>> _sorted;
+    std::vector<Key>                 _keys;
+    std::vector<Key>                 _temp;
+    IdMap                            _pipelineIds;
+    IdMap                            _descriptorIds;
+    IdMap                            _vertexIds;
+
+private:
+    static uint64_t denseId(IdMap & map, uint64_t value) { return map.try_emplace(value, map.size()).first->second; }
+
+    static uint64_t hashDescriptors(const DrawPack & d) {
+        // The descriptor block contains all the descriptor infos of all sets. So it is a good identity of the content.
+        uint64_t h = rv_details::fnv1a(nullptr, 0);
+        if (d.descriptorBlock) h = rv_details::fnv1a(d.descriptorBlock->data(), d.descriptorBlock->size(), h);
+        for (auto o : d.descriptorOffsets) h = rv_details::fnv1a(&o, sizeof(o), h);
+        return h;
+    }
+
+    static uint64_t hashVertexInputs(const DrawPack & d) {
+        uint64_t h = rv_details::fnv1a(nullptr, 0);
+        for (size_t i = 0; i < d.vertexBuffers.size(); ++i) {
+            auto b = (VkBuffer) d.vertexBuffers[i]->handle();
+            h      = rv_details::fnv1a(&b, sizeof(b), h);
+            h      = rv_details::fnv1a(&d.vertexOffsets[i], sizeof(vk::DeviceSize), h);
+        }
+        if (d.indexBuffer) {
+            auto b = (VkBuffer) d.indexBuffer->handle();
+            h      = rv_details::fnv1a(&b, sizeof(b), h);
+            h      = rv_details::fnv1a(&d.indexOffset, sizeof(d.indexOffset), h);
+            h      = rv_details::fnv1a(&d.indexType, sizeof(d.indexType), h);
+        }
+        return h;
+    }
+
+    /// Stable LSD radix sort of the keys, 8 bits per pass. The user key is the least significant part.
+    void radixSort() {
+        _temp.resize(_keys.size());
+        auto pass = [&](auto digitOf) {
+            size_t counts[256] = {};
+            for (const auto & k : _keys) ++counts[digitOf(k)];
+            if (counts[digitOf(_keys[0])] == _keys.size()) return; // all keys have the same digit.
+            size_t offset = 0;
+            for (auto & c : counts) {
+                auto n = c;
+                c      = offset;
+                offset += n;
+            }
+            for (const auto & k : _keys) _temp[counts[digitOf(k)]++] = k;
+            _keys.swap(_temp);
+        };
+        for (uint32_t shift = 0; shift < 32; shift += 8) pass([shift](const Key & k) { return (k.user >> shift) & 0xFF; });
+        for (uint32_t shift = 0; shift < 64; shift += 8) pass([shift](const Key & k) { return (size_t) (k.state >> shift) & 0xFF; });
+    }
+};
+
+RenderQueue::RenderQueue(const ConstructParameters & cp): Root(cp) { _impl = new Impl(cp); }
+RenderQueue::~RenderQueue() {
+    delete _impl;
+    _impl = nullptr;
+}
+auto RenderQueue::add(Ref<const DrawPack> d, uint32_t key) -> RenderQueue & {
+    _impl->add(std::move(d), key);
+    return *this;
+}
+size_t RenderQueue::size() const { return _impl->size(); }
+void RenderQueue::clear() { _impl->clear(); }
+auto RenderQueue::sort() -> const std::vector<Ref<const DrawPack>> & { return _impl->sort(); }
+size_t RenderQueue::flush(CommandBuffer & cb) { return _impl->flush(cb); }
+
+/// Returns the lock shared by all users of the device queue, or null if the queue is not created by a Device.
+static std::mutex * queueMutex(const GlobalInfo * gi, uint32_t family, uint32_t index) {
+    if (!gi || !gi->queueMutexes) return nullptr;
+    auto iter = gi->queueMutexes->find({family, index});
+    return iter == gi->queueMutexes->end() ? nullptr : &iter->second;
+}
 
 class CommandQueue::Impl {
 public:
     Impl(CommandQueue & owner, const ConstructParameters & params): _owner(owner) {
-        _desc.gi     = params.gi;
-        _desc.family = params.family;
-        _desc.index  = params.index;
-        _desc.handle = params.gi->device.getQueue(params.family, params.index);
+        _desc.gi                         = params.gi;
+        _desc.family                     = params.family;
+        _desc.index                      = params.index;
+        _desc.pooled                     = params.pooled;
+        _desc.descriptorSetCacheCapacity = params.descriptorSetCacheCapacity;
+        _desc.handle                     = params.gi->device.getQueue(params.family, params.index);
+        _queueMutex                      = queueMutex(params.gi, params.family, params.index);
+        if (!_queueMutex) _queueMutex = &_ownQueueMutex;
+        if (params.descriptorSetCacheCapacity > 0) {
+            _descriptorCache = std::make_shared<DescriptorSetCache>(params.gi, owner.name(), params.descriptorSetCacheCapacity);
+        }
+        if (params.gi->timelineSemaphore) {
+            // Use one timeline semaphore to track all submissions. The value of the semaphore is the index of the last finished submission.
+            vk::SemaphoreTypeCreateInfo ti(vk::SemaphoreType::eTimeline, 0);
+            _timeline = params.gi->device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&ti), params.gi->allocator);
+        }
     }
 
-    ~Impl() { waitIdle(); }
+    ~Impl() {
+        {
+            auto lock   = std::lock_guard {_recordMutex};
+            _recordQuit = true;
+            _recordSignal.notify_all();
+        }
+        for (auto & t : _recorders) t.join();
+        waitIdle();
+        // Delete all command buffers before the shared pools.
+        _contexts.clear();
+        _descriptorCache.reset();
+        auto gi = _desc.gi;
+        gi->safeDestroy(_timeline);
+        for (auto & f : _fencePool) gi->safeDestroy(f);
+        _fencePool.clear();
+    }
 
     const Desc & desc() const { return _desc; }
 
     const std::string & name() const { return _owner.name(); }
 
-    CommandBuffer begin(const char * name, vk::CommandBufferLevel level) {
+    CommandBuffer begin(const char * name, vk::CommandBufferLevel level, const vk::CommandBufferInheritanceInfo * inheritance = nullptr) {
         if (!name || !*name) name = "<no-name>";
-        auto lock = std::lock_guard {_mutex};
-        auto p    = std::shared_ptr<CommandBuffer::Impl>();
-        if (_finished.empty()) {
-            p = std::make_unique<CommandBuffer::Impl>(_owner, name, level);
+        // Each thread allocates from its own context. So the lock is contended only when other threads are submitting, dropping or
+        // retiring command buffers of this thread at the same time.
+        auto tid  = std::this_thread::get_id();
+        auto ctx  = context(tid);
+        auto lock = std::unique_lock {ctx->mutex};
+        while (ctx->retired) {
+            // The context is reclaimed by another thread in the meantime. Start over with a new one.
+            lock.unlock();
+            ctx  = context(tid);
+            lock = std::unique_lock {ctx->mutex};
+        }
+        if (ctx->idle) {
+            ctx->idle = false;
+            _idleContexts.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (ctx->finished.empty() && _idleContexts.load(std::memory_order_relaxed) > 0) reclaim(*ctx);
+        auto shared = threadPool(*ctx);
+        auto p      = std::shared_ptr<CommandBuffer::Impl>();
+        if (ctx->finished.empty()) {
+            p = std::make_unique<CommandBuffer::Impl>(_owner, name, level, shared, _descriptorCache, inheritance);
         } else {
-            p = _finished.begin()->second;
-            _finished.erase(_finished.begin());
-            p->wakeup();
+            p = std::move(ctx->finished.back());
+            ctx->finished.pop_back();
+            p->wakeup(level, shared, inheritance);
         }
-        auto cb     = p.get();
-        _active[cb] = std::move(p);
+        auto cb         = p.get();
+        ctx->active[cb] = std::move(p);
+        ++ctx->outstanding;
         return cb;
     }
 
     SubmissionID submit(const SubmitParameters & sp) {
-        // remove duplicated command buffers
-        auto uniqueCommandBuffers = unique(sp.commandBuffers);
+        // The caller doesn't tell which stages depend on the semaphores. So all of them have to wait.
+        std::vector<SemaphoreSubmit> waits, signals;
+        for (auto s : sp.waitSemaphores) waits.push_back({s});
+        for (auto s : sp.signalSemaphores) signals.push_back({s});
+        return submitBatches(Batch {sp.commandBuffers, waits, signals, sp.waitSubmissions}, sp.signalFence).back();
+    }
+
+    SubmissionRange submitBatches(vk::ArrayProxy<const Batch> batches, vk::Fence signalFence) {
+        // Collect command buffers of each batch. Each batch is tracked by its own submission.
+        auto submissions = std::vector<std::unique_ptr<InternalSubmission>>();
+        auto infos       = std::vector<BatchInfo>(batches.size());
+        bool empty       = true;
+        for (uint32_t i = 0; i < batches.size(); ++i) {
+            const auto & b = batches.data()[i];
+            auto         s = std::make_unique<InternalSubmission>();
+            // remove duplicated command buffers
+            for (auto c : unique(b.commandBuffers)) {
+                auto p = promote(c);
+                if (!p) continue;
+                if (!p->end()) continue;
+                s->commandBuffers.push_back(p);
+            }
+            auto waits = submissionWaits(b.waitSubmissions, b.waitSubmissionStages);
+            if (!s->commandBuffers.empty() || !b.waitSemaphores.empty() || !b.signalSemaphores.empty() || !waits.empty()) empty = false;
+            infos[i].build(*_desc.gi, b, waits, s->commandBuffers, _timeline);
+            submissions.push_back(std::move(s));
+        }
+        if (empty) return {};
+
+        // Set fence of the last batch, which is signaled once all batches are finished. When timeline semaphore is available, the
+        // fence is only signaled for the caller, not used for tracking.
+        auto & last = *submissions.back();
+        last.fence  = signalFence;
+        if (!last.fence && !_timeline) {
+            last.fence    = acquireFence();
+            last.ownFence = true;
+        }
 
-        auto lock    = std::lock_guard {_mutex};
-        auto s       = std::make_unique<InternalSubmission>();
-        auto handles = std::vector<vk::CommandBuffer> {};
-        for (auto c : uniqueCommandBuffers) {
-            auto p = promote(c);
-            if (!p) continue;
-            if (!p->end()) continue;
-            s->commandBuffers.push_back(p);
-            handles.push_back(p->handle());
-        }
-        if (s->commandBuffers.empty()) return {};
-
-        // set submission index
-        s->index = ++_nextSubmissionId;
-        if (0 == s->index) s->index = ++_nextSubmissionId;
-
-        // set fence
-        s->fence = sp.signalFence;
-        if (!s->fence) {
-            s->builtInFence = _desc.gi->device.createFenceUnique({});
-            setVkHandleName(_desc.gi->device, s->builtInFence.get(), name());
-            s->fence = s->builtInFence.get();
-        }
-
-        // submit the command buffer
-        std::vector<vk::PipelineStageFlags> flags(sp.waitSemaphores.size(), vk::PipelineStageFlagBits::eBottomOfPipe);
-        vk::SubmitInfo                      si;
-        si.setWaitSemaphores(sp.waitSemaphores);
-        si.setSignalSemaphores(sp.signalSemaphores);
-        si.setCommandBuffers(handles);
-        si.setPWaitDstStageMask(flags.data());
-        _desc.handle.submit({si}, s->fence);
-
-        // Mark the command buffers as pending. remove them from the active list.
-        for (auto cb : s->commandBuffers) {
-            cb->setPending();
-            _active.erase(cb.get());
-        }
-
-        // going through the pending list in reverse order to find the first submission that is already finished the execution on GPU.
-        for (auto iter = _pending.rbegin(); iter != _pending.rend(); ++iter) {
-            auto status = _desc.gi->device.getFenceStatus((*iter)->fence);
-            if (vk::Result::eNotReady == status) continue; // the submission is still in progress.
-            finishSubmission(iter.base() - 1);
-            break;
+        // Mark the command buffers as pending. Remove them from the active lists. This has to be done before the submission is
+        // published, since the retiring thread could recycle them right after that.
+        for (const auto & s : submissions) {
+            for (const auto & cb : s->commandBuffers) {
+                cb->setPending();
+                // Submission marks the end of a frame of the recording thread. So the thread will switch to a new pool
+                // next time, leaving this one to be reset once all of its command buffers are retired.
+                deactivate(*cb, true);
+                for (const auto & c : cb->children()) seal(*c);
+            }
+        }
+
+        auto sync2 = _desc.gi->synchronization2;
+        auto si    = std::vector<vk::SubmitInfo>();
+        auto si2   = std::vector<vk::SubmitInfo2>();
+        for (const auto & i : infos) {
+            if (sync2)
+                si2.push_back(i.info2);
+            else
+                si.push_back(i.info);
+        }
+
+        // Hold the queue lock only for the submit call. Submission indices are allocated under the same lock, since the timeline
+        // semaphore has to be signaled with increasing values in submission order.
+        auto count = (int64_t) submissions.size();
+        auto first = int64_t(0);
+        try {
+            auto lock = std::lock_guard {*_queueMutex};
+            first     = _nextSubmissionId.load(std::memory_order_relaxed) + 1;
+            if (first <= 0 && first + count > 0) first = 1; // indices of one call are consecutive. And 0 means empty submission.
+            for (int64_t i = 0; i < count; ++i) {
+                submissions[(size_t) i]->index = first + i;
+                infos[(size_t) i].setTimelineValue((uint64_t) (first + i));
+            }
+            if (sync2)
+                _desc.handle.submit2(si2, last.fence);
+            else
+                _desc.handle.submit(si, last.fence);
+            for (auto & s : submissions) publish(s.release());
+            _nextSubmissionId.store(first + count - 1, std::memory_order_release);
+        } catch (...) {
+            for (const auto & s : submissions) {
+                for (const auto & cb : s->commandBuffers) recycle(cb);
+                if (s->ownFence) releaseFence(s->fence);
+            }
+            throw;
         }
 
-        // add to pending list
-        _pending.push_back(std::move(s));
+        // retire submissions that have already finished execution on GPU, unless another thread is doing it already.
+        auto lock = std::unique_lock {_retireMutex, std::try_to_lock};
+        if (lock) {
+            drain();
+            retire(completedIndex());
+        }
 
         // done
-        return {(intptr_t) &_owner, _nextSubmissionId};
+        return {(intptr_t) &_owner, first, (uint32_t) count};
     }
 
     void drop(const vk::ArrayProxy<const CommandBuffer> & commandBuffers) {
         // remove duplicated command buffers
         auto uniqueCommandBuffers = unique(commandBuffers);
 
-        auto lock = std::lock_guard {_mutex};
-        for (auto c : commandBuffers) {
+        for (auto c : uniqueCommandBuffers) {
             auto p = promote(c);
             if (!p) continue;
-            p->hibernate();
-            _active.erase(p.get());
-            _finished[p.get()] = p;
+            deactivate(*p, false);
+            recycle(p);
         }
     }
 
-    CommandQueue & wait(const vk::ArrayProxy<const SubmissionID> & submissions) {
-        if (submissions.empty()) return _owner;
+    /// End the secondary command buffer, and take it out of the active list. The caller is then responsible for
+    /// executing it and handing it back through the primary command buffer.
+    std::shared_ptr<CommandBuffer::Impl> adopt(const CommandBuffer & cb) {
+        auto p = promote(cb);
+        if (!p || !p->end()) return {};
+        deactivate(*p, false);
+        return p;
+    }
 
-        auto lock = std::lock_guard {_mutex};
+    /// Run job(i) for each i in [0, count) concurrently, one on the calling thread and the rest on the recording
+    /// threads. Returns when all of them are done. Rethrows the first exception thrown by the jobs.
+    void runParallel(uint32_t count, const std::function<void(uint32_t)> & job) {
+        if (0 == count) return;
+
+        struct Batch {
+            std::mutex              mutex;
+            std::condition_variable done;
+            uint32_t                remaining = 0;
+            std::exception_ptr      error;
+        } batch;
+        batch.remaining = count;
+
+        auto run = [&](uint32_t i) {
+            std::exception_ptr e;
+            try {
+                job(i);
+            } catch (...) { e = std::current_exception(); }
+            auto lock = std::lock_guard {batch.mutex};
+            if (e && !batch.error) batch.error = e;
+            if (0 == --batch.remaining) batch.done.notify_all();
+        };
+
+        if (count > 1) {
+            auto lock = std::lock_guard {_recordMutex};
+            // Start more recording threads on demand. They stay alive until the queue is destroyed.
+            while (_recorders.size() + 1 < count) _recorders.emplace_back([this] { record(); });
+            for (uint32_t i = 1; i < count; ++i) _recordJobs.push_back([&run, i] { run(i); });
+            _recordSignal.notify_all();
+        }
+        run(0);
 
-        // do nothing if pending list is empty.
-        if (_pending.empty()) return _owner;
+        auto lock = std::unique_lock {batch.mutex};
+        batch.done.wait(lock, [&] { return 0 == batch.remaining; });
+        if (batch.error) std::rethrow_exception(batch.error);
+    }
+
+    CommandQueue & wait(const vk::ArrayProxy<const SubmissionID> & submissions) {
+        if (submissions.empty()) return _owner;
 
         // if the submission array is not empty, then find the one with the largest index.
+        auto                   newest = _nextSubmissionId.load(std::memory_order_acquire);
         std::optional<int64_t> candidate;
         for (const auto & sid : submissions) {
             if (sid.queue != (int64_t) (intptr_t) &_owner) {
                 RVI_LOGE("Submission %" PRIi64 " is not from queue (%s)!", sid.index, name().c_str());
                 continue;
             }
-            auto oldest = _pending.front()->index;
-            if (sid.olderThan(oldest)) {
-                // the workload has finished already.
-                continue;
-            }
-            auto newest = _pending.back()->index;
             if (sid.newerThan(newest)) {
                 RVI_LOGE("Submission %" PRIi64 " is invalid since it is newer than the newest submission %" PRIi64 "!", sid.index, newest);
                 continue;
             }
 
-            // this is an valid pending submission.
+            // this is an valid submission. Waiting on one that has already finished returns immediately.
             if (!candidate.has_value()) {
                 candidate = sid.index;
             } else if (sid.newerThan(candidate.value())) {
@@ -2800,25 +4907,57 @@ public:
             return _owner;
         }
 
-        auto submission = findSubmission(candidate.value());
-        if (submission == _pending.end()) {
-            RVI_LOGE("Submission %" PRIi64 " is invalid since it is not found in the pending list!", (*submission)->index);
-            return _owner;
-        }
-
         // done
-        waitSubmission(submission);
+        waitSubmission(candidate.value());
         return _owner;
     }
 
     CommandQueue & waitIdle() {
-        auto lock = std::lock_guard {_mutex};
-        if (!_pending.empty()) waitSubmission(--_pending.end());
+        waitSubmission(_nextSubmissionId.load(std::memory_order_acquire));
         return _owner;
     }
 
+    bool finished(const SubmissionID & sid) {
+        if (sid.empty()) return true;
+        if (sid.queue != (int64_t) (intptr_t) &_owner) {
+            RVI_LOGE("Submission %" PRIi64 " is not from queue (%s)!", sid.index, name().c_str());
+            return false;
+        }
+
+        // Submissions on the same queue are finished in order. So one query is enough to retire everything up to this one.
+        if (_timeline) {
+            // The timeline semaphore answers the question without any lock. Retire the finished submissions too, unless another
+            // thread is doing it already.
+            auto completed = completedIndex();
+            auto lock      = std::unique_lock {_retireMutex, std::try_to_lock};
+            if (lock) {
+                drain();
+                retire(completed);
+            }
+            return !sid.newerThan(completed);
+        }
+
+        auto lock = std::lock_guard {_retireMutex};
+        drain();
+        if (_pending.empty() || sid.olderThan(_pending.front()->index)) return true;
+        retire(completedIndex());
+        return _pending.empty() || sid.olderThan(_pending.front()->index);
+    }
+
+    size_t pendingSubmissions() {
+        if (_timeline) {
+            // no lock is needed to query the timeline semaphore.
+            auto pending = _nextSubmissionId.load(std::memory_order_acquire) - completedIndex();
+            return pending > 0 ? (size_t) pending : 0;
+        }
+        auto lock = std::lock_guard {_retireMutex};
+        drain();
+        retire(completedIndex());
+        return _pending.size();
+    }
+
     void setName(const std::string & name) {
-        auto lock = std::lock_guard {_mutex};
+        auto lock = std::lock_guard {*_queueMutex};
         setVkHandleName(_desc.gi->device, _desc.handle, name.c_str());
     }
 
@@ -2827,68 +4966,380 @@ private:
         int64_t                                           index {};
         std::vector<std::shared_ptr<CommandBuffer::Impl>> commandBuffers {};
         vk::Fence                                         fence {};
-        vk::UniqueFence                                   builtInFence {};
+        bool                                              ownFence = false;   ///< true, if the fence is acquired from the fence pool.
+        InternalSubmission *                              next     = nullptr; ///< the previous submission in the published list.
     };
 
     typedef std::unordered_map<CommandBuffer::Impl *, std::shared_ptr<CommandBuffer::Impl>> CommandBufferMap;
-    typedef std::deque<std::shared_ptr<InternalSubmission>>                                 PendingList;
-    typedef PendingList::iterator                                                           PendingIterator;
+    typedef std::vector<std::shared_ptr<CommandBuffer::Impl>>                               CommandBufferList;
+    typedef std::deque<std::unique_ptr<InternalSubmission>>                                 PendingList;
+    typedef std::vector<std::shared_ptr<SharedCommandPool>>                                 SharedPoolList;
+
+    /// Command buffers and shared pools of one recording thread. Command buffers are always returned to the thread that began them.
+    /// So threads don't compete for the free list, or for the shared pools. Once all command buffers of a thread are retired, its
+    /// context is idle, and could be reclaimed by other threads (see reclaim()).
+    struct ThreadContext {
+        std::mutex                         mutex;
+        SharedPoolList                     pools;               ///< all shared command pools of the thread. Used only in pooled mode.
+        std::shared_ptr<SharedCommandPool> pool;                ///< current shared command pool of the thread. Used only in pooled mode.
+        CommandBufferMap                   active;              ///< Command buffers in recording state.
+        CommandBufferList                  finished;            ///< list of finished command buffers. ready for reuse.
+        size_t                             outstanding = 0;     ///< number of command buffers that are begun but not recycled yet.
+        bool                               idle        = false; ///< true, if all command buffers are recycled. Counted in _idleContexts.
+        bool                               retired     = false; ///< true, if the context is reclaimed and removed from the map.
+    };
+
+    typedef std::unordered_map<std::thread::id, std::shared_ptr<ThreadContext>> ContextMap;
+
+    /// Vulkan structures of one batch. Either the legacy ones or the synchronization2 ones are filled, depending on which API is used
+    /// to submit. The object can't be moved once built, since the structures point to its own members.
+    struct BatchInfo {
+        vk::SubmitInfo                           info;
+        vk::TimelineSemaphoreSubmitInfo          timeline;
+        std::vector<vk::Semaphore>               waits, signals;
+        std::vector<uint64_t>                    waitValues, signalValues;
+        std::vector<vk::PipelineStageFlags>      waitStages;
+        std::vector<vk::CommandBuffer>           commandBuffers;
+        vk::SubmitInfo2                          info2;
+        std::vector<vk::SemaphoreSubmitInfo>     waits2, signals2;
+        std::vector<vk::CommandBufferSubmitInfo> commandBuffers2;
+        uint64_t *                               timelineValue = nullptr; ///< where to store the value of the queue's timeline semaphore.
+
+        void build(const GlobalInfo & gi, const Batch & b, const std::vector<SemaphoreSubmit> & extraWaits, const CommandBufferList & cbs,
+                   vk::Semaphore queueTimeline) {
+            if (gi.synchronization2) {
+                for (const auto & w : b.waitSemaphores) waits2.emplace_back(w.semaphore, w.value, w.stages);
+                for (const auto & w : extraWaits) waits2.emplace_back(w.semaphore, w.value, w.stages);
+                for (const auto & s : b.signalSemaphores) signals2.emplace_back(s.semaphore, s.value, s.stages);
+                if (queueTimeline) signals2.emplace_back(queueTimeline, 0, vk::PipelineStageFlagBits2::eAllCommands);
+                for (const auto & c : cbs) commandBuffers2.emplace_back(c->handle());
+                info2.setWaitSemaphoreInfos(waits2).setSignalSemaphoreInfos(signals2).setCommandBufferInfos(commandBuffers2);
+                if (queueTimeline) timelineValue = &signals2.back().value;
+                return;
+            }
+            auto addWait = [&](const SemaphoreSubmit & w) {
+                waits.push_back(w.semaphore);
+                waitValues.push_back(w.value);
+                waitStages.push_back(toStageFlags(w.stages));
+            };
+            for (const auto & w : b.waitSemaphores) addWait(w);
+            for (const auto & w : extraWaits) addWait(w);
+            for (const auto & s : b.signalSemaphores) {
+                signals.push_back(s.semaphore);
+                signalValues.push_back(s.value);
+            }
+            if (queueTimeline) {
+                signals.push_back(queueTimeline);
+                signalValues.push_back(0);
+                timelineValue = &signalValues.back();
+            }
+            for (const auto & c : cbs) commandBuffers.push_back(c->handle());
+            info.setWaitSemaphores(waits).setPWaitDstStageMask(waitStages.data()).setSignalSemaphores(signals).setCommandBuffers(commandBuffers);
+            if (gi.timelineSemaphore) {
+                // values of binary semaphores are ignored.
+                timeline.setWaitSemaphoreValues(waitValues).setSignalSemaphoreValues(signalValues);
+                info.setPNext(&timeline);
+            }
+        }
+
+        void setTimelineValue(uint64_t value) {
+            if (timelineValue) *timelineValue = value;
+        }
+
+        /// Convert synchronization2 stages to the legacy ones. Stages that have no legacy counterpart are widened to all commands.
+        static vk::PipelineStageFlags toStageFlags(vk::PipelineStageFlags2 stages) {
+            auto bits = (VkPipelineStageFlags2) stages;
+            if (0 == bits) return vk::PipelineStageFlagBits::eBottomOfPipe; // the legacy equivalent of waiting for nothing.
+            if (bits >> 32) return vk::PipelineStageFlagBits::eAllCommands;
+            return vk::PipelineStageFlags((VkPipelineStageFlags) bits);
+        }
+    };
+
+    CommandQueue &                      _owner;
+    Desc                                _desc;
+    std::shared_mutex                   _contextMutex;
+    ContextMap                          _contexts;            ///< context of each recording thread. Created on the first call to begin().
+    std::atomic<size_t>                 _idleContexts {};     ///< number of contexts that have all command buffers recycled.
+    std::mutex                          _ownQueueMutex;       ///< used when the queue has no device wide lock.
+    std::mutex *                        _queueMutex {};       ///< guards the queue handle. Held only for the duration of the submit call.
+    std::atomic<int64_t>                _nextSubmissionId {}; ///< index of the newest submission.
+    std::atomic<InternalSubmission *>   _published {};        ///< submissions that are not moved to the pending list yet. Newest first.
+    std::mutex                          _retireMutex;         ///< guards the pending list.
+    PendingList                         _pending;             ///< Pending submission list.
+    vk::Semaphore                       _timeline {};         ///< timeline semaphore that tracks submissions. Null if timeline semaphore is not available.
+    std::mutex                          _fenceMutex;
+    std::vector<vk::Fence>              _fencePool {};        ///< recycled fences. Used only when timeline semaphore is not available.
+    std::shared_ptr<DescriptorSetCache> _descriptorCache;     ///< shared by all command buffers of the queue. Null if disabled.
+    std::vector<std::thread>            _recorders;           ///< threads that record secondary command buffers in parallel.
+    std::deque<std::function<void()>>   _recordJobs;
+    std::mutex                          _recordMutex;
+    std::condition_variable             _recordSignal;
+    bool                                _recordQuit = false;
+
+private:
+    static std::vector<CommandBuffer> unique(const vk::ArrayProxy<const CommandBuffer> & commandBuffers) {
+        std::vector<CommandBuffer> uniqueCommandBuffers;
+        uniqueCommandBuffers.reserve(commandBuffers.size());
+        std::unique_copy(commandBuffers.begin(), commandBuffers.end(), std::back_inserter(uniqueCommandBuffers));
+        return uniqueCommandBuffers;
+    }
+
+    /// Convert submissions to waits on the timeline semaphores of their queues. Only the newest submission of each queue needs to be
+    /// waited for, since the timeline value covers all submissions before it.
+    std::vector<SemaphoreSubmit> submissionWaits(vk::ArrayProxy<const SubmissionID> submissions, vk::PipelineStageFlags2 stages) {
+        std::vector<SemaphoreSubmit> waits;
+        for (const auto & sid : submissions) {
+            if (sid.empty()) continue;
+            auto q = ((CommandQueue *) (intptr_t) sid.queue)->_impl;
+            if (q->_desc.gi->device != _desc.gi->device) {
+                RVI_LOGE("Submission %" PRIi64 " is from queue (%s) of another device!", sid.index, q->name().c_str());
+                continue;
+            }
+            auto newest = q->_nextSubmissionId.load(std::memory_order_acquire);
+            if (sid.newerThan(newest)) {
+                RVI_LOGE("Submission %" PRIi64 " is invalid since it is newer than the newest submission %" PRIi64 " of queue (%s)!", sid.index, newest,
+                         q->name().c_str());
+                continue;
+            }
+            if (!q->_timeline) {
+                // There's no semaphore to wait for on GPU. Wait on CPU instead.
+                q->wait(sid);
+                continue;
+            }
+            auto iter = std::find_if(waits.begin(), waits.end(), [&](const auto & w) { return w.semaphore == q->_timeline; });
+            if (iter == waits.end())
+                waits.push_back({q->_timeline, stages, (uint64_t) sid.index});
+            else if (sid.newerThan((int64_t) iter->value))
+                iter->value = (uint64_t) sid.index;
+        }
+        return waits;
+    }
+
+    /// Returns the context of the thread. Returns null if the thread has no command buffer on this queue.
+    std::shared_ptr<ThreadContext> findContext(std::thread::id tid) {
+        auto lock = std::shared_lock {_contextMutex};
+        auto iter = _contexts.find(tid);
+        return iter != _contexts.end() ? iter->second : nullptr;
+    }
+
+    /// Returns the context of the thread. Create a new one, if there's none yet.
+    std::shared_ptr<ThreadContext> context(std::thread::id tid) {
+        if (auto ctx = findContext(tid)) return ctx;
+        auto   lock = std::lock_guard {_contextMutex};
+        auto & ctx  = _contexts[tid];
+        if (!ctx) ctx = std::make_shared<ThreadContext>();
+        return ctx;
+    }
+
+    /// Take over the finished command buffers and the shared pools of all idle contexts, then remove them. So the resources of threads
+    /// that stopped recording (or exited) are reused, instead of being stranded in the contexts forever. Requires the lock of ctx.
+    void reclaim(ThreadContext & ctx) {
+        auto lock = std::lock_guard {_contextMutex};
+        for (auto iter = _contexts.begin(); iter != _contexts.end();) {
+            // Keep the context alive until it is unlocked, since erasing it from the map might delete it.
+            auto other = iter->second;
+            // Skip contexts that are busy. Blocking here could dead lock with the owner, which might be reclaiming this one right now.
+            if (other.get() == &ctx || !other->mutex.try_lock()) {
+                ++iter;
+                continue;
+            }
+            auto otherLock = std::lock_guard {other->mutex, std::adopt_lock};
+            if (!other->idle) {
+                ++iter;
+                continue;
+            }
+            // All command buffers of the context are recycled. So none of its shared pools is in use anymore.
+            RVI_ASSERT(0 == other->outstanding && other->active.empty());
+            if (other->pool) seal(*other, other->pool);
+            for (auto & cb : other->finished) ctx.finished.push_back(std::move(cb));
+            for (auto & p : other->pools) ctx.pools.push_back(std::move(p));
+            other->finished.clear();
+            other->pools.clear();
+            other->idle    = false;
+            other->retired = true;
+            _idleContexts.fetch_sub(1, std::memory_order_relaxed);
+            iter = _contexts.erase(iter);
+        }
+    }
+
+    std::shared_ptr<CommandBuffer::Impl> promote(const CommandBuffer & cb) {
+        if (!cb) {
+            RVI_LOGE("Null command buffer.");
+            return {};
+        }
+        if (auto ctx = findContext(cb.impl()->thread())) {
+            auto lock = std::lock_guard {ctx->mutex};
+            auto it   = ctx->active.find(cb.impl());
+            if (it != ctx->active.end()) return it->second;
+        }
+        RVI_LOGE("Command buffer (%s) is not created by queue (%s).", cb.name().c_str(), name().c_str());
+        return {};
+    }
+
+    /// Remove the command buffer from the active list of its thread. Optionally, seal the shared pool it is allocated from.
+    void deactivate(const CommandBuffer::Impl & cb, bool sealPool) {
+        auto ctx  = context(cb.thread());
+        auto lock = std::lock_guard {ctx->mutex};
+        ctx->active.erase(const_cast<CommandBuffer::Impl *>(&cb));
+        if (sealPool && cb.shared()) seal(*ctx, cb.shared());
+    }
+
+    /// Seal the shared pool of the command buffer.
+    void seal(const CommandBuffer::Impl & cb) {
+        if (!cb.shared()) return;
+        auto ctx  = context(cb.thread());
+        auto lock = std::lock_guard {ctx->mutex};
+        seal(*ctx, cb.shared());
+    }
+
+    /// Get the shared command pool of the thread. Returns null if the queue is not in pooled mode.
+    std::shared_ptr<SharedCommandPool> threadPool(ThreadContext & ctx) {
+        if (!_desc.pooled) return {};
+        if (ctx.pool) return ctx.pool;
+        // Reuse an idle pool of the thread, if there's any. Or else, create a new one.
+        auto iter = std::find_if(ctx.pools.begin(), ctx.pools.end(), [](const auto & p) { return p->idle(); });
+        if (iter != ctx.pools.end()) {
+            ctx.pool = *iter;
+        } else {
+            ctx.pool = std::make_shared<SharedCommandPool>(_desc.gi, _desc.family);
+            setVkHandleName(_desc.gi->device, ctx.pool->handle, name());
+            ctx.pools.push_back(ctx.pool);
+        }
+        ctx.pool->sealed = false;
+        return ctx.pool;
+    }
+
+    /// Detach the shared pool from its recording thread.
+    static void seal(ThreadContext & ctx, const std::shared_ptr<SharedCommandPool> & pool) {
+        if (pool->sealed) return;
+        pool->sealed = true;
+        if (ctx.pool == pool) ctx.pool.reset();
+    }
+
+    vk::Fence acquireFence() {
+        {
+            auto lock = std::lock_guard {_fenceMutex};
+            if (!_fencePool.empty()) {
+                auto f = _fencePool.back();
+                _fencePool.pop_back();
+                return f;
+            }
+        }
+        auto f = _desc.gi->device.createFence({}, _desc.gi->allocator);
+        setVkHandleName(_desc.gi->device, f, name());
+        return f;
+    }
 
-    CommandQueue &   _owner;
-    std::mutex       _mutex;
-    CommandBufferMap _active;   ///< Command buffers in recording state.
-    PendingList      _pending;  ///< Pending submission list.
-    CommandBufferMap _finished; ///< list of finished command buffers. ready for reuse.
-    Desc             _desc;
-    int64_t          _nextSubmissionId {};
+    void releaseFence(vk::Fence f) {
+        _desc.gi->device.resetFences({f});
+        auto lock = std::lock_guard {_fenceMutex};
+        _fencePool.push_back(f);
+    }
 
-private:
-    static std::vector<CommandBuffer> unique(const vk::ArrayProxy<const CommandBuffer> & commandBuffers) {
-        std::vector<CommandBuffer> uniqueCommandBuffers;
-        uniqueCommandBuffers.reserve(commandBuffers.size());
-        std::unique_copy(commandBuffers.begin(), commandBuffers.end(), std::back_inserter(uniqueCommandBuffers));
-        return uniqueCommandBuffers;
+    /// Publish a new submission to the retiring thread. This is lock free, so it never waits on the thread that is retiring.
+    void publish(InternalSubmission * s) {
+        s->next = _published.load(std::memory_order_relaxed);
+        while (!_published.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {}
     }
 
-    std::shared_ptr<CommandBuffer::Impl> promote(const CommandBuffer & cb, bool expectedNull = false) const {
-        if (!cb) {
-            if (!expectedNull) RVI_LOGE("Null command buffer.");
-            return {};
+    /// Move all published submissions to the end of the pending list. Requires the retire lock.
+    void drain() {
+        auto first = _pending.size();
+        for (auto s = _published.exchange(nullptr, std::memory_order_acquire); s;) {
+            auto next = s->next;
+            _pending.emplace_back(s);
+            s = next;
         }
-        auto it = _active.find(cb.impl());
-        if (it == _active.end()) {
-            if (!expectedNull) RVI_LOGE("Command buffer (%s) is not created by queue (%s).", cb.name().c_str(), name().c_str());
-            return {};
+        // The published list is in reverse submission order.
+        std::reverse(_pending.begin() + (ptrdiff_t) first, _pending.end());
+    }
+
+    /// Returns the pending submission of the specified index. Submission indices in the pending list are consecutive.
+    /// So no search is needed. Requires the retire lock.
+    InternalSubmission & pendingSubmission(int64_t index) {
+        RVI_ASSERT(!_pending.empty());
+        auto offset = index - _pending.front()->index;
+        RVI_ASSERT(0 <= offset && offset < (int64_t) _pending.size());
+        return *_pending[(size_t) offset];
+    }
+
+    /// Returns index of the newest submission that is known to be finished on GPU. Requires the retire lock, when timeline semaphore is
+    /// not available.
+    int64_t completedIndex() {
+        if (_timeline) return (int64_t) _desc.gi->device.getSemaphoreCounterValue(_timeline);
+        if (_pending.empty()) return _nextSubmissionId.load(std::memory_order_acquire);
+        // Check fences in submission order. Stop at the first one that is still in progress. Batches of one call share the fence of
+        // the last batch. So they are known to be finished only when the last one is.
+        auto completed = _pending.front()->index - 1;
+        for (const auto & s : _pending) {
+            if (!s->fence) continue;
+            if (vk::Result::eNotReady == _desc.gi->device.getFenceStatus(s->fence)) break;
+            completed = s->index;
         }
-        return it->second;
+        return completed;
     }
 
-    PendingIterator findSubmission(int64_t index) {
-        return std::find_if(_pending.begin(), _pending.end(), [index](const auto & s) { return s->index == index; });
-    }
-
-    void waitSubmission(PendingIterator iter) {
-        RVI_ASSERT(iter != _pending.end());
-        const auto & submission = **iter;
-        RVI_ASSERT(submission.fence);
-        auto result = _desc.gi->device.waitForFences(1, &submission.fence, true, UINT64_MAX);
+    void waitSubmission(int64_t index) {
+        auto result = vk::Result::eSuccess;
+        if (_timeline) {
+            // Wait without holding any lock. So other threads can keep submitting and retiring in the meantime.
+            auto value = (uint64_t) index;
+            result     = _desc.gi->device.waitSemaphores(vk::SemaphoreWaitInfo().setSemaphores(_timeline).setValues(value), UINT64_MAX);
+        }
+        auto lock = std::lock_guard {_retireMutex};
+        drain();
+        if (!_timeline && !_pending.empty() && index - _pending.front()->index >= 0) {
+            // Batches of one call share the fence of the last batch.
+            auto submission = &pendingSubmission(index);
+            for (auto i = index; !submission->fence;) submission = &pendingSubmission(++i);
+            result = _desc.gi->device.waitForFences(1, &submission->fence, true, UINT64_MAX);
+        }
         if (result != vk::Result::eSuccess) {
-            RVI_LOGE("Submission %" PRIi64 " failed to wait for finish: %s", submission.index, vk::to_string(result).c_str());
+            RVI_LOGE("Submission %" PRIi64 " failed to wait for finish: %s", index, vk::to_string(result).c_str());
+        }
+        retire(index);
+    }
+
+    /// Hibernate the command buffer, along with its secondary command buffers, and return them to the free list of the threads that
+    /// began them.
+    void recycle(const std::shared_ptr<CommandBuffer::Impl> & cb) {
+        for (const auto & c : cb->takeChildren()) recycle(c);
+        // The lock also protects the shared pool, which the thread might be checking for idleness at the same time.
+        auto ctx  = context(cb->thread());
+        auto lock = std::lock_guard {ctx->mutex};
+        cb->hibernate();
+        ctx->finished.push_back(cb);
+        RVI_ASSERT(ctx->outstanding > 0);
+        if (0 == --ctx->outstanding) {
+            ctx->idle = true;
+            _idleContexts.fetch_add(1, std::memory_order_relaxed);
         }
-        finishSubmission(iter);
     }
 
-    void finishSubmission(PendingIterator iter) {
-        // Move all finished command buffers from pending list to finished list
-        RVI_ASSERT(iter != _pending.end());
-        ++iter;
-        for (auto s = _pending.begin(); s != iter; ++s) {
-            for (auto cb : (*s)->commandBuffers) {
-                cb->hibernate();
-                _finished[cb.get()] = cb;
+    /// Main loop of the recording threads.
+    void record() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                auto lock = std::unique_lock {_recordMutex};
+                _recordSignal.wait(lock, [&] { return _recordQuit || !_recordJobs.empty(); });
+                if (_recordQuit) return;
+                job = std::move(_recordJobs.front());
+                _recordJobs.pop_front();
             }
+            job();
+        }
+    }
+
+    /// Move command buffers of all submissions up to (and including) the specified index from pending list to the free lists.
+    /// Requires the retire lock.
+    void retire(int64_t index) {
+        while (!_pending.empty() && index - _pending.front()->index >= 0) {
+            auto & s = *_pending.front();
+            for (const auto & cb : s.commandBuffers) recycle(cb);
+            if (s.ownFence) releaseFence(s.fence);
+            _pending.pop_front();
         }
-        _pending.erase(_pending.begin(), iter);
     }
 
     // void finish(CommandBuffer * p) {
@@ -2927,6 +5378,55 @@ private:
     // }
 };
 
+// Defined here, since it depends on CommandQueue::Impl.
+void CommandBuffer::Impl::renderParallel(const ParallelRenderParameters & params) {
+    if (RECORDING != _state || vk::CommandBufferLevel::ePrimary != _level) {
+        RVI_LOGE("Failed to render in parallel: command buffer %s is not a primary command buffer in RECORDING state!", _name.c_str());
+        return;
+    }
+    auto total = params.packs.size();
+    if (0 == total) return;
+
+    // Split the packs into evenly sized chunks. One secondary command buffer for each.
+    auto threads   = params.threads ? params.threads : std::max(1u, std::thread::hardware_concurrency());
+    auto perThread = std::max(1u, params.minPacksPerThread);
+    auto chunks    = std::max(1u, std::min(threads, (total + perThread - 1) / perThread));
+
+    auto inheritance = vk::CommandBufferInheritanceInfo(params.renderPass, params.subpass, params.framebuffer);
+    auto secondaries = std::vector<CommandBuffer>(chunks);
+    auto & queue     = *_queue._impl;
+    try {
+        queue.runParallel(chunks, [&](uint32_t i) {
+            auto first     = (uint32_t) ((uint64_t) total * i / chunks);
+            auto last      = (uint32_t) ((uint64_t) total * (i + 1) / chunks);
+            auto cb        = queue.begin(_name.c_str(), vk::CommandBufferLevel::eSecondary, &inheritance);
+            secondaries[i] = cb;
+            if (!params.viewports.empty()) cb.handle().setViewport(0, params.viewports);
+            if (!params.scissors.empty()) cb.handle().setScissor(0, params.scissors);
+            cb.render(vk::ArrayProxy<const Ref<const DrawPack>>(last - first, params.packs.data() + first));
+        });
+    } catch (...) {
+        // Don't leave the half recorded secondary command buffers in the queue.
+        secondaries.erase(std::remove(secondaries.begin(), secondaries.end(), CommandBuffer()), secondaries.end());
+        queue.drop(secondaries);
+        throw;
+    }
+
+    // Execute the secondary command buffers in order. They are recycled along with this one.
+    std::vector<vk::CommandBuffer> handles;
+    handles.reserve(chunks);
+    for (const auto & cb : secondaries) {
+        auto p = queue.adopt(cb);
+        if (!p) continue;
+        handles.push_back(p->handle());
+        _children.push_back(std::move(p));
+    }
+    if (!handles.empty()) _handle.executeCommands(handles);
+
+    // States bound by the secondary command buffers don't carry over to the primary one.
+    invalidateState();
+}
+
 CommandQueue::CommandQueue(const ConstructParameters & params): Root(params), _impl(new Impl(*this, params)) { _impl->setName(name()); }
 CommandQueue::~CommandQueue() {
     delete _impl;
@@ -2934,12 +5434,501 @@ CommandQueue::~CommandQueue() {
 }
 auto CommandQueue::desc() const -> const Desc & { return _impl->desc(); }
 auto CommandQueue::begin(const char * purpose, vk::CommandBufferLevel level) -> CommandBuffer { return _impl->begin(purpose, level); }
+auto CommandQueue::begin(const char * purpose, const vk::CommandBufferInheritanceInfo & inheritance) -> CommandBuffer {
+    return _impl->begin(purpose, vk::CommandBufferLevel::eSecondary, &inheritance);
+}
 auto CommandQueue::submit(const SubmitParameters & sp) -> SubmissionID { return _impl->submit(sp); }
+auto CommandQueue::submitBatches(vk::ArrayProxy<const Batch> batches, vk::Fence signalFence) -> SubmissionRange {
+    return _impl->submitBatches(batches, signalFence);
+}
 void CommandQueue::drop(vk::ArrayProxy<const CommandBuffer> commandBuffers) { _impl->drop(commandBuffers); }
 auto CommandQueue::wait(const vk::ArrayProxy<const SubmissionID> & s) -> CommandQueue & { return _impl->wait(s); }
 auto CommandQueue::waitIdle() -> CommandQueue & { return _impl->waitIdle(); }
+auto CommandQueue::pendingSubmissions() -> size_t { return _impl->pendingSubmissions(); }
+auto CommandQueue::submissionWaits(vk::ArrayProxy<const SubmissionID> s, vk::PipelineStageFlags2 stages) -> std::vector<SemaphoreSubmit> {
+    return _impl->submissionWaits(s, stages);
+}
+bool CommandQueue::finished(const SubmissionID & s) { return _impl->finished(s); }
 void CommandQueue::onNameChanged(const std::string &) { _impl->setName(name()); }
 
+// *********************************************************************************************************************
+// Staging Ring
+// *********************************************************************************************************************
+
+class StagingRing::Impl {
+public:
+    Impl(StagingRing & owner, const ConstructParameters & cp): _owner(owner), _gi(cp.gi) {
+        RVI_REQUIRE(cp.gi);
+        RVI_REQUIRE(cp.capacity > 0);
+        _buffer = Ref<Buffer>::make(Buffer::ConstructParameters {{owner.name()}, _gi, cp.capacity}.setStaging());
+        auto m  = _buffer->map({});
+        RVI_REQUIRE(m.data, "Failed to map staging ring %s.", owner.name().c_str());
+        _data     = m.data;
+        _capacity = cp.capacity;
+    }
+
+    ~Impl() {
+        // Wait for all pending uploads to finish, before deleting the private queues. The shared queues might be alive for much longer.
+        for (const auto & b : _blocks)
+            if (b.released) b.sid.wait();
+        for (const auto & d : _dedicated) d.sid.wait();
+        _queues.clear();
+        _privateQueues.clear();
+        if (!_blocks.empty()) RVI_LOGW("Staging ring %s is destroyed with %zu allocations outstanding.", _owner.name().c_str(), _blocks.size());
+        _blocks.clear();
+        _dedicated.clear();
+        if (_buffer) _buffer->unmap();
+        _buffer.clear();
+    }
+
+    auto capacity() const -> vk::DeviceSize { return _capacity; }
+
+    Allocation allocate(vk::DeviceSize size, vk::DeviceSize alignment) {
+        if (0 == size) return {};
+        if (0 == alignment) alignment = 1;
+
+        auto lock = std::unique_lock {_mutex};
+        reclaim();
+        for (;;) {
+            auto offset = findSpace(size, alignment);
+            if (INVALID_OFFSET != offset) {
+                auto id = ++_nextBlockId;
+                _blocks.push_back({id, offset, offset + size, {}, false});
+                return {_buffer->handle(), offset, size, _data + offset, id, {}};
+            }
+
+            // The ring is full. If the oldest allocation is already submitted, wait for it to finish and try again.
+            // Otherwise, fall back to dedicated staging buffer. The wait is done w/o holding the lock, so other threads
+            // can keep using the ring in the mean time.
+            if (size > _capacity || _blocks.empty() || !_blocks.front().released) break;
+            auto sid = _blocks.front().sid;
+            lock.unlock();
+            sid.wait();
+            lock.lock();
+            reclaim();
+        }
+
+        RVI_LOGD("Staging ring %s is out of space. Allocate dedicated staging buffer of %zu bytes.", _owner.name().c_str(), (size_t) size);
+        auto dedicated = Ref<Buffer>::make(Buffer::ConstructParameters {{_owner.name()}, _gi, size}.setStaging());
+        auto m         = dedicated->map({});
+        RVI_REQUIRE(m.data, "Failed to map dedicated staging buffer.");
+        return {dedicated->handle(), 0, size, m.data, -1, dedicated};
+    }
+
+    void release(const Allocation & a, const CommandQueue::SubmissionID & sid) {
+        if (a.empty()) return;
+        auto lock = std::lock_guard {_mutex};
+        if (a.dedicated) {
+            a.dedicated->unmap();
+            _dedicated.push_back({a.dedicated, sid});
+            return;
+        }
+        if (_blocks.empty() || a.id < _blocks.front().id || a.id > _blocks.back().id) {
+            RVI_LOGE("Allocation %" PRIi64 " does not belong to staging ring %s.", a.id, _owner.name().c_str());
+            return;
+        }
+        // Block IDs are contiguous. So we can locate the block directly.
+        auto & b = _blocks[(size_t) (a.id - _blocks.front().id)];
+        RVI_ASSERT(b.id == a.id);
+        RVI_ASSERT(!b.released);
+        b.sid      = sid;
+        b.released = true;
+    }
+
+    void setQueue(CommandQueue & q) {
+        auto lock                        = std::lock_guard {_mutex};
+        _queues[{q.family(), q.index()}] = &q;
+    }
+
+    CommandQueue & queue(uint32_t family, uint32_t index) {
+        auto   lock = std::lock_guard {_mutex};
+        auto & q    = _queues[{family, index}];
+        if (!q) {
+            RVI_LOGD("Staging ring %s creates private queue for family %u, index %u.", _owner.name().c_str(), family, index);
+            _privateQueues.emplace_back(new CommandQueue({{_owner.name()}, _gi, family, index}));
+            q = _privateQueues.back().get();
+        }
+        return *q;
+    }
+
+private:
+    struct Block {
+        int64_t                    id {};
+        vk::DeviceSize             begin {};
+        vk::DeviceSize             end {};
+        CommandQueue::SubmissionID sid {};
+        bool                       released {};
+    };
+
+    struct Dedicated {
+        Ref<Buffer>                buffer;
+        CommandQueue::SubmissionID sid {};
+    };
+
+    typedef std::map<std::pair<uint32_t, uint32_t>, CommandQueue *> QueueMap;
+    typedef std::vector<std::unique_ptr<CommandQueue>>              QueueList;
+
+    static constexpr vk::DeviceSize INVALID_OFFSET = vk::DeviceSize(-1);
+
+    StagingRing &        _owner;
+    const GlobalInfo *   _gi {};
+    Ref<Buffer>          _buffer;
+    uint8_t *            _data {};
+    vk::DeviceSize       _capacity {};
+    std::deque<Block>    _blocks; ///< allocations in allocation order.
+    std::list<Dedicated> _dedicated;
+    int64_t              _nextBlockId {};
+    QueueMap             _queues; ///< queues used to submit uploads. Either shared with the owner of the ring, or private ones.
+    QueueList            _privateQueues;
+    std::mutex           _mutex;
+
+private:
+    static vk::DeviceSize alignUp(vk::DeviceSize offset, vk::DeviceSize alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+    /// Find free space in the ring. Returns INVALID_OFFSET if there's not enough space.
+    vk::DeviceSize findSpace(vk::DeviceSize size, vk::DeviceSize alignment) const {
+        if (size > _capacity) return INVALID_OFFSET;
+        if (_blocks.empty()) return 0;
+        auto tail = _blocks.front().begin;
+        auto head = alignUp(_blocks.back().end, alignment);
+        if (_blocks.back().end > tail) {
+            // Used space is [tail, head). Try the end of the ring first, then wrap around to the beginning.
+            if (head + size <= _capacity) return head;
+            if (size <= tail) return 0;
+        } else {
+            // Used space is wrapped around. Free space is [head, tail).
+            if (head + size <= tail) return head;
+        }
+        return INVALID_OFFSET;
+    }
+
+    /// Recycle allocations that are finished on GPU. The ring memory is always recycled in allocation order.
+    void reclaim() {
+        while (!_blocks.empty()) {
+            const auto & b = _blocks.front();
+            if (!b.released || !b.sid.finished()) break;
+            _blocks.pop_front();
+        }
+        for (auto iter = _dedicated.begin(); iter != _dedicated.end();) {
+            if (iter->sid.finished()) {
+                iter = _dedicated.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+};
+
+StagingRing::StagingRing(const ConstructParameters & cp): Root(cp) { _impl = new Impl(*this, cp); }
+StagingRing::~StagingRing() {
+    delete _impl;
+    _impl = nullptr;
+}
+auto StagingRing::capacity() const -> vk::DeviceSize { return _impl->capacity(); }
+auto StagingRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment) -> Allocation { return _impl->allocate(size, alignment); }
+void StagingRing::release(const Allocation & a, const CommandQueue::SubmissionID & sid) { _impl->release(a, sid); }
+void StagingRing::setQueue(CommandQueue & q) { _impl->setQueue(q); }
+auto StagingRing::queue(uint32_t family, uint32_t index) -> CommandQueue & { return _impl->queue(family, index); }
+
+// *********************************************************************************************************************
+// Upload Batch
+// *********************************************************************************************************************
+
+class UploadBatch::Impl {
+public:
+    Impl(UploadBatch & owner, const ConstructParameters & cp): _owner(owner), _queue(cp.queue) {
+        RVI_REQUIRE(cp.queue);
+        _ring = _queue->gi()->stagingRing;
+        if (!_ring) {
+            // The device has no staging ring. So create a private one.
+            _privateRing.reset(new StagingRing({{owner.name()}, _queue->gi()}));
+            _ring = _privateRing.get();
+        }
+    }
+
+    ~Impl() {
+        auto lock = std::lock_guard {_mutex};
+        if (_cb) _queue->drop({_cb});
+        for (const auto & a : _allocations) _ring->release(a);
+        _allocations.clear();
+        // Private ring can't be released until GPU is done with it.
+        if (_privateRing) _last.wait();
+    }
+
+    void setContent(const Buffer & buffer, const Buffer::SetContentParameters & params) {
+        const auto & desc      = buffer.desc();
+        auto         dstOffset = params.offset;
+        auto         size      = params.size;
+        auto         srcOffset = clampRange(dstOffset, size, desc.size);
+        if (0 == size) return;
+        if (!params.data) {
+            RVI_LOGE("Can't set buffer content: data pointer is null.");
+            return;
+        }
+
+        auto lock = std::lock_guard {_mutex};
+        auto cb   = commandBuffer();
+        if (!cb) return;
+        auto staging = stage((const uint8_t *) params.data + srcOffset, size, 16);
+        cb.copyBuffer(staging.buffer, desc.handle, {{staging.offset, dstOffset, size}});
+    }
+
+    void setContent(const Image & image, const Image::SetContentParameters & params) {
+        ImageUpload upload;
+        if (!upload.prepare(image.desc(), params)) return;
+
+        auto lock = std::lock_guard {_mutex};
+        auto cb   = commandBuffer();
+        if (!cb) return;
+        auto staging = stage(upload.pixels, upload.size, upload.alignment);
+        upload.cmdCopy(cb, image.desc().handle, staging.buffer, staging.offset);
+    }
+
+    size_t pending() const {
+        auto lock = std::lock_guard {_mutex};
+        return _allocations.size();
+    }
+
+    CommandQueue::SubmissionID submit() {
+        auto lock = std::lock_guard {_mutex};
+        if (!_cb) return {};
+
+        // Make the uploaded content visible to all commands after this submission.
+        Barrier {}
+            .s(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands)
+            .m(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite)
+            .cmdWrite(_cb);
+
+        auto sid = _queue->submit({{_cb}});
+        for (const auto & a : _allocations) _ring->release(a, sid);
+        _allocations.clear();
+        _cb = {};
+        if (sid) _last = sid;
+        return sid;
+    }
+
+private:
+    UploadBatch &                        _owner;
+    CommandQueue *                       _queue {};
+    StagingRing *                        _ring {};
+    std::unique_ptr<StagingRing>         _privateRing;
+    CommandBuffer                        _cb;          ///< the command buffer that is currently recording.
+    std::vector<StagingRing::Allocation> _allocations; ///< staging memory used by current command buffer.
+    CommandQueue::SubmissionID           _last {};     ///< the last submission of the batch.
+    mutable std::mutex                   _mutex;
+
+private:
+    /// Get the command buffer that is currently recording. Begin a new one if there's none.
+    vk::CommandBuffer commandBuffer() {
+        if (!_cb) {
+            _cb = _queue->begin(_owner.name().c_str());
+            if (!_cb) return {};
+            // Wait for all previous commands on the queue, since the uploads might overwrite resources that are still in use.
+            Barrier {}
+                .s(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer)
+                .m(vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferWrite)
+                .cmdWrite(_cb);
+        }
+        return _cb;
+    }
+
+    /// Copy data into staging memory.
+    const StagingRing::Allocation & stage(const void * data, vk::DeviceSize size, vk::DeviceSize alignment) {
+        _allocations.push_back(_ring->allocate(size, alignment));
+        const auto & a = _allocations.back();
+        RVI_ASSERT(a.data);
+        memcpy(a.data, data, size);
+        return a;
+    }
+};
+
+UploadBatch::UploadBatch(const ConstructParameters & cp): Root(cp) { _impl = new Impl(*this, cp); }
+UploadBatch::~UploadBatch() {
+    delete _impl;
+    _impl = nullptr;
+}
+auto UploadBatch::setContent(const Buffer & b, const Buffer::SetContentParameters & p) -> UploadBatch & {
+    _impl->setContent(b, p);
+    return *this;
+}
+auto UploadBatch::setContent(const Image & i, const Image::SetContentParameters & p) -> UploadBatch & {
+    _impl->setContent(i, p);
+    return *this;
+}
+auto UploadBatch::pending() const -> size_t { return _impl->pending(); }
+auto UploadBatch::submit() -> CommandQueue::SubmissionID { return _impl->submit(); }
+
+// *********************************************************************************************************************
+// Readback Pool
+// *********************************************************************************************************************
+
+class ReadbackPool::Impl {
+public:
+    Impl(ReadbackPool & owner, const ConstructParameters & cp): _owner(owner), _gi(cp.gi) {
+        RVI_REQUIRE(cp.gi);
+        // Prefer host cached memory, since CPU reads from uncached memory are slow.
+        _memory             = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+        auto cached         = _memory | vk::MemoryPropertyFlagBits::eHostCached;
+        auto memoryProperty = _gi->physical.getMemoryProperties();
+        for (uint32_t i = 0; i < memoryProperty.memoryTypeCount; ++i) {
+            if ((memoryProperty.memoryTypes[i].propertyFlags & cached) == cached) {
+                _memory = cached;
+                break;
+            }
+        }
+        _freeList = std::make_shared<FreeList>();
+    }
+
+    Readback cmdRead(vk::CommandBuffer cb, const Buffer & buffer, vk::DeviceSize offset, vk::DeviceSize size) {
+        if (!cb) return {};
+        const auto & desc = buffer.desc();
+        clampRange(offset, size, desc.size);
+        if (0 == size) return {};
+
+        auto rb = acquire(size);
+        if (rb.empty()) return {};
+        auto slot = (Slot *) rb.slot.get();
+        Barrier {}
+            .s(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer)
+            .b(desc.handle, vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead, offset, size)
+            .cmdWrite(cb);
+        cb.copyBuffer(desc.handle, slot->entry.buffer->handle(), {{offset, 0, size}});
+        cmdMakeHostVisible(cb);
+        return rb;
+    }
+
+    Readback cmdRead(vk::CommandBuffer cb, const Image & image, const Image::ReadContentParameters & params) {
+        if (!cb) return {};
+        ImageReadback readback;
+        if (!readback.prepare(image.desc(), params)) return {};
+
+        auto rb = acquire(readback.size);
+        if (rb.empty()) return {};
+        auto slot = (Slot *) rb.slot.get();
+        readback.cmdCopy(cb, image.desc().handle, params.layout, slot->entry.buffer->handle(), 0);
+        cmdMakeHostVisible(cb);
+        rb.subresources = std::move(readback.subresources);
+        return rb;
+    }
+
+private:
+    /// A persistently mapped readback buffer.
+    struct Entry {
+        Ref<Buffer> buffer;
+        uint8_t *   mapped = nullptr;
+    };
+
+    /// Idle readback buffers, sorted by size. It is shared with all outstanding slots, so it outlives the pool if needed.
+    struct FreeList {
+        std::mutex                                              mutex;
+        std::multimap<vk::DeviceSize, Entry>                    entries;
+        std::list<std::pair<CommandQueue::SubmissionID, Entry>> retired; ///< released buffers that GPU might still be writing to.
+
+        ~FreeList() {
+            for (auto & e : entries) e.second.buffer->unmap();
+            for (auto & r : retired) r.second.buffer->unmap();
+        }
+
+        /// Move retired buffers, whose submissions are finished, to the free list. Requires the lock.
+        void reclaim() {
+            for (auto iter = retired.begin(); iter != retired.end();) {
+                if (iter->first.finished()) {
+                    entries.emplace(iter->second.buffer->desc().size, iter->second);
+                    iter = retired.erase(iter);
+                } else {
+                    ++iter;
+                }
+            }
+        }
+    };
+
+    /// A readback buffer that is currently in use. It retires the buffer to the free list when destroyed.
+    struct Slot {
+        Entry                      entry;
+        std::shared_ptr<FreeList>  list;
+        CommandQueue::SubmissionID submission {}; ///< the submission that writes to the buffer.
+
+        ~Slot() {
+            if (submission.empty()) {
+                // The copy commands are recorded, but we don't know if and when they are executed. So the buffer
+                // can't be handed out again.
+                entry.buffer->unmap();
+                return;
+            }
+            auto lock = std::lock_guard {list->mutex};
+            list->retired.emplace_back(submission, entry);
+        }
+    };
+
+    friend struct ReadbackPool::Readback;
+
+    ReadbackPool &            _owner;
+    const GlobalInfo *        _gi {};
+    vk::MemoryPropertyFlags   _memory {};
+    std::shared_ptr<FreeList> _freeList;
+
+private:
+    Readback acquire(vk::DeviceSize size) {
+        Entry entry;
+        {
+            auto lock = std::lock_guard {_freeList->mutex};
+            _freeList->reclaim();
+            auto iter = _freeList->entries.lower_bound(size);
+            if (iter != _freeList->entries.end()) {
+                entry = iter->second;
+                _freeList->entries.erase(iter);
+            }
+        }
+        if (!entry.buffer) {
+            // Round up to power of 2, to improve the chance of reuse.
+            vk::DeviceSize capacity = MIN_BUFFER_SIZE;
+            while (capacity < size) capacity *= 2;
+            auto bcp = Buffer::ConstructParameters {{_owner.name()}, _gi, capacity}.setUsage(vk::BufferUsageFlagBits::eTransferDst);
+            bcp.memory   = _memory;
+            entry.buffer = Ref<Buffer>::make(bcp);
+            // The buffer is persistently mapped. It is unmapped when the free list is destroyed.
+            entry.mapped = entry.buffer->map({}).data;
+            if (!entry.mapped) {
+                RVI_LOGE("Failed to map readback buffer of %s.", _owner.name().c_str());
+                return {};
+            }
+        }
+        Readback rb;
+        rb.mapped = entry.mapped;
+        rb.size   = size;
+        rb.slot   = std::shared_ptr<Slot>(new Slot {entry, _freeList});
+        return rb;
+    }
+
+    static void cmdMakeHostVisible(vk::CommandBuffer cb) {
+        Barrier {}
+            .s(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost)
+            .m(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead)
+            .cmdWrite(cb);
+    }
+
+    static constexpr vk::DeviceSize MIN_BUFFER_SIZE = 64 * 1024;
+};
+
+auto ReadbackPool::Readback::setSubmission(const CommandQueue::SubmissionID & s) -> Readback & {
+    if (slot) ((Impl::Slot *) slot.get())->submission = s;
+    return *this;
+}
+
+auto ReadbackPool::Readback::submission() const -> CommandQueue::SubmissionID {
+    return slot ? ((const Impl::Slot *) slot.get())->submission : CommandQueue::SubmissionID {};
+}
+
+ReadbackPool::ReadbackPool(const ConstructParameters & cp): Root(cp) { _impl = new Impl(*this, cp); }
+ReadbackPool::~ReadbackPool() {
+    delete _impl;
+    _impl = nullptr;
+}
+auto ReadbackPool::cmdRead(vk::CommandBuffer cb, const Buffer & b, vk::DeviceSize offset, vk::DeviceSize size) -> Readback {
+    return _impl->cmdRead(cb, b, offset, size);
+}
+auto ReadbackPool::cmdRead(vk::CommandBuffer cb, const Image & i, const Image::ReadContentParameters & p) -> Readback { return _impl->cmdRead(cb, i, p); }
+
 // *********************************************************************************************************************
 // Swapchain
 // *********************************************************************************************************************
@@ -3000,7 +5989,8 @@ public:
         cb.setScissor(0, 1, &scissor);
 
         std::array cv = {vk::ClearValue().setColor(params.clearColor), vk::ClearValue().setDepthStencil(params.clearDepth)};
-        _renderPass->cmdBegin(cb, vk::RenderPassBeginInfo {{}, bb->framebuffer, vk::Rect2D({0, 0}, {extent.width, extent.height})}.setClearValues(cv));
+        _renderPass->cmdBegin(cb, vk::RenderPassBeginInfo {{}, bb->framebuffer, vk::Rect2D({0, 0}, {extent.width, extent.height})}.setClearValues(cv),
+                              params.contents);
     }
 
     void cmdEndBuiltInRenderPass(vk::CommandBuffer cb) {
@@ -3086,7 +6076,12 @@ public:
                                        .setPImageIndices(&frame.imageIndex)
                                        .setWaitSemaphoreCount(1)
                                        .setPWaitSemaphores(&bb->frameEndSemaphore);
-                auto result = _presentQueue.presentKHR(&presentInfo);
+                auto result = vk::Result::eSuccess;
+                {
+                    // The present queue might be used by other CommandQueue objects at the same time.
+                    auto lock = std::lock_guard {*_presentMutex};
+                    result    = _presentQueue.presentKHR(&presentInfo);
+                }
                 if (result == vk::Result::eErrorOutOfDateKHR) {
                     recoverSwapchainOnPresentError();
                     frame.frameEndSubmission = {};
@@ -3139,6 +6134,8 @@ private:
     FrameStatus         _frameStatus = ENDED;
     uint64_t            _frameIndex  = 0;
     vk::Queue           _presentQueue;
+    std::mutex          _ownPresentMutex; // used when the present queue has no device wide lock.
+    std::mutex *        _presentMutex = &_ownPresentMutex;
     Ref<CommandQueue>   _graphicsQueue;
 
     // the following are data members that will be cleared and recreated when swapchain is recreated.
@@ -3177,7 +6174,10 @@ private:
     void recoverSwapchainOnPresentError() {
         // RVI_LOGD("Waiting for graphics queue to idle...");
         _graphicsQueue->waitIdle(); // make sure frame rendering is done.
-        _presentQueue.waitIdle();   // also need to make sure present is done.
+        {
+            auto lock = std::lock_guard {*_presentMutex};
+            _presentQueue.waitIdle(); // also need to make sure present is done.
+        }
         // RVI_LOGD("Graphics queue is idle.");
 
         // verify surface caps.
@@ -3231,6 +6231,8 @@ private:
             }
         }
         RVI_REQUIRE(_presentQueue);
+        _presentMutex = queueMutex(_cp.gi, _cp.presentQueueFamily, _cp.presentQueueIndex);
+        if (!_presentMutex) _presentMutex = &_ownPresentMutex;
 
         // check if the back buffer format is supported.
         auto supportedFormats = _cp.gi->physical.getSurfaceFormatsKHR(_cp.surface);
@@ -3565,6 +6567,24 @@ struct PhysicalDeviceFeatureList {
         return *t;
     }
 
+    /// Look for a feature structure of the specified type in the chain. Returns null if not found.
+    template<typename T>
+    const T * find() const {
+        for (auto p = (const vk::BaseInStructure *) _deviceFeatures.pNext; p; p = p->pNext) {
+            if (p->sType == T::structureType) return (const T *) p;
+        }
+        return nullptr;
+    }
+
+    /// Look for a feature structure of the specified type in the chain. Returns null if not found.
+    template<typename T>
+    T * find() {
+        for (auto p = (vk::BaseOutStructure *) _deviceFeatures.pNext; p; p = p->pNext) {
+            if (p->sType == T::structureType) return (T *) p;
+        }
+        return nullptr;
+    }
+
 private:
     vk::PhysicalDeviceFeatures2 _deviceFeatures {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR};
     std::list<StructureChain>   _list;
@@ -3814,6 +6834,76 @@ static std::vector<const char *> validateExtensions(const std::vector<vk::Extens
     return supported;
 }
 
+#if RAPID_VULKAN_ENABLE_VMA
+// ---------------------------------------------------------------------------------------------------------------------
+// VMA is compiled with both static and dynamic function loading disabled. So we have to feed it with function pointers
+// that we load by ourselves.
+static VmaAllocator createVmaAllocator(const GlobalInfo & gi, uint32_t apiVersion, VmaAllocatorCreateFlags flags) {
+#if VULKAN_HPP_DISPATCH_LOADER_DYNAMIC == 1
+    auto getInstanceProcAddr = VULKAN_HPP_DEFAULT_DISPATCHER.vkGetInstanceProcAddr;
+#else
+    auto getInstanceProcAddr = &::vkGetInstanceProcAddr;
+#endif
+    auto instance          = (VkInstance) gi.instance;
+    auto device            = (VkDevice) gi.device;
+    auto getDeviceProcAddr = (PFN_vkGetDeviceProcAddr) getInstanceProcAddr(instance, "vkGetDeviceProcAddr");
+    RVI_REQUIRE(getDeviceProcAddr);
+
+    // Since 1.1, the KHR variants of these functions are promoted to core.
+    bool core11 = apiVersion >= VK_API_VERSION_1_1;
+
+    VmaVulkanFunctions vf {};
+#define RVI_VMA_INSTANCE_PROC(name, symbol) vf.name = (PFN_##name) getInstanceProcAddr(instance, symbol)
+#define RVI_VMA_DEVICE_PROC(name, symbol)   vf.name = (PFN_##name) getDeviceProcAddr(device, symbol)
+    vf.vkGetInstanceProcAddr = getInstanceProcAddr;
+    vf.vkGetDeviceProcAddr   = getDeviceProcAddr;
+    RVI_VMA_INSTANCE_PROC(vkGetPhysicalDeviceProperties, "vkGetPhysicalDeviceProperties");
+    RVI_VMA_INSTANCE_PROC(vkGetPhysicalDeviceMemoryProperties, "vkGetPhysicalDeviceMemoryProperties");
+    RVI_VMA_INSTANCE_PROC(vkGetPhysicalDeviceMemoryProperties2KHR,
+                          core11 ? "vkGetPhysicalDeviceMemoryProperties2" : "vkGetPhysicalDeviceMemoryProperties2KHR");
+    RVI_VMA_DEVICE_PROC(vkAllocateMemory, "vkAllocateMemory");
+    RVI_VMA_DEVICE_PROC(vkFreeMemory, "vkFreeMemory");
+    RVI_VMA_DEVICE_PROC(vkMapMemory, "vkMapMemory");
+    RVI_VMA_DEVICE_PROC(vkUnmapMemory, "vkUnmapMemory");
+    RVI_VMA_DEVICE_PROC(vkFlushMappedMemoryRanges, "vkFlushMappedMemoryRanges");
+    RVI_VMA_DEVICE_PROC(vkInvalidateMappedMemoryRanges, "vkInvalidateMappedMemoryRanges");
+    RVI_VMA_DEVICE_PROC(vkBindBufferMemory, "vkBindBufferMemory");
+    RVI_VMA_DEVICE_PROC(vkBindImageMemory, "vkBindImageMemory");
+    RVI_VMA_DEVICE_PROC(vkGetBufferMemoryRequirements, "vkGetBufferMemoryRequirements");
+    RVI_VMA_DEVICE_PROC(vkGetImageMemoryRequirements, "vkGetImageMemoryRequirements");
+    RVI_VMA_DEVICE_PROC(vkCreateBuffer, "vkCreateBuffer");
+    RVI_VMA_DEVICE_PROC(vkDestroyBuffer, "vkDestroyBuffer");
+    RVI_VMA_DEVICE_PROC(vkCreateImage, "vkCreateImage");
+    RVI_VMA_DEVICE_PROC(vkDestroyImage, "vkDestroyImage");
+    RVI_VMA_DEVICE_PROC(vkCmdCopyBuffer, "vkCmdCopyBuffer");
+    RVI_VMA_DEVICE_PROC(vkGetBufferMemoryRequirements2KHR, core11 ? "vkGetBufferMemoryRequirements2" : "vkGetBufferMemoryRequirements2KHR");
+    RVI_VMA_DEVICE_PROC(vkGetImageMemoryRequirements2KHR, core11 ? "vkGetImageMemoryRequirements2" : "vkGetImageMemoryRequirements2KHR");
+    RVI_VMA_DEVICE_PROC(vkBindBufferMemory2KHR, core11 ? "vkBindBufferMemory2" : "vkBindBufferMemory2KHR");
+    RVI_VMA_DEVICE_PROC(vkBindImageMemory2KHR, core11 ? "vkBindImageMemory2" : "vkBindImageMemory2KHR");
+#if VMA_VULKAN_VERSION >= 1003000
+    if (apiVersion >= VK_API_VERSION_1_3) {
+        RVI_VMA_DEVICE_PROC(vkGetDeviceBufferMemoryRequirements, "vkGetDeviceBufferMemoryRequirements");
+        RVI_VMA_DEVICE_PROC(vkGetDeviceImageMemoryRequirements, "vkGetDeviceImageMemoryRequirements");
+    }
+#endif
+#undef RVI_VMA_INSTANCE_PROC
+#undef RVI_VMA_DEVICE_PROC
+
+    VmaAllocatorCreateInfo ai {};
+    ai.flags                = flags;
+    ai.physicalDevice       = (VkPhysicalDevice) gi.physical;
+    ai.device               = device;
+    ai.instance             = instance;
+    ai.vulkanApiVersion     = apiVersion;
+    ai.pVulkanFunctions     = &vf;
+    ai.pAllocationCallbacks = (const VkAllocationCallbacks *) gi.allocator;
+
+    VmaAllocator allocator = nullptr;
+    RVI_VK_REQUIRE(vmaCreateAllocator(&ai, &allocator));
+    return allocator;
+}
+#endif
+
 // ---------------------------------------------------------------------------------------------------------------------
 //
 Device::Device(const ConstructParameters & cp): _cp(cp) {
@@ -3839,8 +6929,35 @@ Device::Device(const ConstructParameters & cp): _cp(cp) {
     PhysicalDeviceFeatureList   deviceFeatures(cp.features1, cp.features2, cp.features3);
     std::map<std::string, bool> askedDeviceExtensions = cp.deviceExtensions;
 
-    vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures(true);
-    deviceFeatures.addFeature(extendedDynamicStateFeatures);
+    // Enable timeline semaphore, if supported. It is used by CommandQueue to track submissions.
+    if (std::min(_gi.apiVersion, vk::enumerateInstanceVersion()) >= VK_API_VERSION_1_2) {
+        auto supported = _gi.physical.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+        if (supported.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore) {
+            // The feature can't be specified in both Vulkan12Features and TimelineSemaphoreFeatures. So reuse the existing one, if any.
+            if (auto f12 = deviceFeatures.find<vk::PhysicalDeviceVulkan12Features>())
+                f12->timelineSemaphore = true;
+            else if (auto fts = deviceFeatures.find<vk::PhysicalDeviceTimelineSemaphoreFeatures>())
+                fts->timelineSemaphore = true;
+            else
+                deviceFeatures.addFeature(vk::PhysicalDeviceTimelineSemaphoreFeatures(true));
+            _gi.timelineSemaphore = true;
+        }
+    }
+
+    // Enable synchronization2, if supported. It is used by CommandQueue to submit batches with vkQueueSubmit2.
+    if (std::min(_gi.apiVersion, vk::enumerateInstanceVersion()) >= VK_API_VERSION_1_3) {
+        auto supported = _gi.physical.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceSynchronization2Features>();
+        if (supported.get<vk::PhysicalDeviceSynchronization2Features>().synchronization2) {
+            // Same as above, the feature can't be specified in both Vulkan13Features and Synchronization2Features.
+            if (auto f13 = deviceFeatures.find<vk::PhysicalDeviceVulkan13Features>())
+                f13->synchronization2 = true;
+            else if (auto fs2 = deviceFeatures.find<vk::PhysicalDeviceSynchronization2Features>())
+                fs2->synchronization2 = true;
+            else
+                deviceFeatures.addFeature(vk::PhysicalDeviceSynchronization2Features(true));
+            _gi.synchronization2 = true;
+        }
+    }
 
     // some extensions are always enabled by default
     askedDeviceExtensions[VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME] = true;
@@ -3853,6 +6970,58 @@ Device::Device(const ConstructParameters & cp): _cp(cp) {
     // enable swapchain extension regardless to support VK_IMAGE_LAYOUT_PRESENT_SRC.
     askedDeviceExtensions[VK_KHR_SWAPCHAIN_EXTENSION_NAME] = true;
 
+    // optionally enable pipeline creation feedback (core since 1.3), which is used to collect pipeline cache statistics.
+    bool feedbackIsCore = std::min(_gi.apiVersion, vk::enumerateInstanceVersion()) >= VK_API_VERSION_1_3;
+    if (!feedbackIsCore) askedDeviceExtensions.insert({VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME, false});
+
+    auto availableDeviceExtensions = enumerateDeviceExtensions(_gi.physical);
+    auto isAvailable               = [&](const char * name) {
+        return availableDeviceExtensions.end() != std::find_if(availableDeviceExtensions.begin(), availableDeviceExtensions.end(),
+                                                               [&](const vk::ExtensionProperties & e) { return 0 == strcmp(e.extensionName, name); });
+    };
+
+    // Enable extended dynamic states, if supported. They are used by GraphicsPipeline::DynamicStates. The commands are
+    // core since Vulkan 1.3.
+    _gi.extendedDynamicState = std::min(_gi.apiVersion, vk::enumerateInstanceVersion()) >= VK_API_VERSION_1_3;
+    if (std::min(_gi.apiVersion, vk::enumerateInstanceVersion()) >= VK_API_VERSION_1_1 && isAvailable(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+        auto supported = _gi.physical.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>();
+        if (supported.get<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>().extendedDynamicState) {
+            if (auto f = deviceFeatures.find<vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>())
+                f->extendedDynamicState = true;
+            else
+                deviceFeatures.addFeature(vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT(true));
+            askedDeviceExtensions[VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME] = true;
+            _gi.extendedDynamicState                                            = true;
+        }
+    }
+
+    // Enable multi-draw indirect, if supported. It is used by CommandBuffer to merge compatible draw packs.
+    {
+        auto supported = _gi.physical.getFeatures();
+        if (supported.multiDrawIndirect && supported.drawIndirectFirstInstance) {
+            deviceFeatures.root().features.multiDrawIndirect         = true;
+            deviceFeatures.root().features.drawIndirectFirstInstance = true;
+            _gi.multiDrawIndirect                                    = true;
+        }
+    }
+
+#ifdef VK_EXT_graphics_pipeline_library
+    // Enable graphics pipeline library, if supported. It is used by fast-linked graphics pipelines.
+    if (std::min(_gi.apiVersion, vk::enumerateInstanceVersion()) >= VK_API_VERSION_1_1 && isAvailable(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        isAvailable(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+        auto supported = _gi.physical.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+        if (supported.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>().graphicsPipelineLibrary) {
+            if (auto f = deviceFeatures.find<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>())
+                f->graphicsPipelineLibrary = true;
+            else
+                deviceFeatures.addFeature(vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT(true));
+            askedDeviceExtensions[VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME]         = true;
+            askedDeviceExtensions[VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME] = true;
+            _gi.graphicsPipelineLibrary                                            = true;
+        }
+    }
+#endif
+
     // #if PH_ANDROID == 0
     //     if (isRenderDocPresent()) {                                                       // only add this when renderdoc is available
     //         askedDeviceExtensions[VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME] = true; // add this to allow debugging on compute shaders
@@ -3860,13 +7029,28 @@ Device::Device(const ConstructParameters & cp): _cp(cp) {
     // #endif
 
     // make sure all extensions are actually supported by the hardware.
-    auto availableDeviceExtensions = enumerateDeviceExtensions(_gi.physical);
-    auto enabledDeviceExtensions   = validateExtensions(availableDeviceExtensions, askedDeviceExtensions);
+    auto enabledDeviceExtensions = validateExtensions(availableDeviceExtensions, askedDeviceExtensions);
 
-    // create device, one queue for each family
-    float                                  queuePriority = 1.0f;
+    // create device, with the requested number of queues in each family.
+    std::vector<std::vector<float>>        queuePriorities(families.size());
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfo;
-    for (uint32_t i = 0; i < families.size(); ++i) { queueCreateInfo.emplace_back(vk::DeviceQueueCreateInfo({}, i, 1, &queuePriority)); }
+    for (uint32_t i = 0; i < families.size(); ++i) {
+        auto   iter = cp.familyQueuePriorities.find(i);
+        auto & p    = queuePriorities[i];
+        p           = iter != cp.familyQueuePriorities.end() ? iter->second : cp.queuePriorities;
+        if (p.empty()) p.push_back(1.0f);
+        for (auto & v : p) {
+            // Vulkan requires priorities to be normalized.
+            if (0.0f <= v && v <= 1.0f) continue;
+            RVI_LOGW("Queue priority %f of family %u is out of range [0, 1]. Clamped.", v, i);
+            v = std::isnan(v) ? 1.0f : std::clamp(v, 0.0f, 1.0f);
+        }
+        if (p.size() > families[i].queueCount) {
+            RVI_LOGW("Queue family %u supports %u queues only. %zu are requested.", i, families[i].queueCount, p.size());
+            p.resize(families[i].queueCount);
+        }
+        queueCreateInfo.push_back(vk::DeviceQueueCreateInfo().setQueueFamilyIndex(i).setQueuePriorities(p));
+    }
 
     // create device
     vk::DeviceCreateInfo deviceCreateInfo;
@@ -3875,26 +7059,59 @@ Device::Device(const ConstructParameters & cp): _cp(cp) {
     deviceCreateInfo.setPEnabledExtensionNames(enabledDeviceExtensions);
     _gi.device = _gi.physical.createDevice(deviceCreateInfo, _gi.allocator);
 
-    //     // initialize a memory allocator for Vulkan images
-    //     if (cp.enableVmaAllocator) {
-    //         VmaAllocatorCreateInfo ai {};
-    //         ai.vulkanApiVersion = cp.apiVersion;
-    //         ai.physicalDevice   = _gi.physical;
-    //         ai.device           = _gi.device;
-    //         ai.instance         = _gi.instance;
-
-    // #if 0 // uncomment this section to enable vma allocation recording
-    //         VmaRecordSettings vmaRecordSettings;
-    //         vmaRecordSettings.pFilePath = "vmaReplay.csv";
-    //         vmaRecordSettings.flags = VMA_RECORD_FLUSH_AFTER_CALL_BIT;
-    //         ai.pRecordSettings = &vmaRecordSettings;
-    // #endif
-    //         if (askedDeviceExtensions.find(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME) != askedDeviceExtensions.end()) {
-    //             RVI_LOGI("Enable VMA allocator with buffer device address.");
-    //             ai.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
-    //         }
-    //         RVI_VK_REQUIRE(vmaCreateAllocator(&ai, &_gi.vmaAllocator));
-    //     }
+    // create one lock for each queue. They are shared by all CommandQueue objects that are created on the same queue.
+    for (uint32_t i = 0; i < queuePriorities.size(); ++i)
+        for (uint32_t j = 0; j < queuePriorities[i].size(); ++j)
+            _queueMutexes.emplace(std::piecewise_construct, std::forward_as_tuple(i, j), std::forward_as_tuple());
+    _gi.queueMutexes = &_queueMutexes;
+
+    _gi.pipelineCreationFeedback = feedbackIsCore || enabledDeviceExtensions.end() != std::find_if(enabledDeviceExtensions.begin(), enabledDeviceExtensions.end(),
+                                                                                                  [](const char * e) {
+                                                                                                      return 0 == strcmp(e, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+                                                                                                  });
+
+#if RAPID_VULKAN_ENABLE_VMA
+    // initialize VMA allocator for buffers and images.
+    if (cp.enableVmaAllocator) {
+        auto isEnabled = [&](const char * name) {
+            return enabledDeviceExtensions.end() !=
+                   std::find_if(enabledDeviceExtensions.begin(), enabledDeviceExtensions.end(), [&](const char * e) { return 0 == strcmp(e, name); });
+        };
+
+        // VMA expects the API version of the instance, which could be lower than the physical device's one.
+        auto vmaApiVersion = std::min(_gi.apiVersion, vk::enumerateInstanceVersion());
+        vmaApiVersion      = VK_MAKE_API_VERSION(0, 1, std::min(VK_API_VERSION_MINOR(vmaApiVersion), 3u), 0); // VMA 3.0 supports up to 1.3
+
+        VmaAllocatorCreateFlags flags = 0;
+
+        // Enable buffer device address, if it is enabled either through the extension or the core 1.2 features.
+        bool bda = isEnabled(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+        if (!bda && vmaApiVersion >= VK_API_VERSION_1_2) {
+            auto f12 = deviceFeatures.find<vk::PhysicalDeviceVulkan12Features>();
+            auto fba = deviceFeatures.find<vk::PhysicalDeviceBufferDeviceAddressFeatures>();
+            bda      = (f12 && f12->bufferDeviceAddress) || (fba && fba->bufferDeviceAddress);
+        }
+        if (bda) flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+
+        if (isEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+
+        _gi.vmaAllocator = createVmaAllocator(_gi, vmaApiVersion, flags);
+        RVI_LOGI("VMA allocator created (buffer device address: %s, memory budget: %s).", bda ? "on" : "off",
+                 (flags & VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT) ? "on" : "off");
+    }
+#endif
+
+    // create device wide staging ring.
+    if (cp.stagingRingSize > 0) {
+        _stagingRing    = new StagingRing({{"Device staging ring"}, &_gi, cp.stagingRingSize});
+        _gi.stagingRing = _stagingRing;
+    }
+
+    // create device wide pipeline cache and registry.
+    _pipelineCache       = new PipelineCache({{"Device pipeline cache"}, &_gi, cp.pipelineCachePath});
+    _gi.pipelineCache    = _pipelineCache;
+    _pipelineRegistry    = new PipelineRegistry({{"Device pipeline registry"}, &_gi});
+    _gi.pipelineRegistry = _pipelineRegistry;
 
     // print device information
     if (cp.printVkInfo) {
@@ -3903,14 +7120,23 @@ Device::Device(const ConstructParameters & cp): _cp(cp) {
     }
 
     // classify queue families. create command pool for each of them.
-    _queues.resize(families.size());
+    _queueSets.resize(families.size());
     for (uint32_t i = 0; i < families.size(); ++i) {
         const auto & f = families[i];
 
         // create an submission proxy for each queue.
-        auto name  = std::string("Default device queue #") + std::to_string(i);
-        auto q     = new CommandQueue({{name}, &_gi, i, 0});
-        _queues[i] = q;
+        std::vector<CommandQueue *> queues;
+        for (uint32_t j = 0; j < queuePriorities[i].size(); ++j) {
+            auto name = std::string("Default device queue #") + std::to_string(i);
+            if (j > 0) name += "." + std::to_string(j);
+            queues.push_back(new CommandQueue({{name}, &_gi, i, j, cp.pooledCommandBuffers}));
+            // Uploads go through the same queue object, so they are ordered on the same timeline as the other work.
+            if (_stagingRing) _stagingRing->setQueue(*queues.back());
+        }
+        _queueSets[i] = new QueueSet(i, std::move(queues));
+
+        // the first queue is the default one of the family.
+        auto q = (*_queueSets[i])[0];
 
         // classify all queues
         if (!_graphics && f.queueFlags & vk::QueueFlagBits::eGraphics) {
@@ -3932,8 +7158,17 @@ Device::Device(const ConstructParameters & cp): _cp(cp) {
 //
 Device::~Device() {
     waitIdle();
-    for (auto q : _queues) delete q;
-    _queues.clear();
+    _gi.stagingRing = nullptr;
+    delete _stagingRing;
+    _stagingRing = nullptr;
+    _gi.pipelineRegistry = nullptr;
+    delete _pipelineRegistry;
+    _pipelineRegistry = nullptr;
+    _gi.pipelineCache = nullptr;
+    delete _pipelineCache;
+    _pipelineCache = nullptr;
+    for (auto s : _queueSets) delete s;
+    _queueSets.clear();
 #if RAPID_VULKAN_ENABLE_VMA
     if (_gi.vmaAllocator) vmaDestroyAllocator(_gi.vmaAllocator), _gi.vmaAllocator = nullptr;
 #endif
@@ -219,6 +219,7 @@ SOFTWARE.
 #include <exception>
 #include <functional>
 #include <memory>
+#include <mutex>
 
 // ---------------------------------------------------------------------------------------------------------------------
 // RVI stands for Rapid Vulkan Implementation. Macros started with this prefix are reserved for internal use.
@@ -341,6 +342,11 @@ enum class LogSeverity {
 // } // namespace std
 // namespace RAPID_VULKAN_NAMESPACE {
 
+class StagingRing;
+class PipelineCache;
+struct PipelineReflection;
+class PipelineRegistry;
+
 // ---------------------------------------------------------------------------------------------------------------------
 /// A utility class used to pass commonly used Vulkan global information around.
 struct GlobalInfo {
@@ -350,11 +356,45 @@ struct GlobalInfo {
     uint32_t                        apiVersion          = 0;
     vk::Device                      device              = nullptr;
     uint32_t                        graphicsQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+    bool                            timelineSemaphore   = false; ///< true, if timeline semaphore is enabled on the device.
 
 #if RAPID_VULKAN_ENABLE_VMA
     VmaAllocator vmaAllocator = nullptr;
 #endif
 
+    /// Optional device wide staging ring used by Buffer::setContent() and Image::setContent(). When null, each upload
+    /// will create its own temporary staging buffer.
+    StagingRing * stagingRing = nullptr;
+
+    /// Optional device wide pipeline cache used by all pipelines created by the library.
+    PipelineCache * pipelineCache = nullptr;
+
+    /// Optional device wide registry of pipelines and pipeline layouts. When not null, pipelines with identical shaders
+    /// share the same pipeline layout.
+    PipelineRegistry * pipelineRegistry = nullptr;
+
+    /// True, if pipeline creation feedback (VK_EXT_pipeline_creation_feedback or Vulkan 1.3) is available.
+    bool pipelineCreationFeedback = false;
+
+    /// True, if VK_EXT_graphics_pipeline_library is enabled on the device. Required by fast-linked graphics pipelines.
+    bool graphicsPipelineLibrary = false;
+
+    /// True, if extended dynamic states (VK_EXT_extended_dynamic_state or Vulkan 1.3) are available.
+    bool extendedDynamicState = false;
+
+    /// True, if multiDrawIndirect and drawIndirectFirstInstance features are enabled. Required by merged indirect draws.
+    bool multiDrawIndirect = false;
+
+    /// True, if synchronization2 (Vulkan 1.3) is enabled. CommandQueue then submits work through vkQueueSubmit2().
+    bool synchronization2 = false;
+
+    typedef std::map<std::pair<uint32_t, uint32_t>, std::mutex> QueueMutexMap;
+
+    /// Locks of the device queues, keyed by (family, index). Vulkan requires access to a VkQueue to be externally
+    /// synchronized, while several CommandQueue objects (clones, the staging ring, the swapchain) might wrap the same
+    /// one. Created by Device. A queue that is not in the map is guarded by a lock of the CommandQueue object only.
+    QueueMutexMap * queueMutexes = nullptr;
+
     template<typename T, typename... ARGS>
     void safeDestroy(T & handle, ARGS... args) const {
         if (!handle) return;
@@ -898,6 +938,7 @@ struct Barrier {
 };
 
 class CommandQueue;
+class CommandBuffer;
 
 // ---------------------------------------------------------------------------------------------------------------------
 /// A wrapper class for VkBuffer
@@ -1300,6 +1341,14 @@ public:
     struct ReadContentParameters {
         uint32_t queueFamily = 0;
         uint32_t queueIndex  = 0;
+        uint32_t mipLevel    = 0;
+        uint32_t levelCount  = VK_REMAINING_MIP_LEVELS;
+        uint32_t arrayLayer  = 0;
+        uint32_t layerCount  = VK_REMAINING_ARRAY_LAYERS;
+
+        /// Current layout of the image. Default is eUndefined, which is what the library has always been using. Set it to the
+        /// actual layout when it is known, to guarantee the content is preserved.
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
 
         ReadContentParameters & setQueue(uint32_t family, uint32_t index) {
             queueFamily = family;
@@ -1308,6 +1357,23 @@ public:
         }
 
         ReadContentParameters & setQueue(const CommandQueue &);
+
+        ReadContentParameters & setMipLevels(uint32_t base, uint32_t count = VK_REMAINING_MIP_LEVELS) {
+            mipLevel   = base;
+            levelCount = count;
+            return *this;
+        }
+
+        ReadContentParameters & setArrayLayers(uint32_t base, uint32_t count = VK_REMAINING_ARRAY_LAYERS) {
+            arrayLayer = base;
+            layerCount = count;
+            return *this;
+        }
+
+        ReadContentParameters & setLayout(vk::ImageLayout l) {
+            layout = l;
+            return *this;
+        }
     };
 
     struct SubresourceContent {
@@ -1325,7 +1391,7 @@ public:
         /// @brief The storage of all pixels.
         std::vector<uint8_t> storage;
 
-        /// @brief content of each subresource. index by (mipLevel * layerCount + arrayLayer)
+        /// @brief content of each subresource. index by ((mipLevel - baseMipLevel) * layerCount + (arrayLayer - baseArrayLayer))
         std::vector<SubresourceContent> subresources;
     };
 
@@ -1354,8 +1420,8 @@ public:
     /// This method, if succeeded, will transfer the subresource into vk::ImageLayout::eTransferDstOptimal layout.
     void setContent(const SetContentParameters &);
 
-    /// @brief Synchronously read content of the whole image.
-    /// This method, if succeeded, will transfer the image into vk::ImageLayout::eTransferSrcOptimal layout.
+    /// @brief Synchronously read content of a range of subresources (the whole image by default).
+    /// This method, if succeeded, will transfer the subresources into vk::ImageLayout::eTransferSrcOptimal layout.
     Content readContent(const ReadContentParameters &);
 
     vk::Image handle() const { return desc().handle; }
@@ -1427,11 +1493,21 @@ public:
         vk::ArrayProxy<const uint32_t> spirv {};
         const char *                   entry = "main";
 
+        /// Set to false to drop the copy of the SPIR-V code once the shader is reflected, to save memory. spirv() will
+        /// return empty array then. Note that async pipelines created with such shader can't make private copy of the
+        /// shader module. So the shader has to stay alive until those pipelines are ready.
+        bool keepSpirv = true;
+
         ConstructParameters & setGi(const GlobalInfo * v) {
             gi = v;
             return *this;
         }
 
+        ConstructParameters & setKeepSpirv(bool b) {
+            keepSpirv = b;
+            return *this;
+        }
+
         template<typename T, size_t C>
         ConstructParameters & setSpirv(const std::array<T, C> & data) {
             spirv = vk::ArrayProxy<const uint32_t>(C * sizeof(T) / sizeof(uint32_t), (const uint32_t *) data.data());
@@ -1467,13 +1543,27 @@ public:
 
     const std::string & entry() const { return _entry; }
 
+    /// @brief The SPIR-V code. Empty if the shader is created with ConstructParameters::keepSpirv set to false.
     vk::ArrayProxy<const uint32_t> spirv() const { return _spirv; }
 
+    /// @brief 64-bit hash of the SPIR-V code and the entry point. Shaders with identical content have identical hash.
+    uint64_t hash() const { return _hash; }
+
+    /// @brief Another 64-bit hash of the same content, computed independently of hash(). It tells apart shaders whose
+    /// hash() collides.
+    uint64_t checksum() const { return _checksum; }
+
+    /// @brief Reflection of the shader alone. Shared by all shaders with identical content. Null for empty shader.
+    const std::shared_ptr<const PipelineReflection> & reflection() const { return _reflection; }
+
 private:
-    const GlobalInfo *    _gi = nullptr;
-    vk::ShaderModule      _handle {};
-    std::string           _entry;
-    std::vector<uint32_t> _spirv;
+    const GlobalInfo *                        _gi = nullptr;
+    vk::ShaderModule                          _handle {};
+    std::string                               _entry;
+    std::vector<uint32_t>                     _spirv;
+    uint64_t                                  _hash {};
+    uint64_t                                  _checksum {};
+    std::shared_ptr<const PipelineReflection> _reflection;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1584,14 +1674,134 @@ struct PipelineReflection {
     /// Collection of vertex shader input. Key is input location.
     typedef std::map<uint32_t, VertexShaderInput> VertexLayout;
 
-    std::string      name; ///< name of the program that this reflect is from. this field is for logging and debugging.
-    DescriptorLayout descriptors;
-    ConstantLayout   constants;
-    VertexLayout     vertex;
+    /// Properties of a specialization constant.
+    struct SpecializationConstant {
+        uint32_t             id   = 0; ///< the constant ID.
+        uint32_t             size = 0; ///< size of the constant in bytes.
+        vk::ShaderStageFlags stages {};
+    };
+
+    /// Collection of named specialization constants. Key is the name of the constant.
+    typedef std::map<std::string, SpecializationConstant> SpecializationLayout;
+
+    std::string          name; ///< name of the program that this reflect is from. this field is for logging and debugging.
+    DescriptorLayout     descriptors;
+    ConstantLayout       constants;
+    VertexLayout         vertex;
+    SpecializationLayout specializations;
 
     PipelineReflection() {}
 };
 
+// ---------------------------------------------------------------------------------------------------------------------
+/// Specialization constant values of one shader stage. Constants can be referenced either by constant ID, or by name.
+/// Names are resolved to constant IDs via PipelineReflection::specializations when the pipeline is created.
+struct SpecializationConstants {
+    /// Binary value of one constant. Booleans are stored as 32-bit VkBool32.
+    struct Value {
+        uint64_t bits = 0;
+        uint32_t size = 0;
+    };
+
+    std::map<uint32_t, Value>    ids;   ///< values keyed by constant ID.
+    std::map<std::string, Value> names; ///< values keyed by constant name.
+
+    template<typename T>
+    SpecializationConstants & set(uint32_t id, T value) {
+        ids[id] = makeValue(value);
+        return *this;
+    }
+
+    template<typename T>
+    SpecializationConstants & set(const std::string & name, T value) {
+        names[name] = makeValue(value);
+        return *this;
+    }
+
+    bool empty() const { return ids.empty() && names.empty(); }
+
+    template<typename T>
+    static Value makeValue(T v) {
+        static_assert(std::is_arithmetic_v<T> && (std::is_same_v<T, bool> || 4 == sizeof(T) || 8 == sizeof(T)), "unsupported constant type");
+        Value r;
+        if constexpr (std::is_same_v<T, bool>) {
+            r.bits = v ? VK_TRUE : VK_FALSE;
+            r.size = sizeof(VkBool32);
+        } else {
+            memcpy(&r.bits, &v, sizeof(T));
+            r.size = sizeof(T);
+        }
+        return r;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// A wrapper class for VkPipelineCache. The cache can be loaded from and saved to a file, to avoid recompiling
+/// pipelines across process launches. The device creates one and stores it in GlobalInfo::pipelineCache.
+class PipelineCache : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        const GlobalInfo * gi = nullptr;
+
+        /// Path of the cache file. The cache is loaded from it when constructed and saved to it when destroyed. Cache
+        /// data that is created by a different driver or device is ignored. Empty path means in-memory cache only.
+        std::string path {};
+
+        /// Number of worker threads for async pipeline creation. The threads are started on the first async request.
+        /// 0 means half of the hardware threads.
+        uint32_t workerCount = 0;
+
+        ConstructParameters & setPath(const std::string & v) {
+            path = v;
+            return *this;
+        }
+
+        ConstructParameters & setWorkerCount(uint32_t v) {
+            workerCount = v;
+            return *this;
+        }
+    };
+
+    struct Stats {
+        uint64_t hits    = 0; ///< number of pipelines that are found in the cache.
+        uint64_t misses  = 0; ///< number of pipelines that are compiled from scratch.
+        uint64_t unknown = 0; ///< number of pipelines created without creation feedback, thus can't tell.
+    };
+
+    PipelineCache(const ConstructParameters &);
+
+    ~PipelineCache() override;
+
+    vk::PipelineCache handle() const;
+
+    auto stats() const -> Stats;
+
+    /// @brief Save the cache data to the file. Returns false on failure, or if the cache has no path.
+    bool save() const;
+
+    /// @brief Create a graphics pipeline with the cache. Returns null handle on failure.
+    vk::Pipeline createGraphicsPipeline(const vk::GraphicsPipelineCreateInfo &);
+
+    /// @brief Create a compute pipeline with the cache. Returns null handle on failure.
+    vk::Pipeline createComputePipeline(const vk::ComputePipelineCreateInfo &);
+
+    /// @brief Queue a graphics pipeline to be created on the worker threads. Queued pipelines are created in batches.
+    /// The create info, and everything it points to, must stay valid until the callback is invoked on one of the worker
+    /// threads, with the new pipeline, or with null handle if the creation failed or is cancelled. The callback owns
+    /// the pipeline handle.
+    void createGraphicsPipelineAsync(const vk::GraphicsPipelineCreateInfo &, std::function<void(vk::Pipeline)> callback);
+
+    /// @brief Queue a compute pipeline to be created on the worker threads. See createGraphicsPipelineAsync() for details.
+    void createComputePipelineAsync(const vk::ComputePipelineCreateInfo &, std::function<void(vk::Pipeline)> callback);
+
+protected:
+    void onNameChanged(const std::string &) override;
+
+private:
+    class Impl;
+    Impl * _impl = nullptr;
+};
+
 // ---------------------------------------------------------------------------------------------------------------------
 /// A wrapper class for VkPipeline. Immutable after being created. Safe to visit from multiple threads.
 class Pipeline : public Root {
@@ -1600,12 +1810,28 @@ public:
 
     vk::PipelineBindPoint bindPoint() const;
 
+    /// @brief Returns the pipeline handle. Null if the pipeline is not ready yet.
     vk::Pipeline handle() const;
 
     vk::PipelineLayout layout() const;
 
+    /// @brief Returns true if the pipeline is created and ready to use. Async pipelines are not ready until they are
+    /// compiled by the worker threads of GlobalInfo::pipelineCache. Pipelines that failed to compile are never ready.
+    bool isReady() const;
+
+    /// @brief Block until the pending async compilation is done, including the background optimization of fast-linked
+    /// graphics pipelines. Returns isReady().
+    bool wait() const;
+
+    /// @brief Pipeline to use in place of this one, while this one is still being compiled. Could be null.
+    const Pipeline * fallback() const;
+
     const PipelineReflection & reflection() const;
 
+    /// @brief Returns the descriptor update template of the descriptor set. Null if not available.
+    /// The template consumes descriptor infos packed in the same layout as DrawPack::descriptorBlock, starting at the offset of the set.
+    vk::DescriptorUpdateTemplate descriptorUpdateTemplate(uint32_t set) const;
+
 protected:
     Pipeline(const std::string & name, vk::PipelineBindPoint bindPoint, vk::ArrayProxy<const Shader * const> shaders);
 
@@ -1639,6 +1865,30 @@ public:
         vk::Pipeline                                       baseHandle {};
         int32_t                                            baseIndex {};
 
+        /// Set to true to compile the pipeline asynchronously. The render pass must stay valid until the pipeline is ready.
+        bool async = false;
+
+        /// Optional pipeline with compatible layout, that is used in place of this one while this one is being compiled.
+        Ref<const Pipeline> fallback {};
+
+        /// Specialization constants of each shader stage.
+        std::map<vk::ShaderStageFlagBits, SpecializationConstants> specializations {};
+
+        /// Set to true to build the pipeline by fast-linking pipeline libraries of the vertex input, pre-rasterization,
+        /// fragment shader and fragment output states (VK_EXT_graphics_pipeline_library). Each library is compiled once
+        /// and shared through GlobalInfo::pipelineRegistry, so pipelines that differ only in, say, blend states compile
+        /// only the part that is different. Falls back to regular compilation when the extension is not available.
+        /// Takes priority over async, since linking is fast.
+        bool fastLink = false;
+
+        /// When fast-linking, also compile a fully optimized pipeline on the worker threads of GlobalInfo::pipelineCache.
+        /// It replaces the fast-linked one once ready.
+        bool optimize = true;
+
+        /// Set to true to mark all states in DynamicStates as dynamic, so they can be changed per Drawable at record time.
+        /// The values in ia, rast and depth are used as defaults. Ignored if GlobalInfo::extendedDynamicState is false.
+        bool extendedDynamicState = false;
+
         ConstructParameters & setName(std::string newName) {
             name = std::move(newName);
             return *this;
@@ -1660,6 +1910,28 @@ public:
             return *this;
         }
 
+        ConstructParameters & setAsync(bool b, Ref<const Pipeline> fb = {}) {
+            async    = b;
+            fallback = fb;
+            return *this;
+        }
+
+        ConstructParameters & setSpecialization(vk::ShaderStageFlagBits stage, const SpecializationConstants & sc) {
+            specializations[stage] = sc;
+            return *this;
+        }
+
+        ConstructParameters & setFastLink(bool b, bool optimizeInBackground = true) {
+            fastLink = b;
+            optimize = optimizeInBackground;
+            return *this;
+        }
+
+        ConstructParameters & setExtendedDynamicState(bool b = true) {
+            extendedDynamicState = b;
+            return *this;
+        }
+
         /// @brief Add a vertex attribute, in order of location.
         /// The first call to this method adds a vertex attribute for location 0. The second call adds a vertex attribute for location 1, and so on.
         ConstructParameters & addVertexAttribute(size_t binding, size_t offset, vk::Format format) {
@@ -1778,9 +2050,76 @@ public:
         }
     };
 
+    /// @brief Pipeline states that can be changed at record time, if the pipeline is created with extended dynamic state.
+    struct DynamicStates {
+        vk::CullModeFlags     cullMode              = vk::CullModeFlagBits::eNone;
+        vk::FrontFace         frontFace             = vk::FrontFace::eCounterClockwise;
+        vk::PrimitiveTopology topology              = vk::PrimitiveTopology::eTriangleList; ///< must be of the same class as the pipeline's one.
+        bool                  depthTestEnable       = false;
+        bool                  depthWriteEnable      = false;
+        vk::CompareOp         depthCompareOp        = vk::CompareOp::eNever;
+        bool                  depthBoundsTestEnable = false;
+        bool                  stencilTestEnable     = false;
+
+        DynamicStates & setCullMode(vk::CullModeFlags v) {
+            cullMode = v;
+            return *this;
+        }
+
+        DynamicStates & setFrontFace(vk::FrontFace v) {
+            frontFace = v;
+            return *this;
+        }
+
+        DynamicStates & setTopology(vk::PrimitiveTopology v) {
+            topology = v;
+            return *this;
+        }
+
+        DynamicStates & setDepth(bool test, bool write, vk::CompareOp op = vk::CompareOp::eLess) {
+            depthTestEnable  = test;
+            depthWriteEnable = write;
+            depthCompareOp   = op;
+            return *this;
+        }
+
+        DynamicStates & setDepthBoundsTest(bool b) {
+            depthBoundsTestEnable = b;
+            return *this;
+        }
+
+        DynamicStates & setStencilTest(bool b) {
+            stencilTestEnable = b;
+            return *this;
+        }
+
+        bool operator==(const DynamicStates & rhs) const {
+            return cullMode == rhs.cullMode && frontFace == rhs.frontFace && topology == rhs.topology && depthTestEnable == rhs.depthTestEnable &&
+                   depthWriteEnable == rhs.depthWriteEnable && depthCompareOp == rhs.depthCompareOp && depthBoundsTestEnable == rhs.depthBoundsTestEnable &&
+                   stencilTestEnable == rhs.stencilTestEnable;
+        }
+
+        bool operator!=(const DynamicStates & rhs) const { return !(*this == rhs); }
+
+        /// @brief Set all states to the command buffer.
+        void cmdSet(vk::CommandBuffer) const;
+    };
+
     GraphicsPipeline(const ConstructParameters &);
 
+    /// @brief Default values of the dynamic states. Null, if the pipeline is not created with extended dynamic state.
+    const DynamicStates * dynamicStates() const { return _dynamic ? &_defaultStates : nullptr; }
+
+    /// @brief Bind the pipeline and draw. Dynamic states, if any, are set to their defaults.
     void cmdDraw(vk::CommandBuffer, const DrawParameters &) const;
+
+    /// @brief Bind the pipeline and draw. States left by previously rendered draw packs are invalidated, so the next
+    /// CommandBuffer::render() call records all of its states again.
+    void cmdDraw(const CommandBuffer &, const DrawParameters &) const;
+
+private:
+    DynamicStates _defaultStates {};
+    bool          _dynamic = false;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1790,6 +2129,26 @@ public:
     struct ConstructParameters : public Root::ConstructParameters {
         /// Pointer to the computer shader. Must be non-null.
         const Shader * cs = nullptr;
+
+        /// Set to true to compile the pipeline asynchronously. See GraphicsPipeline::ConstructParameters::async for details.
+        bool async = false;
+
+        /// Optional pipeline with compatible layout, that is used in place of this one while this one is being compiled.
+        Ref<const Pipeline> fallback {};
+
+        /// Specialization constants of the compute shader.
+        SpecializationConstants specialization {};
+
+        ConstructParameters & setAsync(bool b, Ref<const Pipeline> fb = {}) {
+            async    = b;
+            fallback = fb;
+            return *this;
+        }
+
+        ConstructParameters & setSpecialization(const SpecializationConstants & sc) {
+            specialization = sc;
+            return *this;
+        }
     };
 
     struct DispatchParameters {
@@ -1801,6 +2160,64 @@ public:
     ComputePipeline(const ConstructParameters &);
 
     void cmdDispatch(vk::CommandBuffer, const DispatchParameters &) const;
+
+    /// @brief Bind the pipeline and dispatch. See GraphicsPipeline::cmdDraw() for how this affects CommandBuffer::render().
+    void cmdDispatch(const CommandBuffer &, const DispatchParameters &) const;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// @brief Content addressed registry of pipeline objects.
+///
+/// Pipelines requested with identical shaders (compared by both Shader::hash() and Shader::checksum()) and identical
+/// fixed function states are shared, instead of being compiled again. Pipeline layouts are shared by all pipelines
+/// created with identical shaders, regardless if they are created through the registry or not. Shared objects keep the name of the first requester.
+/// The device creates one and stores it in GlobalInfo::pipelineRegistry. All methods are thread safe.
+class PipelineRegistry : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        const GlobalInfo * gi = nullptr;
+    };
+
+    struct Stats {
+        uint64_t hits          = 0; ///< number of pipeline requests served from the registry.
+        uint64_t misses        = 0; ///< number of pipeline requests that created new pipelines.
+        uint64_t uncached      = 0; ///< number of pipeline requests that can't be cached (e.g. states with pNext chain, or unknown render pass).
+        uint64_t layoutHits    = 0; ///< number of pipeline layout requests served from the registry.
+        uint64_t layoutMisses  = 0; ///< number of pipeline layout requests that created new layouts.
+        uint64_t libraryHits   = 0; ///< number of pipeline library requests served from the registry.
+        uint64_t libraryMisses = 0; ///< number of pipeline library requests that compiled new libraries.
+    };
+
+    PipelineRegistry(const ConstructParameters &);
+
+    ~PipelineRegistry() override;
+
+    /// @brief Get a graphics pipeline with the specified parameters. Create a new one if not found.
+    Ref<GraphicsPipeline> graphics(const GraphicsPipeline::ConstructParameters &);
+
+    /// @brief Get a compute pipeline with the specified parameters. Create a new one if not found.
+    Ref<ComputePipeline> compute(const ComputePipeline::ConstructParameters &);
+
+    /// @brief Describe the render pass to the registry. The handle of a destroyed render pass could be reused by an
+    /// unrelated one. So graphics pipelines are cached only if their render pass is null or described here, and render
+    /// passes are compared by the description instead. Render passes created by the library itself, such as the built-in
+    /// one of Swapchain, are described automatically.
+    void addRenderPass(vk::RenderPass, const vk::RenderPassCreateInfo &);
+
+    /// @brief Forget the render pass. Call it before the render pass is destroyed.
+    void removeRenderPass(vk::RenderPass);
+
+    auto stats() const -> Stats;
+
+    /// @brief Release pipelines, pipeline libraries and pipeline layouts that are not referenced by anyone else.
+    /// @return Number of objects released.
+    size_t purge();
+
+private:
+    friend class Pipeline;
+    friend class GraphicsPipeline;
+    class Impl;
+    Impl * _impl = nullptr;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1811,14 +2228,20 @@ public:
 
     ~DrawPack() override = default;
 
+    /// @brief Draw packs are allocated out of a pool of fixed size blocks. Blocks of deleted packs are recycled through
+    /// a free list, instead of going back to the heap.
+    static void * operator new(size_t);
+
+    static void operator delete(void *, size_t);
+
     /// @brief A list of resources that all descriptors depend on.
     struct Dependencies {
         typedef std::shared_ptr<std::vector<uint8_t>> Blob;
 
-        std::set<Ref<const Buffer>>  buffers;  ///< Buffers used by descriptors
-        std::set<Ref<const Image>>   images;   ///< Images used by descriptors
-        std::set<Ref<const Sampler>> samplers; ///< Samplers used by descriptors
-        std::vector<Blob>            blobs;    ///< Binary data used by descriptors
+        std::vector<Ref<const Buffer>>  buffers;  ///< Buffers used by descriptors. Sorted and unique.
+        std::vector<Ref<const Image>>   images;   ///< Images used by descriptors. Sorted and unique.
+        std::vector<Ref<const Sampler>> samplers; ///< Samplers used by descriptors. Sorted and unique.
+        std::vector<Blob>               blobs;    ///< Binary data used by descriptors
 
         Dependencies() = default;
 
@@ -1870,13 +2293,17 @@ public:
 
     const Ref<const Pipeline>                        pipeline; ///< Pipeline used by the draw pack. It is immutable.
     std::vector<std::vector<vk::WriteDescriptorSet>> descriptors;
+    Dependencies::Blob                               descriptorBlock;   ///< Packed descriptor infos of all sets. Descriptor writes point into it.
+    std::vector<size_t>                              descriptorOffsets; ///< Byte offset of infos of each set in the descriptor block.
     Dependencies                                     dependencies;
     std::vector<ConstantArgument>                    constants;
     std::vector<Ref<Buffer>>                         vertexBuffers;
     std::vector<vk::DeviceSize>                      vertexOffsets;
-    Ref<Buffer>                                      indexBuffer;                          ///< Index buffer. Null, if the draw is non-indexed.
-    vk::DeviceSize                                   indexOffset = 0;                      ///< Offset into the index buffer. Ignored for non-indexed draw.
-    vk::IndexType                                    indexType   = vk::IndexType::eUint16; ///< Type of index. Ignored for non-indexed draw.
+    Ref<Buffer>                                      indexBuffer;                               ///< Index buffer. Null, if the draw is non-indexed.
+    vk::DeviceSize                                   indexOffset      = 0;                      ///< Offset into the index buffer. Ignored for non-indexed draw.
+    vk::IndexType                                    indexType        = vk::IndexType::eUint16; ///< Type of index. Ignored for non-indexed draw.
+    bool                                             hasDynamicStates = false;                  ///< True, if the pipeline has extended dynamic states.
+    GraphicsPipeline::DynamicStates                  dynamicStates {};                          ///< Ignored, if hasDynamicStates is false.
 
     union {
         GraphicsPipeline::DrawParameters    draw;     ///< Draw parameters for graphics pipeline.
@@ -1888,8 +2315,31 @@ public:
         vk::Device             device {};
         DescriptorSetAllocator descriptorSetAllocator {};
         const DrawPack *       previous {};
+
+        /// Optional. Returns a descriptor set with the specified content, which is ready to use without being updated.
+        /// Returning null set makes the draw pack fall back to descriptorSetAllocator.
+        std::function<vk::DescriptorSet(const Pipeline &, uint32_t setIndex, const std::vector<vk::WriteDescriptorSet> &)> descriptorSetLookup {};
+
+        /// Optional. Pipeline handle currently bound to the command buffer. The pipeline bind is skipped, if it is same
+        /// as the one to render with. Updated by cmdRender().
+        vk::Pipeline * boundPipeline {};
+
+        /// Optional. When not null, the draw parameters of the pack are ignored. Instead, indirectCount draws are sourced
+        /// from the buffer, as VkDrawIndexedIndirectCommand for indexed draw, or VkDrawIndirectCommand for non-indexed
+        /// draw. Ignored by compute pipelines.
+        vk::Buffer     indirectBuffer {};
+        vk::DeviceSize indirectOffset = 0;
+        uint32_t       indirectCount  = 0;
     };
-    void cmdRender(vk::CommandBuffer cb, const RenderParameters &) const;
+    /// @brief Record the draw pack into the command buffer. States that are identical to the previous draw pack (pipeline,
+    /// descriptor sets, push constants, vertex and index buffers) are not recorded again. While the pipeline is still
+    /// being compiled, its fallback pipeline is used instead. If there's no ready-to-use fallback, nothing is recorded
+    /// and the method returns false.
+    bool cmdRender(vk::CommandBuffer cb, const RenderParameters &) const;
+
+    /// @brief Check if the two draw packs can be merged into one indirect draw, i.e. they are graphics draw packs that
+    /// differ only in draw parameters.
+    bool mergeable(const DrawPack &) const;
 
     /// @brief A draw pack is considered empty if it does not contain any pipeline.
     bool empty() const { return !pipeline; }
@@ -1967,6 +2417,12 @@ public:
     /// @brief Set draw parameters
     Drawable & draw(const GraphicsPipeline::DrawParameters &);
 
+    /// @brief Set dynamic states. Ignored, if the pipeline is not created with extended dynamic state.
+    Drawable & dynamicStates(const GraphicsPipeline::DynamicStates &);
+
+    /// @brief Current dynamic states of the drawable. Initialized to the defaults of the pipeline.
+    const GraphicsPipeline::DynamicStates & dynamicStates() const;
+
     /// @brief Set dispatch parameters
     Drawable & dispatch(const ComputePipeline::DispatchParameters &);
 
@@ -1997,6 +2453,53 @@ public:
         vk::ArrayProxy<const vk::Semaphore> signalSemaphores {};
     };
 
+    /// @brief Parameters to record draw packs into secondary command buffers in parallel. See renderParallel().
+    struct ParallelRenderParameters {
+        /// The draw packs to render, in order.
+        vk::ArrayProxy<const Ref<const DrawPack>> packs {};
+
+        /// The render pass and subpass that the secondary command buffers are executed in. The framebuffer is optional.
+        vk::RenderPass  renderPass {};
+        uint32_t        subpass = 0;
+        vk::Framebuffer framebuffer {};
+
+        /// Viewports and scissors to set at the beginning of each secondary command buffer, since secondary command
+        /// buffers don't inherit dynamic states from the primary one. Leave them empty, if the pipelines use static ones.
+        vk::ArrayProxy<const vk::Viewport> viewports {};
+        vk::ArrayProxy<const vk::Rect2D>   scissors {};
+
+        /// Max number of secondary command buffers, each one is recorded on its own thread. 0 means the number of
+        /// hardware threads.
+        uint32_t threads = 0;
+
+        /// Min number of draw packs recorded by each thread. Fewer threads are used for smaller batches.
+        uint32_t minPacksPerThread = 64;
+
+        ParallelRenderParameters & setPacks(vk::ArrayProxy<const Ref<const DrawPack>> v) {
+            packs = v;
+            return *this;
+        }
+
+        ParallelRenderParameters & setRenderPass(vk::RenderPass pass, uint32_t subpass_ = 0, vk::Framebuffer framebuffer_ = {}) {
+            renderPass  = pass;
+            subpass     = subpass_;
+            framebuffer = framebuffer_;
+            return *this;
+        }
+
+        ParallelRenderParameters & setViewportAndScissor(vk::ArrayProxy<const vk::Viewport> viewports_, vk::ArrayProxy<const vk::Rect2D> scissors_) {
+            viewports = viewports_;
+            scissors  = scissors_;
+            return *this;
+        }
+
+        ParallelRenderParameters & setThreads(uint32_t count, uint32_t minPacks = 64) {
+            threads           = count;
+            minPacksPerThread = minPacks;
+            return *this;
+        }
+    };
+
     CommandBuffer(Impl * impl = nullptr): _impl(impl) {}
     CommandBuffer(const CommandBuffer & o): _impl(o._impl) {}
     ~CommandBuffer() = default;
@@ -2018,11 +2521,34 @@ public:
     /// @brief Enqueue a draw pack to the queue to be rendered later.
     /// The drawable and the associated resources are considered in-use until the command buffer is dropped or finished executing on GPU.
     /// Deleting the drawable object before the command buffer is dropped or finished executing on GPU will result in undefined behavior.
+    /// States that are identical to the previously rendered draw pack are not recorded again. So after changing pipeline,
+    /// descriptor sets, push constants, dynamic states or vertex/index buffers directly through handle() in between
+    /// render() calls, call invalidateState() before the next render() call. GraphicsPipeline::cmdDraw() and
+    /// ComputePipeline::cmdDispatch() do that automatically, when they are given the CommandBuffer object.
     const CommandBuffer & render(Ref<const DrawPack>) const;
 
     /// @brief Enqueue a draw pack to the queue to be rendered later.
     CommandBuffer & render(Ref<const DrawPack>);
 
+    /// @brief Render a sequence of draw packs in order. When GlobalInfo::multiDrawIndirect is true, runs of adjacent
+    /// draw packs that are mergeable() are rendered with one indirect draw call. The draw commands are written into a
+    /// host visible buffer owned by the command buffer. Sort the packs (see RenderQueue) to get longer runs.
+    const CommandBuffer & render(vk::ArrayProxy<const Ref<const DrawPack>>) const;
+
+    /// @brief Render a sequence of draw packs in order, merging compatible ones into indirect draws.
+    CommandBuffer & render(vk::ArrayProxy<const Ref<const DrawPack>>);
+
+    /// @brief Split the draw packs into chunks, record each chunk into a secondary command buffer on its own thread,
+    /// then execute the secondary command buffers in order from this one. Blocks until all chunks are recorded.
+    /// This must be a primary command buffer that is inside the render pass subpass, which is begun with
+    /// vk::SubpassContents::eSecondaryCommandBuffers. The secondary command buffers are owned by this one, and are
+    /// recycled along with it.
+    CommandBuffer & renderParallel(const ParallelRenderParameters &);
+
+    /// @brief Forget the states recorded by previous render() calls, so the next render() call records all of its
+    /// states again. Call this after binding states directly through handle().
+    const CommandBuffer & invalidateState() const;
+
     CommandBuffer & operator=(const CommandBuffer & o) {
         _impl = o._impl;
         return *this;
@@ -2045,22 +2571,127 @@ private:
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
-/// A wrapper class for VkQueue
+/// @brief A queue of draw packs, that are sorted to minimize state changes before being recorded into command buffer.
+///
+/// Draw packs are sorted by pipeline, then by content of descriptor sets, then by vertex and index buffers, and at last
+/// by the user provided key. Pipelines are ordered by their first appearance in the queue. Packs with identical sort
+/// keys keep their submission order. The object is not thread safe.
+class RenderQueue : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        /// Set to true to let flush() merge runs of compatible draw packs into indirect draws. See CommandBuffer::render().
+        bool mergeDraws = false;
+
+        ConstructParameters & setMergeDraws(bool v = true) {
+            mergeDraws = v;
+            return *this;
+        }
+    };
+
+    // A "= {}" default argument can't be used here, since ConstructParameters has default member initializers, which
+    // are not available until the enclosing class is complete.
+    RenderQueue(): RenderQueue(ConstructParameters {}) {}
+
+    RenderQueue(const ConstructParameters &);
+
+    ~RenderQueue() override;
+
+    /// @brief Add a draw pack to the queue. Empty packs are ignored.
+    /// @param key Sort key among packs with the same states, such as quantized depth or priority. Lower key goes first.
+    RenderQueue & add(Ref<const DrawPack>, uint32_t key = 0);
+
+    /// @brief Number of draw packs in the queue.
+    size_t size() const;
+
+    /// @brief Remove all draw packs from the queue.
+    void clear();
+
+    /// @brief Sort the draw packs in place. Returns them in render order.
+    auto sort() -> const std::vector<Ref<const DrawPack>> &;
+
+    /// @brief Sort the draw packs, render them into the command buffer, then clear the queue.
+    /// @return Number of draw packs in the queue before the flush.
+    size_t flush(CommandBuffer &);
+
+private:
+    class Impl;
+    Impl * _impl = nullptr;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// A wrapper class for VkQueue. All methods are thread safe. Each thread reuses the command buffers that it began
+/// before, so recording threads rarely contend with each other. Once all command buffers of a thread are retired, they
+/// could be taken over by other threads, so threads that stop recording don't keep them forever. The VkQueue is locked
+/// only for vkQueueSubmit(). The lock is shared by all CommandQueue objects of the same VkQueue (see
+/// GlobalInfo::queueMutexes).
 class CommandQueue : public Root {
 public:
     struct ConstructParameters : public Root::ConstructParameters {
         const GlobalInfo * gi     = nullptr;
         uint32_t           family = 0; ///< queue family index
         uint32_t           index  = 0; ///< queue index within family
+
+        /// Set to true to allocate command buffers out of per-thread shared command pools, instead of one pool for each
+        /// command buffer. A recording thread keeps allocating from the same pool until it submits. The pool is then
+        /// reset as a whole once all of its command buffers are finished. In this mode, a command buffer must be
+        /// recorded on the thread that begins it.
+        bool pooled = false;
+
+        /// Max number of descriptor sets cached by the queue. Cached sets are reused by command buffers of this queue
+        /// across frames, as long as their content is identical, without being allocated and written again. Set to 0 to
+        /// disable the cache. Note that a cached set keeps the draw pack that creates it (and all resources referenced
+        /// by the draw pack) alive until the set is evicted from the cache.
+        size_t descriptorSetCacheCapacity = 0;
+
+        ConstructParameters & setPooled(bool v) {
+            pooled = v;
+            return *this;
+        }
+
+        ConstructParameters & setDescriptorSetCacheCapacity(size_t v) {
+            descriptorSetCacheCapacity = v;
+            return *this;
+        }
     };
 
     struct Desc {
         const GlobalInfo * gi     = nullptr;
         vk::Queue          handle = {};
-        uint32_t           family = 0; ///< queue family index
-        uint32_t           index  = 0; ///< queue index within family
+        uint32_t           family                     = 0;     ///< queue family index
+        uint32_t           index                      = 0;     ///< queue index within family
+        bool               pooled                     = false; ///< true, if command buffers are allocated out of per-thread shared command pools.
+        size_t             descriptorSetCacheCapacity = 0;     ///< max number of cached descriptor sets. 0 means cache is disabled.
+    };
+
+    /// @brief unique identifier of a GPU submission
+    struct SubmissionID {
+        int64_t queue {};
+        int64_t index {};
+
+        bool empty() const { return !queue || 0 == index; }
+
+        bool newerThan(int64_t other) const { return index - other > 0; }
+
+        bool olderThan(int64_t other) const { return index - other < 0; }
+
+        void wait() const {
+            if (empty()) return;
+            auto q = (CommandQueue *) (intptr_t) queue;
+            q->wait(*this);
+        }
+
+        bool finished() const {
+            if (empty()) return true;
+            auto q = (CommandQueue *) (intptr_t) queue;
+            return q->finished(*this);
+        }
+
+        operator bool() const { return !empty(); }
     };
 
+    /// @brief Parameters of submit(). A submission without any valid command buffer still goes to the queue, if it has
+    /// semaphores or submissions to wait for or to signal, so they take effect. Only a submission that has none of them
+    /// is skipped: submit() then returns an empty SubmissionID, and the fence is not signaled.
     struct SubmitParameters {
         /// @brief The command buffers to submit. The command buffers must be allocated out of this queue class.
         vk::ArrayProxy<const CommandBuffer> commandBuffers {};
@@ -2068,29 +2699,59 @@ public:
         /// The (optional) fence object to signal once the command buffers have completed execution.
         vk::Fence signalFence = {};
 
-        /// @brief List of semaphores to wait for before executing the command buffers.
+        /// @brief List of semaphores to wait for before executing the command buffers. All commands of the command
+        /// buffers wait for them. Use submitBatches() to specify the stages.
         vk::ArrayProxy<const vk::Semaphore> waitSemaphores {};
 
         /// @brief List of semaphores to signal once the command buffers have completed execution.
         vk::ArrayProxy<const vk::Semaphore> signalSemaphores {};
+
+        /// @brief List of submissions, usually from other queues, to wait for on GPU before executing the command
+        /// buffers. See Batch::waitSubmissions for details.
+        vk::ArrayProxy<const SubmissionID> waitSubmissions {};
     };
 
-    /// @brief unique identifier of a GPU submission
-    struct SubmissionID {
-        int64_t queue {};
-        int64_t index {};
+    /// @brief A semaphore to wait for or to signal, along with the pipeline stages that are synchronized with it.
+    /// Maps to VkSemaphoreSubmitInfo. The stages of signal operations are ignored without synchronization2.
+    struct SemaphoreSubmit {
+        vk::Semaphore           semaphore {};
+        vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eAllCommands;
+        uint64_t                value  = 0; ///< the value to wait for or to signal. Ignored by binary semaphores.
+    };
 
-        bool empty() const { return !queue || 0 == index; }
+    /// @brief One batch of command buffers, along with the semaphores it waits for and signals. See submitBatches().
+    struct Batch {
+        /// @brief The command buffers to submit. The command buffers must be allocated out of this queue class.
+        vk::ArrayProxy<const CommandBuffer> commandBuffers {};
 
-        bool newerThan(int64_t other) const { return index - other > 0; }
+        /// @brief Semaphores to wait for before executing the command buffers.
+        vk::ArrayProxy<const SemaphoreSubmit> waitSemaphores {};
 
-        bool olderThan(int64_t other) const { return index - other < 0; }
+        /// @brief Semaphores to signal once the command buffers have completed execution.
+        vk::ArrayProxy<const SemaphoreSubmit> signalSemaphores {};
 
-        void wait() const {
-            if (empty()) return;
-            auto q = (CommandQueue *) (intptr_t) queue;
-            q->wait(*this);
-        }
+        /// @brief Submissions to wait for on GPU before executing the command buffers. They can come from any queue of
+        /// the same device. The library waits for the timeline semaphores of their queues, so no CPU round trip is
+        /// needed. Without timeline semaphore support, the submissions are waited for on CPU instead.
+        vk::ArrayProxy<const SubmissionID> waitSubmissions {};
+
+        /// @brief The stages that wait for the submissions.
+        vk::PipelineStageFlags2 waitSubmissionStages = vk::PipelineStageFlagBits2::eAllCommands;
+    };
+
+    /// @brief Consecutive submissions made by one submitBatches() call, one for each batch.
+    struct SubmissionRange {
+        int64_t  queue {};
+        int64_t  first {}; ///< index of the submission of the first batch.
+        uint32_t count {};
+
+        bool empty() const { return !queue || 0 == count; }
+
+        /// @brief Returns the submission of the i-th batch.
+        SubmissionID operator[](uint32_t i) const { return {queue, first + i}; }
+
+        /// @brief Returns the submission of the last batch. Submissions finish in order. So it covers the whole range.
+        SubmissionID back() const { return empty() ? SubmissionID {} : SubmissionID {queue, first + count - 1}; }
 
         operator bool() const { return !empty(); }
     };
@@ -2104,12 +2765,23 @@ public:
     /// @brief Begin recording a command buffer.
     CommandBuffer begin(const char * name, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
 
+    /// @brief Begin recording a secondary command buffer with the inheritance info. The command buffer continues the
+    /// render pass, if the inheritance info has one. Secondary command buffers can't be submitted directly. Use
+    /// CommandBuffer::renderParallel() to record and execute them from a primary command buffer.
+    CommandBuffer begin(const char * name, const vk::CommandBufferInheritanceInfo &);
+
     /// @brief Submit command buffers to the queue for asynchronous processing.
     /// After this call, all command buffer pointers are inaccessible. The caller should not use them anymore.
     /// @return A submission ID that later to check/wait for the completion of the submission. Return an empty
     /// handle on failure.
     SubmissionID submit(const SubmitParameters &);
 
+    /// @brief Submit several batches with one driver call, which is vkQueueSubmit2() when GlobalInfo::synchronization2
+    /// is true, or vkQueueSubmit() otherwise. Each batch waits for and signals its own semaphores.
+    /// @param signalFence The (optional) fence object to signal once all batches have completed execution.
+    /// @return Submissions of the batches. Returns an empty range on failure.
+    SubmissionRange submitBatches(vk::ArrayProxy<const Batch> batches, vk::Fence signalFence = {});
+
     /// @brief Drop command buffers. Discard all contents of them.
     /// After this call, the command buffer pointers are inaccessible. The caller should not use them anymore.
     void drop(vk::ArrayProxy<const CommandBuffer>);
@@ -2122,6 +2794,20 @@ public:
     /// @brief Wait for all submitted work to finish.
     CommandQueue & waitIdle();
 
+    /// @brief Check if a submission has finished execution on GPU. This is a non-blocking call.
+    /// Empty submission is always considered finished.
+    bool finished(const SubmissionID &);
+
+    /// @brief Returns number of submissions that are not finished on GPU yet. This is a non-blocking call.
+    size_t pendingSubmissions();
+
+    /// @brief Returns the semaphore waits that submit() uses for Batch::waitSubmissions: one wait on the timeline
+    /// semaphore of each queue, for the newest of its submissions. Useful to make work submitted through other means
+    /// wait for the submissions. Submissions of queues without timeline semaphore are waited on CPU instead, before
+    /// this call returns. Empty and invalid submissions are ignored.
+    std::vector<SemaphoreSubmit> submissionWaits(vk::ArrayProxy<const SubmissionID>,
+                                                 vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eAllCommands);
+
     auto gi() const -> const GlobalInfo * { return desc().gi; }
     auto family() const -> uint32_t { return desc().family; }
     auto index() const -> uint32_t { return desc().index; }
@@ -2129,12 +2815,182 @@ public:
 
     /// @brief Create another queue object that shares the same underlying queue handle.
     CommandQueue clone(const std::string & newName = {}) const {
-        return CommandQueue {ConstructParameters {{newName.empty() ? name() : newName}, gi(), family(), index()}};
+        return CommandQueue {
+            ConstructParameters {{newName.empty() ? name() : newName}, gi(), family(), index(), desc().pooled, desc().descriptorSetCacheCapacity}};
     }
 
 protected:
     void onNameChanged(const std::string &) override;
 
+private:
+    friend class CommandBuffer;
+    class Impl;
+    Impl * _impl = nullptr;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// A persistently mapped ring buffer used to stage transient upload data. Small allocations are sub-allocated out of
+/// the ring and recycled once the submission that consumes them is finished on GPU. Allocations that don't fit into
+/// the ring fall back to a dedicated staging buffer.
+class StagingRing : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        const GlobalInfo * gi       = nullptr;
+        vk::DeviceSize     capacity = 32 * 1024 * 1024; ///< size of the ring buffer in bytes.
+
+        ConstructParameters & setCapacity(vk::DeviceSize v) {
+            capacity = v;
+            return *this;
+        }
+    };
+
+    /// @brief A chunk of host visible memory that is ready for CPU to write to.
+    struct Allocation {
+        vk::Buffer     buffer = {};      ///< the buffer that the allocation belongs to.
+        vk::DeviceSize offset = 0;       ///< byte offset of the allocation within the buffer.
+        vk::DeviceSize size   = 0;       ///< size of the allocation in bytes.
+        uint8_t *      data   = nullptr; ///< CPU address of the allocation.
+        int64_t        id     = 0;       ///< internal ID of the allocation. 0 means the allocation is empty.
+        Ref<Buffer>    dedicated;        ///< the dedicated staging buffer, if the allocation doesn't fit into the ring.
+
+        bool empty() const { return 0 == id; }
+
+        operator bool() const { return !empty(); }
+    };
+
+    StagingRing(const ConstructParameters &);
+
+    ~StagingRing() override;
+
+    auto capacity() const -> vk::DeviceSize;
+
+    /// @brief Allocate a chunk of host visible memory out of the ring.
+    /// The allocation must be released by calling release() after it is submitted to GPU (or dropped).
+    Allocation allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+
+    /// @brief Return the allocation back to the ring. The memory will be reused only after the submission is finished.
+    /// Pass an empty submission ID to release the allocation immediately, e.g. when the upload is cancelled.
+    void release(const Allocation &, const CommandQueue::SubmissionID & = {});
+
+    /// @brief Submit uploads to the queue's hardware queue through the queue object itself, instead of a private one. So
+    /// uploads share the same timeline with other work of the queue. The queue must outlive the ring. Device calls this
+    /// for all of its queues.
+    void setQueue(CommandQueue &);
+
+    /// @brief Get a queue object that can be used to submit upload commands to the specified hardware queue.
+    /// Returns the one set by setQueue(), if there's any. Or else, the ring creates a private queue object, which shares
+    /// the underlying VkQueue handle (and its lock, see GlobalInfo::queueMutexes) with the other queue objects.
+    CommandQueue & queue(uint32_t family, uint32_t index);
+
+private:
+    class Impl;
+    Impl * _impl = nullptr;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Collect many buffer and image uploads into one command buffer, then submit them to GPU all at once, asynchronously.
+/// Unlike Buffer::setContent() and Image::setContent(), this class never blocks CPU on GPU.
+class UploadBatch : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        CommandQueue * queue = nullptr; ///< the queue that the uploads are submitted to.
+
+        ConstructParameters & setQueue(CommandQueue & q) {
+            queue = &q;
+            return *this;
+        }
+    };
+
+    UploadBatch(const ConstructParameters &);
+
+    /// @brief Uploads that are not submitted yet are dropped.
+    ~UploadBatch() override;
+
+    /// @brief Enqueue a buffer upload. The queue family and index in the parameters are ignored.
+    /// The source data is copied into staging memory right away. So it is safe to release the source data after this call.
+    UploadBatch & setContent(const Buffer &, const Buffer::SetContentParameters &);
+
+    /// @brief Enqueue an image upload. The queue family and index in the parameters are ignored.
+    /// Once the upload is executed, the subresource will be in vk::ImageLayout::eTransferDstOptimal layout.
+    UploadBatch & setContent(const Image &, const Image::SetContentParameters &);
+
+    /// @brief Number of uploads that are enqueued since last submit.
+    size_t pending() const;
+
+    /// @brief Submit all enqueued uploads in one submission. The batch is ready to accept new uploads after this call.
+    /// The uploaded content is visible to all commands submitted to the same queue afterwards.
+    /// @return The submission ID to wait for. Empty if there's nothing to submit.
+    CommandQueue::SubmissionID submit();
+
+private:
+    class Impl;
+    Impl * _impl = nullptr;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// A pool of host visible (and host cached, when available) buffers used to read data back from GPU without blocking.
+/// The copy commands are recorded into caller provided command buffer. Readback buffers are recycled by the pool.
+class ReadbackPool : public Root {
+public:
+    struct ConstructParameters : public Root::ConstructParameters {
+        const GlobalInfo * gi = nullptr;
+    };
+
+    /// @brief Non-owning view of the read back data.
+    struct Span {
+        const uint8_t * data = nullptr;
+        size_t          size = 0;
+
+        bool            empty() const { return !data || !size; }
+        const uint8_t * begin() const { return data; }
+        const uint8_t * end() const { return data + size; }
+    };
+
+    /// @brief A readback in flight. The readback buffer goes back to the pool when the last copy of this object is gone
+    /// and the submission is finished on GPU. A buffer that is never submitted is not reused.
+    struct Readback {
+        std::shared_ptr<void>                  slot;         ///< (internal) the readback buffer that holds the data.
+        const uint8_t *                        mapped = nullptr;
+        vk::DeviceSize                         size   = 0;
+        std::vector<Image::SubresourceContent> subresources; ///< layout of image subresources in the data. Empty for buffer readback.
+
+        bool empty() const { return !slot; }
+
+        /// @brief Set the submission that contains the copy commands. This has to be called after the command buffer is submitted.
+        /// The submission is stored in the readback buffer, so it is seen by all copies of this object.
+        Readback & setSubmission(const CommandQueue::SubmissionID & s);
+
+        /// @brief The submission that contains the copy commands. Empty, if setSubmission() is not called yet.
+        CommandQueue::SubmissionID submission() const;
+
+        /// @brief Check if the data is ready to read. This is a non-blocking call.
+        bool ready() const {
+            auto s = submission();
+            return !s.empty() && s.finished();
+        }
+
+        /// @brief Get the data. Returns empty span, if the data is not ready yet.
+        Span data() const { return ready() ? Span {mapped, (size_t) size} : Span {}; }
+
+        /// @brief Block until the data is ready, then return it.
+        Span wait() const {
+            if (empty()) return {};
+            submission().wait();
+            return data();
+        }
+    };
+
+    ReadbackPool(const ConstructParameters &);
+
+    ~ReadbackPool() override;
+
+    /// @brief Record commands to copy a range of the buffer into a readback buffer.
+    Readback cmdRead(vk::CommandBuffer, const Buffer &, vk::DeviceSize offset = 0, vk::DeviceSize size = vk::DeviceSize(-1));
+
+    /// @brief Record commands to copy a range of subresources of the image into a readback buffer.
+    /// The queue family and index in the parameters are ignored. The subresources are transferred to eTransferSrcOptimal layout.
+    Readback cmdRead(vk::CommandBuffer, const Image &, const Image::ReadContentParameters & = {});
+
 private:
     class Impl;
     Impl * _impl = nullptr;
@@ -2278,6 +3134,9 @@ public:
         /// When built-in render pass ends, the back buffer image will be automatically transitioned into status suitable for present().
         BackbufferStatus backbufferStatus = {vk::ImageLayout::ePresentSrcKHR, vk::AccessFlagBits::eMemoryRead, vk::PipelineStageFlagBits::eBottomOfPipe};
 
+        /// @brief Set to vk::SubpassContents::eSecondaryCommandBuffers to render with CommandBuffer::renderParallel().
+        vk::SubpassContents contents = vk::SubpassContents::eInline;
+
         BeginRenderPassParameters & setClearColorF(vk::ArrayProxy<const float> color) {
             clearColor.setFloat32({color.size() > 0 ? color.data()[0] : 0.f, color.size() > 1 ? color.data()[1] : 0.f, color.size() > 2 ? color.data()[2] : 0.f,
                                    color.size() > 3 ? color.data()[3] : 1.f});
@@ -2288,6 +3147,11 @@ public:
             clearDepth = vk::ClearDepthStencilValue(depth_, stencil_);
             return *this;
         }
+
+        BeginRenderPassParameters & setContents(vk::SubpassContents v) {
+            contents = v;
+            return *this;
+        }
     };
 
     /// @brief Specify parameters to call present().
@@ -2422,6 +3286,23 @@ public:
         /// Set to true to create VMA allocator and store in the GlobalInfo::vmaAllocator field.
         bool enableVmaAllocator = true;
 
+        /// Size of the device wide staging ring (GlobalInfo::stagingRing) in bytes. Set to 0 to disable it.
+        vk::DeviceSize stagingRingSize = 32 * 1024 * 1024;
+
+        /// Set to true to create the device queues in pooled mode. See CommandQueue::ConstructParameters::pooled for details.
+        bool pooledCommandBuffers = false;
+
+        /// Priorities of the queues to create in each queue family, one queue for each element. The list is truncated
+        /// to the number of queues that the family supports. Priorities out of [0, 1] are clamped. Empty means one
+        /// queue of priority 1.0.
+        std::vector<float> queuePriorities {};
+
+        /// Overrides queuePriorities for individual queue families, keyed by family index.
+        std::map<uint32_t, std::vector<float>> familyQueuePriorities {};
+
+        /// Path of the device wide pipeline cache file (GlobalInfo::pipelineCache). Empty means in-memory cache only.
+        std::string pipelineCachePath {};
+
         /// set to false to make the creation log less verbose.
         Verbosity printVkInfo = BRIEF;
 
@@ -2453,12 +3334,80 @@ public:
             return *this;
         }
 
+        ConstructParameters & setStagingRingSize(vk::DeviceSize v) {
+            stagingRingSize = v;
+            return *this;
+        }
+
+        ConstructParameters & setPooledCommandBuffers(bool b) {
+            pooledCommandBuffers = b;
+            return *this;
+        }
+
+        ConstructParameters & setQueuePriorities(std::vector<float> v) {
+            queuePriorities = std::move(v);
+            return *this;
+        }
+
+        ConstructParameters & setFamilyQueuePriorities(uint32_t family, std::vector<float> v) {
+            familyQueuePriorities[family] = std::move(v);
+            return *this;
+        }
+
+        ConstructParameters & setPipelineCachePath(const std::string & v) {
+            pipelineCachePath = v;
+            return *this;
+        }
+
         ConstructParameters & setPrintVkInfo(Verbosity v) {
             printVkInfo = v;
             return *this;
         }
     };
 
+    /// All queues of one queue family. Independent workloads can be spread over them to be submitted concurrently,
+    /// since each VkQueue has its own lock (see GlobalInfo::queueMutexes).
+    class QueueSet {
+    public:
+        RVI_NO_COPY_NO_MOVE(QueueSet);
+
+        QueueSet(uint32_t family, std::vector<CommandQueue *> queues): _family(family), _queues(std::move(queues)) {}
+
+        ~QueueSet() {
+            for (auto q : _queues) delete q;
+        }
+
+        uint32_t family() const { return _family; }
+
+        size_t size() const { return _queues.size(); }
+
+        CommandQueue * operator[](size_t i) const { return _queues[i]; }
+
+        auto begin() const { return _queues.begin(); }
+
+        auto end() const { return _queues.end(); }
+
+        /// Returns the queues in turn.
+        CommandQueue * next() const { return _queues[_next++ % _queues.size()]; }
+
+        /// Returns the queue with the fewest unfinished submissions.
+        CommandQueue * leastLoaded() const {
+            CommandQueue * best = nullptr;
+            size_t         load = 0;
+            for (auto q : _queues) {
+                auto n = q->pendingSubmissions();
+                if (!best || n < load) best = q, load = n;
+                if (0 == load) break;
+            }
+            return best;
+        }
+
+    private:
+        uint32_t                      _family;
+        std::vector<CommandQueue *>   _queues;
+        mutable std::atomic<uint32_t> _next {};
+    };
+
     Device(const ConstructParameters &);
 
     ~Device();
@@ -2475,6 +3424,9 @@ public:
     /// the async transfer queue. could be null if the device does not support async transfer.
     CommandQueue * transfer() const { return _transfer; }
 
+    /// All queues of the queue family. The first one is the default queue of the family. Null if the family doesn't exist.
+    const QueueSet * queues(uint32_t family) const { return family < _queueSets.size() ? _queueSets[family] : nullptr; }
+
     void waitIdle() const { return threadSafeWaitForDeviceIdle(_gi.device); }
 
     vk::Device handle() const { return _gi.device; }
@@ -2488,10 +3440,14 @@ public:
 private:
     ConstructParameters         _cp;
     GlobalInfo                  _gi {};
-    std::vector<CommandQueue *> _queues; // one for each queue family
-    CommandQueue *              _graphics = nullptr;
-    CommandQueue *              _compute  = nullptr;
-    CommandQueue *              _transfer = nullptr;
+    std::vector<QueueSet *>     _queueSets;    // one for each queue family
+    GlobalInfo::QueueMutexMap   _queueMutexes; // one for each queue. See GlobalInfo::queueMutexes.
+    CommandQueue *              _graphics         = nullptr;
+    CommandQueue *              _compute          = nullptr;
+    CommandQueue *              _transfer         = nullptr;
+    StagingRing *               _stagingRing      = nullptr;
+    PipelineCache *             _pipelineCache    = nullptr;
+    PipelineRegistry *          _pipelineRegistry = nullptr;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------